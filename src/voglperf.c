@@ -30,20 +30,36 @@
 #include <syslog.h>
 #include <string.h>
 #include <ctype.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <time.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/msg.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <execinfo.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 #define __USE_GNU
 #include <dlfcn.h>
 #include <errno.h>
 
 #include <GL/glx.h>
+#include <EGL/egl.h>
 
 #include "voglperf.h"
+#include "voglperf_log.h"
+#include "voglperf_hist.h"
+#include "voglperf_swap.h"
 
 #define OS_POSIX
 #include "eintr_wrapper.h"
@@ -55,19 +71,92 @@
 //----------------------------------------------------------------------------------------------------------------------
 static int g_showfps = 0;
 static int g_verbose = 0;
-
-// If we write 4000 frametimes of '0.25 ', that would be 20,000 bytes. So 32k should be enough to
-// handle a full second of reasonable frametimes.
+static int g_gputime = 0;   // Time frames on the GPU with timer queries.
+static int g_glfinish = 0;  // glFinish after every swap.
+static uint32_t g_fpslimit = 0; // Frame rate cap (--fpslimit), 0 for none. Changed by MSGTYPE_OPTIONS from any thread.
+static float g_hitch_factor = 2.5f; // Frames this many times the rolling median are hitches (--hitch-factor), 0 for off.
+static uint64_t g_hitch_budget = 0; // Frames longer than this (ns) are hitches (--hitch-ms), 0 for off.
+
+// Logfile currently being captured (empty if none) and CLOCK_MONOTONIC time (ns) to stop it (0 for never).
+// Swaps on any thread can open or close the logfile, so changes go through g_logfile_lock.
+static pthread_mutex_t g_logfile_lock = PTHREAD_MUTEX_INITIALIZER;
 static char g_logfile_name[PATH_MAX];
-static int g_logfile_buf_len = 0;
-static char g_logfile_buf[32 * 1024];
-static int g_logfile_fd = -1;
-static uint64_t g_logfile_time = 0;
+static uint64_t g_logfile_time_end = 0;
+
+// Flight recorder dump waiting for the rest of its window to be recorded (voglperf_logfile_dump_deferred), also
+// g_logfile_lock. Written early if the process exits first.
+static char g_dump_name[PATH_MAX];
+static uint64_t g_dump_time_start = 0; // Time (ns) it captures from.
+static uint64_t g_dump_time_end = 0;   // Time (ns) to write it, 0 if there isn't one waiting.
 
 static int g_msqid = -1;
 
+// Socket voglperfrun sleeps on, rung after every message we queue (-1 if it isn't listening).
+static int g_doorbell_fd = -1;
+
+// Messages dropped because the queue was full. Reported in every fps message.
+static uint32_t g_msgs_dropped = 0;
+
+// getpid(), for tagging frames and messages with the process they came from.
+static uint32_t g_pid = 0;
+
+// Shared memory frame ring from voglperfrun (--shmid).
+static struct voglperf_frame_ring_t *g_frame_ring = NULL;
+static uint64_t g_command_count = 0;    // Control block commands we've seen (control_update).
+
 __attribute__((destructor)) static void vogl_perf_destructor_func();
-static void voglperf_swap_buffers(Display *dpy, GLXDrawable drawable, int flush_logfile);
+static void voglperf_atfork_child();
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_msgsnd
+//  Sends the first size bytes of mbuf to voglperfrun as a type message (see Wire format in voglperf.h), ringing its
+//  doorbell so it wakes up and reads it right away.
+//----------------------------------------------------------------------------------------------------------------------
+static int voglperf_msgsnd(uint16_t type, void *mbuf, size_t size, int msgflg)
+{
+    struct voglperf_msgbuf_t msgbuf;
+    size_t len = voglperf_msg_pack(&msgbuf, type, mbuf, size);
+    int ret = msgsnd(g_msqid, &msgbuf, len, msgflg);
+    int err = errno;
+
+    // A full queue means voglperfrun has fallen behind for a moment. Count it and carry on; it gets rung again below
+    //  to catch up.
+    if ((ret == -1) && (err == EAGAIN))
+        __atomic_add_fetch(&g_msgs_dropped, 1, __ATOMIC_RELAXED);
+
+    // A full doorbell just means voglperfrun already has a wakeup pending.
+    if (((ret == 0) || (err == EAGAIN)) && (g_doorbell_fd != -1))
+        send(g_doorbell_fd, "", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    errno = err;
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// doorbell_connect
+//----------------------------------------------------------------------------------------------------------------------
+static void doorbell_connect(int msqid)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+    if (fd == -1)
+        return;
+
+    // Abstract socket: leading nul, no file to clean up.
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, VOGLPERF_DOORBELL_NAME, msqid);
+
+    if (connect(fd, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + 1 + len) != 0)
+    {
+        syslog(LOG_INFO, "(voglperf) doorbell connect failed: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    g_doorbell_fd = fd;
+}
 
 #define VOGL_X11_SYM(rc, fn, params, args, ret) \
     typedef rc (*VOGL_DYNX11FN_##fn) params;    \
@@ -76,27 +165,267 @@ static void voglperf_swap_buffers(Display *dpy, GLXDrawable drawable, int flush_
 VOGL_X11_SYM(XFontStruct *, XLoadQueryFont, (Display *a, _Xconst char *b), (a, b), return)
 VOGL_X11_SYM(GC, XCreateGC, (Display *a, Drawable b, unsigned long c, XGCValues *d), (a, b, c, d), return)
 VOGL_X11_SYM(int, XDrawString, (Display *a, Drawable b, GC c, int d, int e, _Xconst char *f, int g), (a, b, c, d, e, f, g), return)
+VOGL_X11_SYM(int, XFreeGC, (Display *a, GC b), (a, b), return)
+
+//----------------------------------------------------------------------------------------------------------------------
+// hook table
+//  Every entry point we interpose on, with the real function it wraps. Real pointers are looked up once when we're
+//  loaded. Anything that isn't there yet (libEGL dlopened later, extensions only available through
+//  GetProcAddress) is looked up again the first time it's called. glXGetProcAddress[ARB] and eglGetProcAddress find
+//  names in a perfect hash, so handing out hooks costs one hash and one strcmp no matter how many there are.
+//
+//  X(name, gpa, lookup, return type, params)
+//    gpa:    HOOK_GPA_GLX or HOOK_GPA_EGL if that API's GetProcAddress should hand out our hook, else HOOK_GPA_NONE.
+//    lookup: HOOK_EXPORTED if the real function is exported by the library, HOOK_EXTENSION if it might only be
+//            available through the API's GetProcAddress.
+//----------------------------------------------------------------------------------------------------------------------
+#define VOGL_HOOKS(X)                                                                                                           \
+    X(glXSwapBuffers,              HOOK_GPA_GLX,  HOOK_EXPORTED,  void, (Display *dpy, GLXDrawable drawable))                   \
+    X(glXSwapBuffersMscOML,        HOOK_GPA_GLX,  HOOK_EXTENSION, int64_t, (Display *dpy, GLXDrawable drawable,                \
+                                                                            int64_t target_msc, int64_t divisor, int64_t remainder)) \
+    X(glXMakeCurrent,              HOOK_GPA_GLX,  HOOK_EXPORTED,  Bool, (Display *dpy, GLXDrawable drawable, GLXContext ctx))   \
+    X(glXMakeContextCurrent,       HOOK_GPA_GLX,  HOOK_EXPORTED,  Bool, (Display *dpy, GLXDrawable draw, GLXDrawable read,      \
+                                                                         GLXContext ctx))                                       \
+    X(glXMakeCurrentReadSGI,       HOOK_GPA_GLX,  HOOK_EXTENSION, Bool, (Display *dpy, GLXDrawable draw, GLXDrawable read,      \
+                                                                         GLXContext ctx))                                       \
+    X(glXDestroyWindow,            HOOK_GPA_GLX,  HOOK_EXPORTED,  void, (Display *dpy, GLXWindow drawable))                     \
+    X(glXDestroyPixmap,            HOOK_GPA_GLX,  HOOK_EXPORTED,  void, (Display *dpy, GLXPixmap drawable))                     \
+    X(glXDestroyGLXPixmap,         HOOK_GPA_GLX,  HOOK_EXPORTED,  void, (Display *dpy, GLXPixmap drawable))                     \
+    X(glXDestroyPbuffer,           HOOK_GPA_GLX,  HOOK_EXPORTED,  void, (Display *dpy, GLXPbuffer drawable))                    \
+    X(glXGetProcAddressARB,        HOOK_GPA_GLX,  HOOK_EXPORTED,  __GLXextFuncPtr, (const GLubyte *procname))                   \
+    X(glXGetProcAddress,           HOOK_GPA_GLX,  HOOK_EXPORTED,  __GLXextFuncPtr, (const GLubyte *procname))                   \
+    X(XDestroyWindow,              HOOK_GPA_NONE, HOOK_EXPORTED,  int, (Display *dpy, Window window))                           \
+    X(XDestroySubwindows,          HOOK_GPA_NONE, HOOK_EXPORTED,  int, (Display *dpy, Window window))                           \
+    X(XCloseDisplay,               HOOK_GPA_NONE, HOOK_EXPORTED,  int, (Display *dpy))                                          \
+    X(eglSwapBuffers,              HOOK_GPA_EGL,  HOOK_EXPORTED,  EGLBoolean, (EGLDisplay dpy, EGLSurface surface))             \
+    X(eglSwapBuffersWithDamageKHR, HOOK_GPA_EGL,  HOOK_EXTENSION, EGLBoolean, (EGLDisplay dpy, EGLSurface surface,              \
+                                                                               const EGLint *rects, EGLint n_rects))            \
+    X(eglSwapBuffersWithDamageEXT, HOOK_GPA_EGL,  HOOK_EXTENSION, EGLBoolean, (EGLDisplay dpy, EGLSurface surface,              \
+                                                                               const EGLint *rects, EGLint n_rects))            \
+    X(eglMakeCurrent,              HOOK_GPA_EGL,  HOOK_EXPORTED,  EGLBoolean, (EGLDisplay dpy, EGLSurface draw,                 \
+                                                                               EGLSurface read, EGLContext ctx))                \
+    X(eglDestroySurface,           HOOK_GPA_EGL,  HOOK_EXPORTED,  EGLBoolean, (EGLDisplay dpy, EGLSurface surface))             \
+    X(eglGetProcAddress,           HOOK_GPA_EGL,  HOOK_EXPORTED,  __eglMustCastToProperFunctionPointerType, (const char *procname)) \
+    X(dlopen,                      HOOK_GPA_NONE, HOOK_EXPORTED,  void *, (const char *pFile, int mode))
+
+#define HOOK_HASH_SIZE 64           // Must be a power of 2 and leave plenty of empty slots so a seed is quick to find.
+#define HOOK_HASH_MAX_SEEDS 65536
+
+typedef enum hook_gpa_t
+{
+    HOOK_GPA_NONE,
+    HOOK_GPA_GLX,
+    HOOK_GPA_EGL,
+} hook_gpa_t;
+
+typedef enum hook_lookup_t
+{
+    HOOK_EXPORTED,
+    HOOK_EXTENSION,
+} hook_lookup_t;
+
+typedef void (*hook_func_t)(void);
+
+#define HOOK_ENUM(_name, _gpa, _lookup, _ret, _params) HOOK_##_name,
+enum
+{
+    VOGL_HOOKS(HOOK_ENUM)
+    HOOK_COUNT
+};
+#undef HOOK_ENUM
+
+#define HOOK_DECLARE(_name, _gpa, _lookup, _ret, _params)    \
+    typedef _ret (*GLAPIENTRY _name##_func_ptr_t) _params;  \
+    VOGL_API_EXPORT _ret GLAPIENTRY _name _params;
+VOGL_HOOKS(HOOK_DECLARE)
+#undef HOOK_DECLARE
+
+typedef struct hook_t
+{
+    const char *name;
+    hook_gpa_t gpa;
+    hook_lookup_t lookup;
+    hook_func_t func;           // Our interposer.
+    void *real;                 // Function we're wrapping. NULL until found.
+    int warned;
+} hook_t;
+
+#define HOOK_ENTRY(_name, _gpa, _lookup, _ret, _params) { #_name, _gpa, _lookup, (hook_func_t)_name, NULL, 0 },
+static hook_t g_hooks[HOOK_COUNT] =
+{
+    VOGL_HOOKS(HOOK_ENTRY)
+};
+#undef HOOK_ENTRY
+
+typedef char hook_hash_size_check[(HOOK_COUNT * 2 <= HOOK_HASH_SIZE) ? 1 : -1];
+
+static pthread_once_t g_hooks_once = PTHREAD_ONCE_INIT;
+static uint8_t g_hook_hash[HOOK_HASH_SIZE];     // Hook index + 1 for each slot, 0 if empty.
+static uint32_t g_hook_hash_seed;
+
+//----------------------------------------------------------------------------------------------------------------------
+// hook_hash
+//  Seeded FNV-1a.
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t hook_hash(const char *name, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+
+    hash ^= hash >> 15;
+    return hash & (HOOK_HASH_SIZE - 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// hooks_init
+//  Finds a seed that gives every hook name its own slot and looks up the real functions.
+//----------------------------------------------------------------------------------------------------------------------
+static void hooks_init()
+{
+    uint32_t i;
+    uint32_t seed;
+
+    for (seed = 0; seed < HOOK_HASH_MAX_SEEDS; seed++)
+    {
+        memset(g_hook_hash, 0, sizeof(g_hook_hash));
+
+        for (i = 0; i < HOOK_COUNT; i++)
+        {
+            uint32_t slot = hook_hash(g_hooks[i].name, seed);
+
+            if (g_hook_hash[slot])
+                break;
+            g_hook_hash[slot] = (uint8_t)(i + 1);
+        }
+
+        if (i == HOOK_COUNT)
+            break;
+    }
+
+    if (seed == HOOK_HASH_MAX_SEEDS)
+    {
+        // Can't happen with the names we have, but if it ever does GetProcAddress just won't hand out hooks.
+        syslog(LOG_ERR, "(voglperf) No perfect hash seed for %d hooks.\n", HOOK_COUNT);
+        memset(g_hook_hash, 0, sizeof(g_hook_hash));
+    }
+    g_hook_hash_seed = seed;
+
+    for (i = 0; i < HOOK_COUNT; i++)
+        __atomic_store_n(&g_hooks[i].real, dlsym(RTLD_NEXT, g_hooks[i].name), __ATOMIC_RELEASE);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// hook_resolve
+//  Looks for a real function that wasn't around yet when we were loaded.
+//----------------------------------------------------------------------------------------------------------------------
+static void *hook_resolve(hook_t *hook)
+{
+    pthread_once(&g_hooks_once, hooks_init);
+
+    void *real = __atomic_load_n(&hook->real, __ATOMIC_ACQUIRE);
+    if (real)
+        return real;
+
+    real = dlsym(RTLD_NEXT, hook->name);
+
+    if (!real && (hook->lookup == HOOK_EXTENSION))
+    {
+        if (hook->gpa == HOOK_GPA_GLX)
+        {
+            glXGetProcAddressARB_func_ptr_t get_proc =
+                (glXGetProcAddressARB_func_ptr_t)hook_resolve(&g_hooks[HOOK_glXGetProcAddressARB]);
+
+            if (get_proc)
+                real = (void *)get_proc((const GLubyte *)hook->name);
+        }
+        else if (hook->gpa == HOOK_GPA_EGL)
+        {
+            eglGetProcAddress_func_ptr_t get_proc =
+                (eglGetProcAddress_func_ptr_t)hook_resolve(&g_hooks[HOOK_eglGetProcAddress]);
+
+            if (get_proc)
+                real = (void *)get_proc(hook->name);
+        }
+    }
 
-#define HOOK_FUNC(_func, _ret, ...)                                     \
-    typedef _ret (*GLAPIENTRY func_ptr_t)(__VA_ARGS__);                 \
-    static func_ptr_t s_orig_func = NULL;                               \
-    if (!s_orig_func)                                                   \
-    {                                                                   \
-        s_orig_func = (func_ptr_t)dlsym(RTLD_NEXT, _func);              \
-        if (!s_orig_func)                                               \
-        {                                                               \
-            syslog(LOG_ERR, "(voglperf) dlsym(%s) failed.\n", _func);   \
-        }                                                               \
+    if (real)
+    {
+        __atomic_store_n(&hook->real, real, __ATOMIC_RELEASE);
+    }
+    else if (!hook->warned)
+    {
+        // Missing extensions are normal, missing exports mean something's wrong with the GL/EGL install.
+        hook->warned = 1;
+        syslog((hook->lookup == HOOK_EXTENSION) ? LOG_INFO : LOG_ERR, "(voglperf) %s not found.\n", hook->name);
     }
+    return real;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// hook_real
+//----------------------------------------------------------------------------------------------------------------------
+static inline void *hook_real(int index)
+{
+    void *real = __atomic_load_n(&g_hooks[index].real, __ATOMIC_ACQUIRE);
+
+    return real ? real : hook_resolve(&g_hooks[index]);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// hook_find
+//  Our hook for procname if gpa hands it out and there's a real function behind it, else NULL.
+//----------------------------------------------------------------------------------------------------------------------
+static hook_func_t hook_find(const char *procname, hook_gpa_t gpa)
+{
+    pthread_once(&g_hooks_once, hooks_init);
+
+    uint32_t index = g_hook_hash[hook_hash(procname, g_hook_hash_seed)];
+    if (!index)
+        return NULL;
+
+    hook_t *hook = &g_hooks[index - 1];
+    if ((hook->gpa != gpa) || strcmp(hook->name, procname) || !hook_real((int)(index - 1)))
+        return NULL;
+
+    syslog(LOG_INFO, "(voglperf) GetProcAddress hooking %s.\n", procname);
+    return hook->func;
+}
+
+// Declares orig_func, the real function _func wraps.
+#define HOOK_FUNC(_func) \
+    _func##_func_ptr_t orig_func = (_func##_func_ptr_t)hook_real(HOOK_##_func)
 
-// Use get_glinfo() to get gl/vendor/renderer/version associated with dpy+drawable
+// Frame timing accumulated by voglperf_swap_buffers() for each surface (dpy + drawable), see surface_stats_t.
+typedef struct frameinfo_t
+{
+    uint64_t time_benchmark;
+    uint64_t time_last_frame;
+    uint64_t frame_min;
+    uint64_t frame_max;
+    unsigned int frame_count;
+    uint64_t time_cpu;              // App CPU and swap blocked time for this second.
+    uint64_t time_swap;
+    uint64_t time_gpu;              // GPU time and number of frames with GPU times for this second.
+    unsigned int gpu_count;
+    uint64_t time_limit;            // Time the frame limiter held frames and its worst pacing error this second.
+    uint64_t limit_error_max;
+    struct voglperf_hist_t hist;    // Frame times for this second, for percentiles.
+} frameinfo_t;
+
+// Use get_glinfo() to get gl/vendor/renderer/version associated with dpy+drawable. The cache is shared by
+// every thread, so hold g_glinfo_lock while calling it and using the entry. Entries never move, but they are
+// reused for other drawables once glinfo_evict() drops theirs.
 typedef struct glinfo_cache_t
 {
-    Display *dpy;
-    GLXDrawable drawable;
+    uint32_t surface;       // Id for this dpy+drawable in frame records and messages. GLINFO_SURFACE_NONE if evicted.
 
-    GC gc;
-    GLXContext ctx;
+    void *ctx;              // GLXContext or EGLContext.
+    struct surface_stats_t *stats; // Frame accounting shared by the threads swapping it. NULL until one does.
 
     int glstrings_valid;
     const GLubyte *vendor;   // GL_VENDOR
@@ -105,50 +434,275 @@ typedef struct glinfo_cache_t
 } glinfo_cache_t;
 
 //----------------------------------------------------------------------------------------------------------------------
-// glinfo_cache_compare
+// glinfo cache
+//  Fixed size open addressing hash table keyed by dpy+drawable, with linear probing. Keys are kept apart from
+//  the entries so a probe checks four keys per cache line, and nothing is ever allocated. Evicting a key shifts
+//  the rest of its probe chain back instead of leaving a tombstone, so chains stay as short as the live
+//  drawables make them however many pbuffers or pixmaps a game churns through. Keys can move, so each one
+//  holds the index of its entry, and entries stay put for swap threads holding on to them.
+//----------------------------------------------------------------------------------------------------------------------
+#define GLINFO_CACHE_SIZE 256                       // Max live dpy+drawables. Must be a power of 2, at most 256.
+#define GLINFO_SURFACE_NONE ((uint32_t)-1)
+#define GLINFO_DRAWABLE_EMPTY ((GLXDrawable)None)   // Never swapped, so it can mark unused keys.
+
+typedef struct glinfo_key_t
+{
+    Display *dpy;
+    GLXDrawable drawable;
+} glinfo_key_t;
+
+static pthread_mutex_t g_glinfo_lock = PTHREAD_MUTEX_INITIALIZER;
+static glinfo_key_t g_glinfo_keys[GLINFO_CACHE_SIZE] __attribute__((aligned(64)));
+static uint8_t g_glinfo_key_entries[GLINFO_CACHE_SIZE];  // g_glinfo_cache index for each key.
+static glinfo_cache_t g_glinfo_cache[GLINFO_CACHE_SIZE];
+static uint8_t g_glinfo_free[GLINFO_CACHE_SIZE];        // Evicted entries to reuse.
+static uint32_t g_glinfo_free_count = 0;
+static uint32_t g_glinfo_entry_count = 0;               // Entries handed out so far, including freed ones.
+static uint32_t g_glinfo_surface_count = 0;
+static uint32_t g_glinfo_evictions = 0;     // Bumped on every eviction so swap threads know to recheck surfaces.
+
+static void surface_stats_evict(struct surface_stats_t *stats, Display *dpy);
+static void surface_stats_release(struct surface_stats_t *stats);
+
+//----------------------------------------------------------------------------------------------------------------------
+// glinfo_hash
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t glinfo_hash(Display *dpy, GLXDrawable drawable)
+{
+    uint64_t hash = (((uint64_t)(uintptr_t)dpy >> 4) ^ (uint64_t)drawable) * 0x9e3779b97f4a7c15ULL;
+
+    return (uint32_t)(hash >> 32);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glinfo_find
+//  Returns slot for dpy+drawable. If it's not cached, returns the slot to insert it in (or -1 if the cache is
+//  full) and sets *found to 0.
 //----------------------------------------------------------------------------------------------------------------------
-static int glinfo_cache_compare(const void *elem0, const void *elem1)
+static int glinfo_find(Display *dpy, GLXDrawable drawable, int *found)
 {
-    const glinfo_cache_t *gc0 = (const glinfo_cache_t *)elem0;
-    const glinfo_cache_t *gc1 = (const glinfo_cache_t *)elem1;
+    uint32_t i;
+    uint32_t hash = glinfo_hash(dpy, drawable);
+
+    *found = 0;
+
+    for (i = 0; i < GLINFO_CACHE_SIZE; i++)
+    {
+        uint32_t slot = (hash + i) & (GLINFO_CACHE_SIZE - 1);
+        const glinfo_key_t *key = &g_glinfo_keys[slot];
+
+        if ((key->drawable == drawable) && (key->dpy == dpy))
+        {
+            *found = 1;
+            return (int)slot;
+        }
+
+        // End of the probe chain.
+        if (key->drawable == GLINFO_DRAWABLE_EMPTY)
+            return (int)slot;
+    }
 
-    if (gc0->dpy == gc1->dpy)
-        return (intptr_t)gc0->drawable - (intptr_t)gc1->drawable;
-    return (intptr_t)gc0->dpy - (intptr_t)gc1->dpy;
+    return -1;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 // get_glinfo
+//  Call with g_glinfo_lock held.
 //----------------------------------------------------------------------------------------------------------------------
 static glinfo_cache_t *get_glinfo(Display *dpy, GLXDrawable drawable)
 {
-    static size_t s_glinfo_cache_count = 0;
-    static glinfo_cache_t *s_glinfo_cache = NULL;
+    int found;
 
-    glinfo_cache_t key;
+    if (drawable == GLINFO_DRAWABLE_EMPTY)
+        return NULL;
 
-    memset(&key, 0, sizeof(key));
-    key.dpy = dpy;
-    key.drawable = drawable;
+    int slot = glinfo_find(dpy, drawable, &found);
+    if (found)
+        return &g_glinfo_cache[g_glinfo_key_entries[slot]];
 
-    if (s_glinfo_cache_count)
+    if (slot == -1)
     {
-        glinfo_cache_t *glinfo_entry = bsearch(&key, s_glinfo_cache, s_glinfo_cache_count, sizeof(glinfo_cache_t), glinfo_cache_compare);
-        if (glinfo_entry)
-            return glinfo_entry;
+        static int s_warned = 0;
+
+        if (!s_warned)
+        {
+            s_warned = 1;
+            syslog(LOG_WARNING, "(voglperf) WARNING: More than %d drawables, not tracking %lu.\n", GLINFO_CACHE_SIZE, drawable);
+        }
+        return NULL;
     }
 
-    void *data = realloc(s_glinfo_cache, (s_glinfo_cache_count + 1) * sizeof(glinfo_cache_t));
-    if (data)
+    // Every key has its own entry, so there's always one free when there's a free key.
+    uint8_t entry = g_glinfo_free_count ? g_glinfo_free[--g_glinfo_free_count] : (uint8_t)g_glinfo_entry_count++;
+    glinfo_cache_t *glinfo = &g_glinfo_cache[entry];
+
+    memset(glinfo, 0, sizeof(*glinfo));
+    glinfo->surface = g_glinfo_surface_count++;
+
+    g_glinfo_keys[slot].dpy = dpy;
+    g_glinfo_keys[slot].drawable = drawable;
+    g_glinfo_key_entries[slot] = entry;
+    return glinfo;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glinfo_evict_slot
+//  Call with g_glinfo_lock held. Returns the entry's stats reference for the caller to hand to
+//  surface_stats_evict() once it's unlocked.
+//----------------------------------------------------------------------------------------------------------------------
+static struct surface_stats_t *glinfo_evict_slot(int slot)
+{
+    uint32_t hole = (uint32_t)slot;
+    uint32_t next = hole;
+    uint8_t entry = g_glinfo_key_entries[hole];
+    glinfo_cache_t *glinfo = &g_glinfo_cache[entry];
+    struct surface_stats_t *stats = glinfo->stats;
+
+    if (g_verbose)
+        syslog(LOG_INFO, "(voglperf) Evicting drawable %lu (surface %u).\n", g_glinfo_keys[hole].drawable, glinfo->surface);
+
+    // Threads still holding the entry see its surface id change and let go.
+    memset(glinfo, 0, sizeof(*glinfo));
+    glinfo->surface = GLINFO_SURFACE_NONE;
+    g_glinfo_free[g_glinfo_free_count++] = entry;
+
+    // Move later keys of the chain into the hole unless that would put them before their home slot.
+    for (;;)
     {
-        s_glinfo_cache = (glinfo_cache_t *)data;
+        next = (next + 1) & (GLINFO_CACHE_SIZE - 1);
 
-        s_glinfo_cache[s_glinfo_cache_count++] = key;
-        qsort(s_glinfo_cache, s_glinfo_cache_count, sizeof(glinfo_cache_t), glinfo_cache_compare);
-        return &s_glinfo_cache[s_glinfo_cache_count - 1];
+        const glinfo_key_t *key = &g_glinfo_keys[next];
+        if (key->drawable == GLINFO_DRAWABLE_EMPTY)
+            break;
+
+        uint32_t home = glinfo_hash(key->dpy, key->drawable) & (GLINFO_CACHE_SIZE - 1);
+        if (((next - home) & (GLINFO_CACHE_SIZE - 1)) < ((next - hole) & (GLINFO_CACHE_SIZE - 1)))
+            continue;
+
+        g_glinfo_keys[hole] = *key;
+        g_glinfo_key_entries[hole] = g_glinfo_key_entries[next];
+        hole = next;
     }
 
-    return NULL;
+    g_glinfo_keys[hole].dpy = NULL;
+    g_glinfo_keys[hole].drawable = GLINFO_DRAWABLE_EMPTY;
+
+    __atomic_add_fetch(&g_glinfo_evictions, 1, __ATOMIC_RELEASE);
+    return stats;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glinfo_evict
+//  Drops dpy+drawable from the cache when it's destroyed. Swaps of a new drawable that reuses the XID get a
+//  new surface id.
+//----------------------------------------------------------------------------------------------------------------------
+void glinfo_evict(Display *dpy, GLXDrawable drawable)
+{
+    int found;
+    struct surface_stats_t *stats = NULL;
+
+    if (drawable == GLINFO_DRAWABLE_EMPTY)
+        return;
+
+    pthread_mutex_lock(&g_glinfo_lock);
+
+    int slot = glinfo_find(dpy, drawable, &found);
+    if (found)
+        stats = glinfo_evict_slot(slot);
+
+    pthread_mutex_unlock(&g_glinfo_lock);
+
+    if (stats)
+        surface_stats_evict(stats, dpy);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glinfo_display_cached
+//----------------------------------------------------------------------------------------------------------------------
+static int glinfo_display_cached(Display *dpy)
+{
+    uint32_t i;
+    int cached = 0;
+
+    pthread_mutex_lock(&g_glinfo_lock);
+    for (i = 0; (i < GLINFO_CACHE_SIZE) && !cached; i++)
+        cached = (g_glinfo_keys[i].dpy == dpy);
+    pthread_mutex_unlock(&g_glinfo_lock);
+    return cached;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glinfo_evict_subwindows
+//  Drops every drawable below window from the cache before the X server destroys them along with it. Only asks
+//  the server for the window tree when something on dpy is cached.
+//----------------------------------------------------------------------------------------------------------------------
+static void glinfo_evict_subwindows(Display *dpy, Window window)
+{
+    typedef Status (*XQueryTree_func_ptr_t)(Display *dpy, Window window, Window *root, Window *parent,
+                                            Window **children, unsigned int *count);
+    typedef int (*XFree_func_ptr_t)(void *data);
+    static XQueryTree_func_ptr_t s_pActual_XQueryTree;
+    static XFree_func_ptr_t s_pActual_XFree;
+    Window root;
+    Window parent;
+    Window *children = NULL;
+    unsigned int count = 0;
+    unsigned int i;
+
+    if (!glinfo_display_cached(dpy))
+        return;
+
+    // Whoever is destroying windows has libX11 loaded.
+    if (!s_pActual_XQueryTree)
+        s_pActual_XQueryTree = (XQueryTree_func_ptr_t)dlsym(RTLD_NEXT, "XQueryTree");
+    if (!s_pActual_XFree)
+        s_pActual_XFree = (XFree_func_ptr_t)dlsym(RTLD_NEXT, "XFree");
+    if (!s_pActual_XQueryTree || !s_pActual_XFree)
+        return;
+
+    if (!s_pActual_XQueryTree(dpy, window, &root, &parent, &children, &count))
+        return;
+
+    for (i = 0; i < count; i++)
+    {
+        glinfo_evict(dpy, (GLXDrawable)children[i]);
+        glinfo_evict_subwindows(dpy, children[i]);
+    }
+
+    if (children)
+        s_pActual_XFree(children);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glinfo_evict_display
+//  Drops every drawable on dpy from the cache before it's closed.
+//----------------------------------------------------------------------------------------------------------------------
+static void glinfo_evict_display(Display *dpy)
+{
+    uint32_t i;
+
+    // Evicting shifts keys around, possibly into slots we've already looked at, so start over after each one.
+    for (;;)
+    {
+        struct surface_stats_t *stats = NULL;
+        int evicted = 0;
+
+        pthread_mutex_lock(&g_glinfo_lock);
+        for (i = 0; (i < GLINFO_CACHE_SIZE) && !evicted; i++)
+        {
+            if ((g_glinfo_keys[i].dpy == dpy) && (g_glinfo_keys[i].drawable != GLINFO_DRAWABLE_EMPTY))
+            {
+                stats = glinfo_evict_slot((int)i);
+                evicted = 1;
+            }
+        }
+        pthread_mutex_unlock(&g_glinfo_lock);
+
+        if (!evicted)
+            break;
+        if (stats)
+            surface_stats_evict(stats, dpy);
+    }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -270,467 +824,4309 @@ static void vogl_delay(unsigned int ms)
     } while (was_error && (errno == EINTR));
 }
 
-static void *vogl_load_object(const char *sofile)
+static uint64_t vogl_get_ns(clockid_t clock)
 {
-    return dlopen(sofile, RTLD_NOW | RTLD_LOCAL);
-}
+    struct timespec time;
 
-static void *vogl_load_function(void *handle, const char *name)
-{
-    // Handle appending an underscore for platforms that need that?
-    return dlsym(handle, name);
+    clock_gettime(clock, &time);
+    return ((uint64_t)time.tv_sec * 1000000000) + time.tv_nsec;
 }
 
-static void voglperf_logfile_close()
-{
-    if (g_logfile_fd == -1)
-        return;
-
-    syslog(LOG_INFO, "(voglperf) logfile_close(%s).\n", g_logfile_name);
+//----------------------------------------------------------------------------------------------------------------------
+// clock
+//  Every frame timestamp comes from vogl_get_time_ns(). The default is CLOCK_MONOTONIC through the vDSO.
+//  --clock=tsc reads the invariant TSC with rdtsc instead, so extra timestamps per frame cost next to nothing.
+//  TSC ticks are calibrated against CLOCK_MONOTONIC at init. They're re-synced about once a second after that,
+//  so times track NTP slewing and stay within a few microseconds of CLOCK_MONOTONIC. Offsets found at a re-sync
+//  are steered out over the next second instead of jumped, so time never goes backwards. Without an
+//  invariant TSC we stay on CLOCK_MONOTONIC.
+//
+//  Sync state is published with a seqlock. Any thread can read the clock and whichever one notices a re-sync is
+//  due does it.
+//----------------------------------------------------------------------------------------------------------------------
+#define TSC_SHIFT 24                        // ns per tick are kept as a 40.24 fixed point multiplier.
+#define TSC_CALIBRATE_MS 10
+#define TSC_SYNC_NS 1000000000ULL
+#define TSC_MAX_STEP_NS 1000000ULL          // Offsets bigger than this are stepped forward instead of steered out.
 
-    // Flush whatever framerate numbers we've built up.
-    voglperf_swap_buffers(NULL, None, 1);
+typedef struct tsc_clock_t
+{
+    uint32_t seq;               // Odd while the fields below are being updated.
+    uint64_t tsc_base;          // TSC and nanoseconds at the last sync.
+    uint64_t ns_base;
+    uint64_t mult;              // ns per tick << TSC_SHIFT.
+    uint64_t tsc_sync;          // TSC to re-sync at.
 
-    // Close the file.
-    close(g_logfile_fd);
-    g_logfile_fd = -1;
+    // Only touched by the thread holding syncing.
+    int syncing;
+    uint64_t tsc_calibrate;     // First calibration sample. The rate is measured from here so it gets more
+    uint64_t ns_calibrate;      // accurate the longer we run.
+    double ns_per_tick;
+} tsc_clock_t;
 
-    // Notify folks.
-    if (g_msqid != -1)
-    {
-        struct mbuf_logfile_stop_t mbuf_stop;
+static uint32_t g_clock = VOGLPERF_CLOCK_MONOTONIC;
+static tsc_clock_t g_tsc_clock;
 
-        mbuf_stop.mtype = MSGTYPE_LOGFILE_STOP_NOTIFY;
-        strncpy(mbuf_stop.logfile, g_logfile_name, sizeof(mbuf_stop.logfile));
+#if defined(__i386__) || defined(__x86_64__)
 
-        int ret = msgsnd(g_msqid, &mbuf_stop, sizeof(mbuf_stop) - sizeof(mbuf_stop.mtype), IPC_NOWAIT);
-        if (ret == -1)
-            syslog(LOG_ERR, "(voglperf) msgsnd failed: %d. %s\n", ret, strerror(errno));
-    }
+//----------------------------------------------------------------------------------------------------------------------
+// tsc_invariant
+//  CPUID.80000007H:EDX[8] says the TSC runs at a constant rate in every P, C and T state.
+//----------------------------------------------------------------------------------------------------------------------
+static int tsc_invariant()
+{
+    unsigned int eax, ebx, ecx, edx;
 
-    g_logfile_name[0] = 0;
-    g_logfile_time = 0;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || (eax < 0x80000007))
+        return 0;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return !!(edx & (1 << 8));
 }
 
-static int voglperf_logfile_open(const char *logfile_name, uint64_t seconds)
+//----------------------------------------------------------------------------------------------------------------------
+// tsc_sample
+//  TSC and CLOCK_MONOTONIC read as close together as we can manage. Keeps the tightest of a few tries so a
+//  preemption or interrupt between the reads doesn't skew calibration.
+//----------------------------------------------------------------------------------------------------------------------
+static void tsc_sample(uint64_t *tsc, uint64_t *ns)
 {
-    // Make sure nothing is currently open.
-    voglperf_logfile_close();
-
-    syslog(LOG_INFO, "(voglperf) logfile_open(%s) %" PRIu64 " seconds.\n", logfile_name, seconds);
+    uint64_t best = (uint64_t)-1;
+    int i;
 
-    g_logfile_fd = open(logfile_name, O_WRONLY | O_CREAT, 0666);
-    if (g_logfile_fd == -1)
-    {
-        syslog(LOG_ERR, "(voglperf) Error opening '%s': %s\n", logfile_name, strerror(errno));
-    }
-    else
+    for (i = 0; i < 5; i++)
     {
-        time_t now;
-        struct tm now_tm;
-        char timebuf[256];
-
-        time(&now);
-        strftime(timebuf, sizeof(timebuf), "%h %e %T", localtime_r(&now, &now_tm));
+        uint64_t tsc0 = __rdtsc();
+        uint64_t ns0 = vogl_get_ns(CLOCK_MONOTONIC);
+        uint64_t tsc1 = __rdtsc();
 
-        if (g_logfile_fd != -1)
+        if (tsc1 - tsc0 < best)
         {
-            snprintf(g_logfile_buf, sizeof(g_logfile_buf),
-                     "# %s - %s\n",
-                     timebuf, program_invocation_short_name);
-            HANDLE_EINTR(write(g_logfile_fd, g_logfile_buf, strlen(g_logfile_buf)));
-            g_logfile_buf_len = 0;
+            best = tsc1 - tsc0;
+            *tsc = tsc0 + (tsc1 - tsc0) / 2;
+            *ns = ns0;
+        }
+    }
+}
 
-            g_logfile_time = seconds * 1000000000;
+//----------------------------------------------------------------------------------------------------------------------
+// tsc_scale
+//  (ticks * mult) >> TSC_SHIFT without needing 128-bit math, so it works in 32-bit builds too.
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint64_t tsc_scale(uint64_t ticks, uint64_t mult)
+{
+    return (((ticks >> 32) * mult) << (32 - TSC_SHIFT)) + (((ticks & 0xffffffff) * mult) >> TSC_SHIFT);
+}
 
-            strncpy(g_logfile_name, logfile_name, sizeof(g_logfile_name));
+//----------------------------------------------------------------------------------------------------------------------
+// tsc_to_ns
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint64_t tsc_to_ns(uint64_t tsc, uint64_t tsc_base, uint64_t ns_base, uint64_t mult)
+{
+    // Another thread can publish a sync between us reading the TSC and the sync state.
+    if (tsc < tsc_base)
+        return ns_base - tsc_scale(tsc_base - tsc, mult);
+    return ns_base + tsc_scale(tsc - tsc_base, mult);
+}
 
-            if (g_msqid != -1)
-            {
-                struct mbuf_logfile_start_t mbuf_start;
+//----------------------------------------------------------------------------------------------------------------------
+// tsc_publish
+//----------------------------------------------------------------------------------------------------------------------
+static void tsc_publish(uint64_t tsc_base, uint64_t ns_base, uint64_t mult, uint64_t tsc_sync)
+{
+    tsc_clock_t *clock = &g_tsc_clock;
+    uint32_t seq = clock->seq;
 
-                mbuf_start.mtype = MSGTYPE_LOGFILE_START_NOTIFY;
-                strncpy(mbuf_start.logfile, g_logfile_name, sizeof(mbuf_start.logfile));
-                mbuf_start.time = seconds;
+    __atomic_store_n(&clock->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 
-                int ret = msgsnd(g_msqid, &mbuf_start, sizeof(mbuf_start) - sizeof(mbuf_start.mtype), IPC_NOWAIT);
-                if (ret == -1)
-                    syslog(LOG_ERR, "(voglperf) msgsnd failed: %d. %s\n", ret, strerror(errno));
-            }
-        }
-    }
+    __atomic_store_n(&clock->tsc_base, tsc_base, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->ns_base, ns_base, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->mult, mult, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->tsc_sync, tsc_sync, __ATOMIC_RELAXED);
 
-    return g_logfile_fd;
+    __atomic_store_n(&clock->seq, seq + 2, __ATOMIC_RELEASE);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-// showfps_set
+// tsc_sync
+//  Measure the TSC rate again and steer toward CLOCK_MONOTONIC. Returns the time at tsc with the new settings.
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t tsc_sync(uint64_t tsc_base, uint64_t ns_base, uint64_t mult)
+{
+    tsc_clock_t *clock = &g_tsc_clock;
+    uint64_t tsc, ns;
+
+    tsc_sample(&tsc, &ns);
+
+    uint64_t ns_tsc = tsc_to_ns(tsc, tsc_base, ns_base, mult);
+    if (tsc > clock->tsc_calibrate)
+        clock->ns_per_tick = (double)(ns - clock->ns_calibrate) / (double)(tsc - clock->tsc_calibrate);
+
+    // Spread whatever offset is left over the next sync period. Big ones (suspend / resume, clock stepped) are
+    // stepped over if they're forward, and otherwise steered out as fast as we can without time going backwards.
+    double offset = (double)(int64_t)(ns - ns_tsc);
+    if (offset > (double)TSC_MAX_STEP_NS)
+    {
+        ns_tsc = ns;
+        offset = 0.0;
+    }
+    else if (offset < -(double)(TSC_SYNC_NS / 2))
+    {
+        offset = -(double)(TSC_SYNC_NS / 2);
+    }
+
+    double scale = clock->ns_per_tick * (1.0 + offset / (double)TSC_SYNC_NS);
+    uint64_t mult_new = (uint64_t)(scale * (double)(1 << TSC_SHIFT));
+    uint64_t tsc_next = tsc + (uint64_t)((double)TSC_SYNC_NS / clock->ns_per_tick);
+
+    tsc_publish(tsc, ns_tsc, mult_new, tsc_next);
+    return ns_tsc;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// tsc_clock_init
+//----------------------------------------------------------------------------------------------------------------------
+static int tsc_clock_init()
+{
+    tsc_clock_t *clock = &g_tsc_clock;
+
+    if (!tsc_invariant())
+    {
+        syslog(LOG_WARNING, "(voglperf) No invariant TSC, using CLOCK_MONOTONIC.\n");
+        return 0;
+    }
+
+    uint64_t tsc, ns;
+
+    tsc_sample(&clock->tsc_calibrate, &clock->ns_calibrate);
+    vogl_delay(TSC_CALIBRATE_MS);
+    tsc_sample(&tsc, &ns);
+
+    if ((tsc <= clock->tsc_calibrate) || (ns <= clock->ns_calibrate))
+    {
+        syslog(LOG_WARNING, "(voglperf) TSC calibration failed, using CLOCK_MONOTONIC.\n");
+        return 0;
+    }
+
+    clock->ns_per_tick = (double)(ns - clock->ns_calibrate) / (double)(tsc - clock->tsc_calibrate);
+    tsc_publish(tsc, ns, (uint64_t)(clock->ns_per_tick * (double)(1 << TSC_SHIFT)),
+                tsc + (uint64_t)((double)TSC_SYNC_NS / clock->ns_per_tick));
+
+    syslog(LOG_INFO, "(voglperf) Using TSC clock, %.2f MHz.\n", 1000.0 / clock->ns_per_tick);
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// tsc_get_ns
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t tsc_get_ns()
+{
+    tsc_clock_t *clock = &g_tsc_clock;
+    uint64_t tsc, tsc_base, ns_base, mult, tsc_sync_at;
+    uint32_t seq;
+
+    do
+    {
+        seq = __atomic_load_n(&clock->seq, __ATOMIC_ACQUIRE);
+
+        tsc_base = __atomic_load_n(&clock->tsc_base, __ATOMIC_RELAXED);
+        ns_base = __atomic_load_n(&clock->ns_base, __ATOMIC_RELAXED);
+        mult = __atomic_load_n(&clock->mult, __ATOMIC_RELAXED);
+        tsc_sync_at = __atomic_load_n(&clock->tsc_sync, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&clock->seq, __ATOMIC_RELAXED)));
+
+    tsc = __rdtsc();
+
+    if ((tsc >= tsc_sync_at) && !__atomic_exchange_n(&clock->syncing, 1, __ATOMIC_ACQUIRE))
+    {
+        uint64_t ns = tsc_sync(tsc_base, ns_base, mult);
+
+        __atomic_store_n(&clock->syncing, 0, __ATOMIC_RELEASE);
+        return ns;
+    }
+
+    return tsc_to_ns(tsc, tsc_base, ns_base, mult);
+}
+
+#else
+
+static int tsc_clock_init()
+{
+    syslog(LOG_WARNING, "(voglperf) No TSC on this architecture, using CLOCK_MONOTONIC.\n");
+    return 0;
+}
+
+static uint64_t tsc_get_ns()
+{
+    return vogl_get_ns(CLOCK_MONOTONIC);
+}
+
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+// vogl_clock_init
+//----------------------------------------------------------------------------------------------------------------------
+static void vogl_clock_init(uint32_t clock)
+{
+    if ((clock == VOGLPERF_CLOCK_TSC) && tsc_clock_init())
+        g_clock = VOGLPERF_CLOCK_TSC;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// vogl_get_time_ns
+//  Frame timestamp in nanoseconds of CLOCK_MONOTONIC.
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint64_t vogl_get_time_ns()
+{
+    return (g_clock == VOGLPERF_CLOCK_TSC) ? tsc_get_ns() : vogl_get_ns(CLOCK_MONOTONIC);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// vogl_clock_tsc_hz
+//  Calibrated TSC frequency, or 0 if we aren't using it.
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t vogl_clock_tsc_hz()
+{
+    if (g_clock != VOGLPERF_CLOCK_TSC)
+        return 0;
+
+    uint64_t mult = __atomic_load_n(&g_tsc_clock.mult, __ATOMIC_RELAXED);
+    return mult ? (uint64_t)(1000000000.0 * (double)(1 << TSC_SHIFT) / (double)mult) : 0;
+}
+
+static void *vogl_load_object(const char *sofile)
+{
+    return dlopen(sofile, RTLD_NOW | RTLD_LOCAL);
+}
+
+static void *vogl_load_function(void *handle, const char *name)
+{
+    // Handle appending an underscore for platforms that need that?
+    return dlsym(handle, name);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_t
+//  Unbounded single producer / single consumer queue of frames for the logfile writer. Every thread that
+//  swaps gets its own. Frames go into fixed size chunks linked together so the queue can grow when the
+//  writer falls behind (slow disk, 100k+ fps) instead of losing frames. The writer thread keeps a few spare
+//  chunks on a free list so the swap path doesn't have to allocate. Frames are only dropped if we hit the
+//  memory limit.
+//----------------------------------------------------------------------------------------------------------------------
+#define FRAME_CHUNK_FRAMES (16 * 1024)
+#define FRAME_QUEUE_SPARE_CHUNKS 4
+#define FRAME_QUEUE_MAX_BYTES (256 * 1024 * 1024)
+
+typedef struct frame_chunk_t
+{
+    struct frame_chunk_t *next;
+    uint32_t count;             // Frames written by producer.
+    struct voglperf_frame_t frames[FRAME_CHUNK_FRAMES];
+} frame_chunk_t;
+
+typedef struct frame_queue_t
+{
+    frame_chunk_t *tail;        // Producer chunk.
+    frame_chunk_t *head;        // Consumer chunk.
+    uint32_t head_index;        // Consumer position in head.
+
+    frame_chunk_t *free_list;   // Spare chunks. Pushed by consumer, popped by producer.
+    uint32_t free_count;
+    uint32_t chunk_count;       // Chunks allocated.
+} frame_queue_t;
+
+#define FRAME_QUEUE_MAX_CHUNKS (FRAME_QUEUE_MAX_BYTES / sizeof(frame_chunk_t))
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_free_push
+//----------------------------------------------------------------------------------------------------------------------
+static void frame_queue_free_push(frame_queue_t *queue, frame_chunk_t *chunk)
+{
+    frame_chunk_t *head = __atomic_load_n(&queue->free_list, __ATOMIC_RELAXED);
+
+    do
+    {
+        chunk->next = head;
+    } while (!__atomic_compare_exchange_n(&queue->free_list, &head, chunk, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    __atomic_add_fetch(&queue->free_count, 1, __ATOMIC_RELAXED);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_free_pop
+//  Only the producer pops, so chunk->next can't change under us (no ABA).
+//----------------------------------------------------------------------------------------------------------------------
+static frame_chunk_t *frame_queue_free_pop(frame_queue_t *queue)
+{
+    frame_chunk_t *head = __atomic_load_n(&queue->free_list, __ATOMIC_ACQUIRE);
+
+    while (head && !__atomic_compare_exchange_n(&queue->free_list, &head, head->next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        ;
+
+    if (head)
+        __atomic_sub_fetch(&queue->free_count, 1, __ATOMIC_RELAXED);
+    return head;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_alloc_chunk
+//----------------------------------------------------------------------------------------------------------------------
+static frame_chunk_t *frame_queue_alloc_chunk(frame_queue_t *queue)
+{
+    if (__atomic_load_n(&queue->chunk_count, __ATOMIC_RELAXED) >= FRAME_QUEUE_MAX_CHUNKS)
+        return NULL;
+
+    frame_chunk_t *chunk = (frame_chunk_t *)malloc(sizeof(frame_chunk_t));
+    if (chunk)
+        __atomic_add_fetch(&queue->chunk_count, 1, __ATOMIC_RELAXED);
+    return chunk;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_refill
+//  Called by the consumer to make sure the producer has spare chunks ready.
+//----------------------------------------------------------------------------------------------------------------------
+static void frame_queue_refill(frame_queue_t *queue)
+{
+    while (__atomic_load_n(&queue->free_count, __ATOMIC_RELAXED) < FRAME_QUEUE_SPARE_CHUNKS)
+    {
+        frame_chunk_t *chunk = frame_queue_alloc_chunk(queue);
+        if (!chunk)
+            break;
+        frame_queue_free_push(queue, chunk);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_init
+//----------------------------------------------------------------------------------------------------------------------
+static int frame_queue_init(frame_queue_t *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+
+    frame_chunk_t *chunk = frame_queue_alloc_chunk(queue);
+    if (!chunk)
+        return 0;
+
+    chunk->next = NULL;
+    chunk->count = 0;
+    queue->head = chunk;
+    queue->tail = chunk;
+
+    frame_queue_refill(queue);
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_destroy
+//----------------------------------------------------------------------------------------------------------------------
+static void frame_queue_destroy(frame_queue_t *queue)
+{
+    frame_chunk_t *lists[2] = { queue->head, queue->free_list };
+    uint32_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        frame_chunk_t *chunk = lists[i];
+
+        while (chunk)
+        {
+            frame_chunk_t *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+    }
+
+    memset(queue, 0, sizeof(*queue));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_push
+//  Producer. Returns 0 if we're out of memory and the frame was dropped.
+//----------------------------------------------------------------------------------------------------------------------
+static int frame_queue_push(frame_queue_t *queue, const struct voglperf_frame_t *frame)
+{
+    frame_chunk_t *tail = queue->tail;
+    uint32_t count = tail->count;
+
+    if (count == FRAME_CHUNK_FRAMES)
+    {
+        // Writer normally keeps spares around. Only allocate here if it's fallen way behind.
+        frame_chunk_t *chunk = frame_queue_free_pop(queue);
+        if (!chunk)
+            chunk = frame_queue_alloc_chunk(queue);
+        if (!chunk)
+            return 0;
+
+        chunk->next = NULL;
+        chunk->count = 0;
+        __atomic_store_n(&tail->next, chunk, __ATOMIC_RELEASE);
+
+        queue->tail = chunk;
+        tail = chunk;
+        count = 0;
+    }
+
+    tail->frames[count] = *frame;
+    __atomic_store_n(&tail->count, count + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_queue_pop
+//  Consumer. Copies up to count frames and returns the number copied.
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t frame_queue_pop(frame_queue_t *queue, struct voglperf_frame_t *frames, uint32_t count)
+{
+    uint32_t ret = 0;
+
+    while (ret < count)
+    {
+        frame_chunk_t *head = queue->head;
+        uint32_t head_count = __atomic_load_n(&head->count, __ATOMIC_ACQUIRE);
+
+        if (queue->head_index < head_count)
+        {
+            uint32_t num = head_count - queue->head_index;
+
+            if (num > count - ret)
+                num = count - ret;
+
+            memcpy(frames + ret, head->frames + queue->head_index, num * sizeof(frames[0]));
+            queue->head_index += num;
+            ret += num;
+        }
+        else
+        {
+            frame_chunk_t *next = (head_count == FRAME_CHUNK_FRAMES) ? __atomic_load_n(&head->next, __ATOMIC_ACQUIRE) : NULL;
+            if (!next)
+                break;
+
+            // Producer has moved on to the next chunk. Recycle this one.
+            queue->head = next;
+            queue->head_index = 0;
+
+            if (__atomic_load_n(&queue->free_count, __ATOMIC_RELAXED) < FRAME_QUEUE_SPARE_CHUNKS)
+            {
+                frame_queue_free_push(queue, head);
+            }
+            else
+            {
+                free(head);
+                __atomic_sub_fetch(&queue->chunk_count, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// flight recorder
+//  Every frame also goes into a fixed ring holding the last g_flight_seconds of frames, whether or not a logfile is
+//  being captured, so "logfile dump" can write out what just happened after a tester sees a hitch. The ring is
+//  allocated and faulted in on the first swap, so processes that never render don't pay for it, and simply
+//  overwrites the oldest frames; the swap path pays one atomic add and a few stores. Each slot is stamped with its ring index + 1 once written so dumps can skip slots that were
+//  being overwritten while they were copied.
+//----------------------------------------------------------------------------------------------------------------------
+#define FLIGHT_RECORDER_MAX_FPS 1000    // Ring holds g_flight_seconds worth of frames at up to this rate.
+
+typedef struct flight_slot_t
+{
+    uint64_t seq;                   // Ring index + 1 of the frame in this slot, 0 while it's being written.
+    struct voglperf_frame_t frame;
+} flight_slot_t;
+
+typedef struct flight_recorder_t
+{
+    flight_slot_t *slots;
+    uint64_t mask;                  // Slot count - 1. Zero slots if the recorder is off.
+    uint64_t base;                  // Ring index of this process's first frame. Forked children inherit the parent's.
+    uint32_t allocated;             // Set by the first swap to try allocating slots.
+    uint64_t head __attribute__((aligned(64))); // Ring index of the next frame.
+} flight_recorder_t;
+
+static uint32_t g_flight_seconds = VOGLPERF_FLIGHT_SECONDS_DEFAULT; // Seconds of frames to keep (--flight-seconds), 0 for off.
+static flight_recorder_t g_flight_recorder;
+
+//----------------------------------------------------------------------------------------------------------------------
+// flight_recorder_alloc
+//  Called from any swap thread before timing the swap. Only the first call does anything.
+//----------------------------------------------------------------------------------------------------------------------
+static void flight_recorder_alloc()
+{
+    flight_recorder_t *recorder = &g_flight_recorder;
+    uint32_t seconds = g_flight_seconds;
+    uint64_t slot_count = 1;
+
+    if (!seconds || __atomic_load_n(&recorder->allocated, __ATOMIC_RELAXED) ||
+            __atomic_exchange_n(&recorder->allocated, 1, __ATOMIC_RELAXED))
+        return;
+
+    while (slot_count < (uint64_t)seconds * FLIGHT_RECORDER_MAX_FPS)
+        slot_count *= 2;
+
+    flight_slot_t *slots = (flight_slot_t *)malloc(slot_count * sizeof(flight_slot_t));
+    if (!slots)
+    {
+        syslog(LOG_ERR, "(voglperf) Out of memory allocating %" PRIu64 " frame flight recorder.\n", slot_count);
+        return;
+    }
+
+    // Touch every page now so the swap path never faults them in.
+    memset(slots, 0, slot_count * sizeof(flight_slot_t));
+
+    recorder->mask = slot_count - 1;
+    __atomic_store_n(&recorder->slots, slots, __ATOMIC_RELEASE);
+
+    syslog(LOG_INFO, "(voglperf) Flight recorder: %u seconds, %" PRIu64 " frames.\n", seconds, slot_count);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// flight_recorder_push
+//  Called from any swap thread.
+//----------------------------------------------------------------------------------------------------------------------
+static void flight_recorder_push(const struct voglperf_frame_t *frame)
+{
+    flight_recorder_t *recorder = &g_flight_recorder;
+    flight_slot_t *slots = __atomic_load_n(&recorder->slots, __ATOMIC_ACQUIRE);
+
+    if (!slots)
+        return;
+
+    uint64_t index = __atomic_fetch_add(&recorder->head, 1, __ATOMIC_RELAXED);
+    flight_slot_t *slot = &slots[index & recorder->mask];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->frame = *frame;
+    __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// flight_recorder_snapshot
+//  Copies the frames currently in the ring, oldest first, into a malloc'd array. Returns the frame count (0 with
+//  *frames NULL if there aren't any) and the number of slots skipped because they were overwritten as we read them.
+//----------------------------------------------------------------------------------------------------------------------
+static size_t flight_recorder_snapshot(struct voglperf_frame_t **frames, uint64_t *skipped)
+{
+    flight_recorder_t *recorder = &g_flight_recorder;
+    flight_slot_t *slots = __atomic_load_n(&recorder->slots, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+
+    *frames = NULL;
+    *skipped = 0;
+
+    if (!slots)
+        return 0;
+
+    uint64_t head = __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE);
+    uint64_t slot_count = recorder->mask + 1;
+    uint64_t index = (head > slot_count) ? (head - slot_count) : 0;
+
+    if (index < recorder->base)
+        index = recorder->base;
+    if (head == index)
+        return 0;
+
+    struct voglperf_frame_t *dst = (struct voglperf_frame_t *)malloc((head - index) * sizeof(struct voglperf_frame_t));
+    if (!dst)
+    {
+        syslog(LOG_ERR, "(voglperf) Out of memory copying flight recorder.\n");
+        return 0;
+    }
+
+    for (; index < head; index++)
+    {
+        const flight_slot_t *slot = &slots[index & recorder->mask];
+
+        // Same slot stamp before and after the copy means nobody was writing it.
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        dst[count] = slot->frame;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if ((seq == index + 1) && (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq))
+            count++;
+        else
+            (*skipped)++;
+    }
+
+    *frames = dst;
+    return count;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile writer
+//  The swap path only pushes frame timestamps into its thread's frame_producer_t queue. A background thread
+//  pops them from every producer, merges them in time order, formats the frame times and does all the
+//  logfile I/O so a stalled disk never shows up as a hitch in the frame times we're measuring. Logfile
+//  open/close requests are tagged with the timestamp of the last frame pushed so the writer knows which
+//  frames belong in the file.
+//  Logfiles ending in VOGLPERF_LOG_EXTENSION are written in the binary format from voglperf_log.h,
+//  everything else gets the text frame times.
+//----------------------------------------------------------------------------------------------------------------------
+#define LOGFILE_WRITER_MAX_REQUESTS 8
+
+// Fixed width so the count can be rewritten in place when the logfile is closed.
+#define LOGFILE_DROPPED_FORMAT "# dropped frames: %20" PRIu64 "\n"
+#define LOGFILE_COLUMNS_LINE "# frame_ms, cpu_ms, swap_ms, offcpu_ms, surface"
+
+enum
+{
+    LOGFILE_REQUEST_OPEN,
+    LOGFILE_REQUEST_CLOSE,
+    LOGFILE_REQUEST_DUMP
+};
+
+typedef struct logfile_request_t
+{
+    int type;                   // LOGFILE_REQUEST_OPEN, LOGFILE_REQUEST_CLOSE or LOGFILE_REQUEST_DUMP.
+    uint64_t time;              // Applies to frames after this timestamp.
+    uint64_t seconds;           // Seconds to log for (open), or seconds back to dump (dump, 0 for all).
+    char name[PATH_MAX];        // Logfile name (open, dump).
+} logfile_request_t;
+
+// Frame queue for one swapping thread. Swap threads push these onto logfile_writer_t.producers (lock free),
+// and from then on the writer owns them. Once the thread exits and its frames are written, the writer frees it.
+typedef struct frame_producer_t
+{
+    struct frame_producer_t *next;
+    int exited;                 // Set by the thread on exit. Nothing more will be pushed.
+    uint64_t time_busy;         // Set by the thread while it times a frame and pushes it, to a time no later than
+                                //  the frame's. 0 otherwise.
+    frame_queue_t queue;
+} frame_producer_t;
+
+typedef struct logfile_writer_t
+{
+    int started;
+    int quit;
+    pthread_t thread;
+    frame_producer_t *producers;    // Queues from every thread that has swapped since the writer started.
+    uint64_t time_pushed;       // Last frame timestamp from the swap path.
+    uint64_t dropped;           // Frames dropped because a producer queue ran out of memory.
+
+    // Requests from the swap path. Lock is never held while doing I/O.
+    pthread_mutex_t lock;
+    uint32_t request_count;
+    logfile_request_t requests[LOGFILE_WRITER_MAX_REQUESTS];
+
+    // Owned by the writer thread.
+    int fd;
+    char name[PATH_MAX];
+    uint64_t time_last;
+    uint64_t *surface_time_last;    // Last frame time for each surface in the csv logfile (0 if none yet).
+    uint32_t surface_count;
+    uint64_t file_size;         // Bytes appended to the logfile so far.
+    uint64_t dropped_start;     // dropped when logfile was opened.
+    uint64_t dropped_offset;    // File offset of csv dropped frames line.
+    char *buf;
+    size_t buf_len;
+    size_t buf_size;
+    struct voglperf_frame_t *batch; // Frames popped from all producers in one update, starting with the ones held
+    size_t batch_count;             //  back from the last (batch_held).
+    size_t batch_size;
+    size_t batch_held;
+    logfile_request_t held_requests[LOGFILE_WRITER_MAX_REQUESTS]; // Requests held back with them.
+    uint32_t held_request_count;
+
+    int limit;                  // Log frame limiter times. Limiter was on when the logfile was opened.
+    int dump;                   // Writing a flight recorder dump, not the live logfile. Don't notify voglperfrun.
+
+    // Binary logfile state.
+    int binary;
+    struct voglperf_log_header_t header;
+    uint32_t block_frames;
+    uint64_t block_time_base;
+    uint64_t block_time_end;
+    uint64_t block_values[VOGLPERF_LOG_CHANNEL_COUNT][VOGLPERF_LOG_BLOCK_FRAMES];
+    struct voglperf_log_index_t *index;
+    size_t index_count;
+    size_t index_size;
+} logfile_writer_t;
+
+static logfile_writer_t g_logfile_writer = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_reserve
+//  Returns pointer to at least size free bytes at the end of the write buffer.
+//----------------------------------------------------------------------------------------------------------------------
+static char *logfile_writer_reserve(logfile_writer_t *writer, size_t size)
+{
+    if (writer->buf_len + size > writer->buf_size)
+    {
+        size_t buf_size = writer->buf_size ? writer->buf_size : (64 * 1024);
+
+        while (writer->buf_len + size > buf_size)
+            buf_size *= 2;
+
+        char *buf = (char *)realloc(writer->buf, buf_size);
+        if (!buf)
+        {
+            syslog(LOG_ERR, "(voglperf) Out of memory growing logfile buffer.\n");
+            return NULL;
+        }
+
+        writer->buf = buf;
+        writer->buf_size = buf_size;
+    }
+
+    return writer->buf + writer->buf_len;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_commit
+//  Adds size bytes written into logfile_writer_reserve() buffer to the logfile.
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_commit(logfile_writer_t *writer, size_t size)
+{
+    writer->buf_len += size;
+    writer->file_size += size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_printf
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_printf(logfile_writer_t *writer, const char *format, ...)
+{
+    va_list args;
+    char buf[512];
+
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    if (len > 0)
+    {
+        len = (len < (int)sizeof(buf)) ? len : (int)sizeof(buf) - 1;
+
+        char *dst = logfile_writer_reserve(writer, len);
+        if (dst)
+        {
+            memcpy(dst, buf, len);
+            logfile_writer_commit(writer, len);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_write_block
+//  Encodes frames gathered in block_values as varint columns and adds the block to the index.
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_write_block(logfile_writer_t *writer)
+{
+    uint32_t channel;
+    uint32_t channels = writer->header.channels;
+    uint32_t frame_count = writer->block_frames;
+
+    if (!frame_count)
+        return;
+
+    writer->block_frames = 0;
+
+    if (writer->index_count >= writer->index_size)
+    {
+        size_t index_size = writer->index_size ? (writer->index_size * 2) : 256;
+        struct voglperf_log_index_t *index = (struct voglperf_log_index_t *)realloc(writer->index, index_size * sizeof(*index));
+        if (!index)
+        {
+            syslog(LOG_ERR, "(voglperf) Out of memory growing logfile index.\n");
+            return;
+        }
+
+        writer->index = index;
+        writer->index_size = index_size;
+    }
+
+    size_t size_max = sizeof(struct voglperf_log_block_t) + VOGLPERF_LOG_CHANNEL_COUNT * frame_count * VOGLPERF_VARINT_MAX_BYTES;
+    uint8_t *dst = (uint8_t *)logfile_writer_reserve(writer, size_max);
+    if (!dst)
+        return;
+
+    struct voglperf_log_block_t block;
+    uint8_t *data = dst + sizeof(block);
+    uint8_t *data_end = data;
+
+    for (channel = 0; channel < VOGLPERF_LOG_CHANNEL_COUNT; channel++)
+    {
+        uint32_t i;
+
+        if (!(channels & (1 << channel)))
+            continue;
+
+        for (i = 0; i < frame_count; i++)
+            data_end = voglperf_varint_write(data_end, writer->block_values[channel][i]);
+    }
+
+    block.magic = VOGLPERF_LOG_BLOCK_MAGIC;
+    block.frame_count = frame_count;
+    block.channels = channels;
+    block.data_size = (uint32_t)(data_end - data);
+    block.time_base = writer->block_time_base;
+    block.time_end = writer->block_time_end;
+    memcpy(dst, &block, sizeof(block));
+
+    struct voglperf_log_index_t *index = &writer->index[writer->index_count++];
+    index->time_base = block.time_base;
+    index->time_end = block.time_end;
+    index->offset = writer->file_size;
+    index->frame_count = frame_count;
+    index->pad = 0;
+
+    if (!writer->header.frame_count)
+        writer->header.time_start = block.time_base;
+    writer->header.frame_count += frame_count;
+
+    logfile_writer_commit(writer, data_end - dst);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_surface_frame_time
+//  Returns time since surface last swapped in this logfile, or since the last frame if it hasn't yet.
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t logfile_writer_surface_frame_time(logfile_writer_t *writer, const struct voglperf_frame_t *frame)
+{
+    uint64_t time_frame = frame->time - writer->time_last;
+
+    if (frame->surface >= writer->surface_count)
+    {
+        uint32_t surface_count = frame->surface + 8;
+        uint64_t *surface_time_last = (uint64_t *)realloc(writer->surface_time_last, surface_count * sizeof(uint64_t));
+        if (!surface_time_last)
+            return time_frame;
+
+        memset(surface_time_last + writer->surface_count, 0, (surface_count - writer->surface_count) * sizeof(uint64_t));
+        writer->surface_time_last = surface_time_last;
+        writer->surface_count = surface_count;
+    }
+
+    if (writer->surface_time_last[frame->surface])
+        time_frame = frame->time - writer->surface_time_last[frame->surface];
+
+    writer->surface_time_last[frame->surface] = frame->time;
+    return time_frame;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_add_frame
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_add_frame(logfile_writer_t *writer, const struct voglperf_frame_t *frame)
+{
+    static const double g_rcpMILLION = (1.0 / 1000000);
+
+    if (!writer->binary)
+    {
+        uint64_t time_frame = logfile_writer_surface_frame_time(writer, frame);
+
+        logfile_writer_printf(writer, "%.2f, %.2f, %.2f, %.2f, %u", time_frame * g_rcpMILLION,
+                              frame->cpu_time * g_rcpMILLION, frame->swap_time * g_rcpMILLION,
+                              voglperf_frame_off_cpu(time_frame, frame->cpu_time, frame->swap_time, frame->limit_time) * g_rcpMILLION,
+                              frame->surface);
+        if (g_gputime)
+            logfile_writer_printf(writer, ", %.2f", frame->gpu_time * g_rcpMILLION);
+        if (writer->limit)
+            logfile_writer_printf(writer, ", %.2f", frame->limit_time * g_rcpMILLION);
+        logfile_writer_printf(writer, "\n");
+        if (frame->hitch_median)
+            logfile_writer_printf(writer, VOGLPERF_LOG_CSV_HITCH_FORMAT, time_frame * g_rcpMILLION, frame->hitch_median * g_rcpMILLION);
+        return;
+    }
+
+    // Binary logs store the time since the previous frame so absolute times can be rebuilt. Readers work out
+    // per surface frame times from the surface column.
+    uint64_t time_frame = frame->time - writer->time_last;
+
+    if (!writer->block_frames)
+        writer->block_time_base = writer->time_last;
+
+    writer->block_values[VOGLPERF_LOG_CHANNEL_CPU_TIME][writer->block_frames] = frame->cpu_time;
+    writer->block_values[VOGLPERF_LOG_CHANNEL_SWAP_TIME][writer->block_frames] = frame->swap_time;
+    writer->block_values[VOGLPERF_LOG_CHANNEL_GPU_TIME][writer->block_frames] = frame->gpu_time;
+    writer->block_values[VOGLPERF_LOG_CHANNEL_SURFACE][writer->block_frames] = frame->surface;
+    writer->block_values[VOGLPERF_LOG_CHANNEL_LIMIT_TIME][writer->block_frames] = frame->limit_time;
+    writer->block_values[VOGLPERF_LOG_CHANNEL_HITCH_MEDIAN][writer->block_frames] = frame->hitch_median;
+    writer->block_values[VOGLPERF_LOG_CHANNEL_FRAME_TIME][writer->block_frames++] = time_frame;
+    writer->block_time_end = frame->time;
+
+    if (writer->block_frames == VOGLPERF_LOG_BLOCK_FRAMES)
+        logfile_writer_write_block(writer);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_flush
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_flush(logfile_writer_t *writer)
+{
+    if ((writer->fd != -1) && writer->buf_len)
+    {
+        size_t offset = 0;
+
+        while (offset < writer->buf_len)
+        {
+            ssize_t ret = HANDLE_EINTR(write(writer->fd, writer->buf + offset, writer->buf_len - offset));
+            if (ret <= 0)
+            {
+                syslog(LOG_ERR, "(voglperf) Error writing '%s': %s\n", writer->name, strerror(errno));
+                break;
+            }
+            offset += ret;
+        }
+    }
+
+    writer->buf_len = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_apply
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_apply(logfile_writer_t *writer, const logfile_request_t *request)
+{
+    if (writer->fd != -1)
+    {
+        uint64_t dropped = __atomic_load_n(&writer->dropped, __ATOMIC_RELAXED) - writer->dropped_start;
+
+        if (dropped)
+            syslog(LOG_WARNING, "(voglperf) WARNING: %" PRIu64 " frames dropped from '%s'.\n", dropped, writer->name);
+
+        if (writer->binary)
+        {
+            writer->header.dropped = dropped;
+
+            // Write the last partial block and the block index.
+            logfile_writer_write_block(writer);
+
+            size_t index_bytes = writer->index_count * sizeof(writer->index[0]);
+            char *dst = logfile_writer_reserve(writer, index_bytes);
+            if (dst)
+            {
+                writer->header.index_offset = writer->file_size;
+                writer->header.block_count = writer->index_count;
+
+                memcpy(dst, writer->index, index_bytes);
+                logfile_writer_commit(writer, index_bytes);
+            }
+        }
+
+        // Write out whatever frame times we've built up and close the file.
+        logfile_writer_flush(writer);
+
+        if (writer->binary)
+        {
+            // Header now has final frame count and index location.
+            if (HANDLE_EINTR(pwrite(writer->fd, &writer->header, sizeof(writer->header), 0)) != sizeof(writer->header))
+                syslog(LOG_ERR, "(voglperf) Error writing header '%s': %s\n", writer->name, strerror(errno));
+        }
+        else
+        {
+            // Fill in the dropped frame count we left room for in the header.
+            char dropped_line[64];
+            int len = snprintf(dropped_line, sizeof(dropped_line), LOGFILE_DROPPED_FORMAT, dropped);
+
+            if (HANDLE_EINTR(pwrite(writer->fd, dropped_line, len, writer->dropped_offset)) != len)
+                syslog(LOG_ERR, "(voglperf) Error writing header '%s': %s\n", writer->name, strerror(errno));
+        }
+
+        close(writer->fd);
+        writer->fd = -1;
+
+        // Notify folks.
+        if ((g_msqid != -1) && !writer->dump)
+        {
+            struct mbuf_logfile_stop_t mbuf_stop;
+
+            snprintf(mbuf_stop.logfile, sizeof(mbuf_stop.logfile), "%s", writer->name);
+
+            int ret = voglperf_msgsnd(MSGTYPE_LOGFILE_STOP_NOTIFY, &mbuf_stop,
+                                      offsetof(struct mbuf_logfile_stop_t, logfile) + strlen(mbuf_stop.logfile) + 1, IPC_NOWAIT);
+            if (ret == -1)
+                syslog(LOG_ERR, "(voglperf) msgsnd failed: %d. %s\n", ret, strerror(errno));
+        }
+
+        writer->name[0] = 0;
+    }
+
+    if (request->type != LOGFILE_REQUEST_OPEN)
+        return;
+
+    size_t name_len = strlen(request->name);
+    size_t ext_len = strlen(VOGLPERF_LOG_EXTENSION);
+
+    writer->binary = (name_len >= ext_len) && !strcmp(request->name + name_len - ext_len, VOGLPERF_LOG_EXTENSION);
+    writer->fd = open(request->name, writer->binary ? (O_WRONLY | O_CREAT | O_TRUNC) : (O_WRONLY | O_CREAT), 0666);
+    if (writer->fd == -1)
+    {
+        syslog(LOG_ERR, "(voglperf) Error opening '%s': %s\n", request->name, strerror(errno));
+        return;
+    }
+
+    time_t now;
+
+    time(&now);
+    writer->file_size = 0;
+    writer->limit = !!__atomic_load_n(&g_fpslimit, __ATOMIC_RELAXED);
+
+    if (writer->binary)
+    {
+        struct voglperf_log_header_t *header = &writer->header;
+
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, VOGLPERF_LOG_MAGIC, sizeof(header->magic));
+        header->version = VOGLPERF_LOG_VERSION;
+        header->header_size = sizeof(*header);
+        header->channels = (1 << VOGLPERF_LOG_CHANNEL_FRAME_TIME) | (1 << VOGLPERF_LOG_CHANNEL_CPU_TIME) |
+                           (1 << VOGLPERF_LOG_CHANNEL_SWAP_TIME) | (1 << VOGLPERF_LOG_CHANNEL_SURFACE) |
+                           (1 << VOGLPERF_LOG_CHANNEL_HITCH_MEDIAN);
+        if (g_gputime)
+            header->channels |= (1 << VOGLPERF_LOG_CHANNEL_GPU_TIME);
+        if (writer->limit)
+            header->channels |= (1 << VOGLPERF_LOG_CHANNEL_LIMIT_TIME);
+        header->block_frames = VOGLPERF_LOG_BLOCK_FRAMES;
+        header->wall_time = now;
+        header->time_start = request->time;
+        snprintf(header->program, sizeof(header->program), "%s", program_invocation_short_name);
+        header->clock = g_clock;
+        header->tsc_hz = vogl_clock_tsc_hz();
+
+        writer->block_frames = 0;
+        writer->index_count = 0;
+
+        char *dst = logfile_writer_reserve(writer, sizeof(*header));
+        if (dst)
+        {
+            memcpy(dst, header, sizeof(*header));
+            logfile_writer_commit(writer, sizeof(*header));
+        }
+    }
+    else
+    {
+        struct tm now_tm;
+        char timebuf[256];
+
+        strftime(timebuf, sizeof(timebuf), "%h %e %T", localtime_r(&now, &now_tm));
+
+        logfile_writer_printf(writer, "# %s - %s\n", timebuf, program_invocation_short_name);
+
+        writer->dropped_offset = writer->file_size;
+        logfile_writer_printf(writer, LOGFILE_DROPPED_FORMAT, (uint64_t)0);
+        if (g_clock == VOGLPERF_CLOCK_TSC)
+            logfile_writer_printf(writer, "# clock: tsc %" PRIu64 " Hz\n", vogl_clock_tsc_hz());
+        else
+            logfile_writer_printf(writer, "# clock: %s\n", voglperf_clock_name(g_clock));
+        logfile_writer_printf(writer, LOGFILE_COLUMNS_LINE "%s%s\n", g_gputime ? ", gpu_ms" : "",
+                              writer->limit ? ", limit_ms" : "");
+    }
+
+    writer->dropped_start = __atomic_load_n(&writer->dropped, __ATOMIC_RELAXED);
+
+    // First frame in the file is measured from the last frame before the open.
+    writer->time_last = request->time;
+    if (writer->surface_count)
+        memset(writer->surface_time_last, 0, writer->surface_count * sizeof(uint64_t));
+    snprintf(writer->name, sizeof(writer->name), "%s", request->name);
+
+    if ((g_msqid != -1) && !writer->dump)
+    {
+        struct mbuf_logfile_start_t mbuf_start;
+
+        snprintf(mbuf_start.logfile, sizeof(mbuf_start.logfile), "%s", writer->name);
+        mbuf_start.time = request->seconds;
+
+        int ret = voglperf_msgsnd(MSGTYPE_LOGFILE_START_NOTIFY, &mbuf_start,
+                                  offsetof(struct mbuf_logfile_start_t, logfile) + strlen(mbuf_start.logfile) + 1, IPC_NOWAIT);
+        if (ret == -1)
+            syslog(LOG_ERR, "(voglperf) msgsnd failed: %d. %s\n", ret, strerror(errno));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_add_producer
+//  Called by a swap thread to hand its queue to the writer.
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_add_producer(logfile_writer_t *writer, frame_producer_t *producer)
+{
+    frame_producer_t *head = __atomic_load_n(&writer->producers, __ATOMIC_RELAXED);
+
+    do
+    {
+        producer->next = head;
+    } while (!__atomic_compare_exchange_n(&writer->producers, &head, producer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_pop
+//  Appends everything in queue to the batch. Returns 0 if we ran out of memory before emptying it.
+//----------------------------------------------------------------------------------------------------------------------
+static int logfile_writer_pop(logfile_writer_t *writer, frame_queue_t *queue)
+{
+    static const size_t s_pop_frames = 4096;
+
+    for (;;)
+    {
+        if (writer->batch_count + s_pop_frames > writer->batch_size)
+        {
+            size_t batch_size = writer->batch_size ? (writer->batch_size * 2) : (4 * s_pop_frames);
+            struct voglperf_frame_t *batch = (struct voglperf_frame_t *)realloc(writer->batch, batch_size * sizeof(*batch));
+            if (!batch)
+            {
+                // Leave the rest in the queue for next time.
+                syslog(LOG_ERR, "(voglperf) Out of memory growing logfile frame batch.\n");
+                return 0;
+            }
+
+            writer->batch = batch;
+            writer->batch_size = batch_size;
+        }
+
+        uint32_t count = frame_queue_pop(queue, writer->batch + writer->batch_count, s_pop_frames);
+
+        writer->batch_count += count;
+        if (count < s_pop_frames)
+            return 1;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_frame_compare
+//----------------------------------------------------------------------------------------------------------------------
+static int logfile_writer_frame_compare(const void *elem0, const void *elem1)
+{
+    const struct voglperf_frame_t *frame0 = (const struct voglperf_frame_t *)elem0;
+    const struct voglperf_frame_t *frame1 = (const struct voglperf_frame_t *)elem1;
+
+    return (frame0->time > frame1->time) - (frame0->time < frame1->time);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_free
+//  Frees the buffers owned by the writer thread.
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_free(logfile_writer_t *writer)
+{
+    free(writer->buf);
+    writer->buf = NULL;
+    writer->buf_len = 0;
+    writer->buf_size = 0;
+    free(writer->index);
+    writer->index = NULL;
+    free(writer->surface_time_last);
+    writer->surface_time_last = NULL;
+    writer->surface_count = 0;
+    writer->index_count = 0;
+    writer->index_size = 0;
+    free(writer->batch);
+    writer->batch = NULL;
+    writer->batch_count = 0;
+    writer->batch_size = 0;
+    writer->batch_held = 0;
+    writer->held_request_count = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_dump_notify
+//  Tells voglperfrun a flight recorder dump is done. frame_count is 0 if nothing was written.
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_dump_notify(const char *logfile_name, uint64_t frame_count, uint64_t time)
+{
+    struct mbuf_logfile_dump_t mbuf_dump;
+
+    syslog(LOG_INFO, "(voglperf) Dumped %" PRIu64 " frames to '%s'.\n", frame_count, logfile_name);
+
+    if (g_msqid == -1)
+        return;
+
+    mbuf_dump.frame_count = frame_count;
+    mbuf_dump.time = time;
+    snprintf(mbuf_dump.logfile, sizeof(mbuf_dump.logfile), "%s", logfile_name);
+
+    int ret = voglperf_msgsnd(MSGTYPE_LOGFILE_DUMP_NOTIFY, &mbuf_dump,
+                              offsetof(struct mbuf_logfile_dump_t, logfile) + strlen(mbuf_dump.logfile) + 1, IPC_NOWAIT);
+    if (ret == -1)
+        syslog(LOG_ERR, "(voglperf) msgsnd failed: %d. %s\n", ret, strerror(errno));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_dump
+//  Writes the last request->seconds of the flight recorder to request->name. Uses a writer of its own so a
+//  logfile being captured carries on undisturbed.
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_dump(const logfile_request_t *request)
+{
+    uint64_t skipped;
+    struct voglperf_frame_t *frames;
+    size_t count = flight_recorder_snapshot(&frames, &skipped);
+    uint64_t frame_count = 0;
+    uint64_t time = 0;
+
+    // Frames from different threads can land in the ring slightly out of order.
+    if (count)
+        qsort(frames, count, sizeof(frames[0]), logfile_writer_frame_compare);
+
+    // First frame we write is measured from the one before it, same as any other logfile. Asking for more seconds
+    //  than the clock has been running starts at the oldest frame, like asking for more than the ring holds.
+    size_t first = 1;
+    if (count && request->seconds && (request->seconds < frames[count - 1].time / 1000000000))
+    {
+        uint64_t time_start = frames[count - 1].time - request->seconds * 1000000000;
+
+        while ((first < count) && (frames[first].time < time_start))
+            first++;
+    }
+
+    logfile_writer_t *writer = (count > first) ? (logfile_writer_t *)calloc(1, sizeof(logfile_writer_t)) : NULL;
+    if (writer)
+    {
+        logfile_request_t open_request = *request;
+        logfile_request_t close_request = *request;
+        size_t i;
+
+        open_request.type = LOGFILE_REQUEST_OPEN;
+        open_request.time = frames[first - 1].time;
+        close_request.type = LOGFILE_REQUEST_CLOSE;
+
+        writer->fd = -1;
+        writer->dump = 1;
+        logfile_writer_apply(writer, &open_request);
+
+        if (writer->fd != -1)
+        {
+            // Slots overwritten while we copied them are reported as dropped frames.
+            writer->dropped = skipped;
+
+            for (i = first; i < count; i++)
+            {
+                logfile_writer_add_frame(writer, &frames[i]);
+                writer->time_last = frames[i].time;
+            }
+
+            logfile_writer_apply(writer, &close_request);
+
+            frame_count = count - first;
+            time = frames[count - 1].time - frames[first - 1].time;
+        }
+
+        logfile_writer_free(writer);
+        free(writer);
+    }
+    else
+    {
+        syslog(LOG_WARNING, "(voglperf) WARNING: No flight recorder frames to dump to '%s'.\n", request->name);
+    }
+
+    free(frames);
+
+    logfile_dump_notify(request->name, frame_count, time);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_update
+//  Frames are written in the order they were timed. One from a thread that's still busy timing and pushing it can
+//  be older than frames other threads have already pushed, so anything newer than when it started is held back
+//  for the next update, unless flush is set (the writer's quitting).
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_update(logfile_writer_t *writer, int flush)
+{
+    size_t i;
+    uint32_t request_count;
+    uint32_t request_index = 0;
+    uint32_t producer_count = 0;
+    logfile_request_t requests[2 * LOGFILE_WRITER_MAX_REQUESTS];
+
+    // Threads that aren't busy now can't time a frame before now.
+    uint64_t time_safe = flush ? UINT64_MAX : vogl_get_time_ns();
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // Grab requests before popping frames. Every frame a request refers to has already been pushed.
+    request_count = writer->held_request_count;
+    memcpy(requests, writer->held_requests, request_count * sizeof(requests[0]));
+    pthread_mutex_lock(&writer->lock);
+    memcpy(requests + request_count, writer->requests, writer->request_count * sizeof(requests[0]));
+    request_count += writer->request_count;
+    writer->request_count = 0;
+    pthread_mutex_unlock(&writer->lock);
+
+    // Dumps come straight from the flight recorder and don't touch the logfile being captured.
+    for (i = 0; i < request_count;)
+    {
+        if (requests[i].type == LOGFILE_REQUEST_DUMP)
+        {
+            logfile_writer_dump(&requests[i]);
+            memmove(&requests[i], &requests[i + 1], (request_count - i - 1) * sizeof(requests[0]));
+            request_count--;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    // Gather frames from every swap thread.
+    frame_producer_t *prev = NULL;
+    frame_producer_t *producer = __atomic_load_n(&writer->producers, __ATOMIC_ACQUIRE);
+
+    writer->batch_count = writer->batch_held;
+    while (producer)
+    {
+        frame_producer_t *next = producer->next;
+
+        size_t batch_count = writer->batch_count;
+
+        // Check before popping so we know we've seen its last frame, and whether it may push an older one yet.
+        int exited = __atomic_load_n(&producer->exited, __ATOMIC_ACQUIRE);
+        uint64_t time_busy = __atomic_load_n(&producer->time_busy, __ATOMIC_SEQ_CST);
+        if (time_busy && (time_busy < time_safe))
+            time_safe = time_busy;
+
+        int drained = logfile_writer_pop(writer, &producer->queue);
+
+        if (writer->batch_count != batch_count)
+            producer_count++;
+
+        // Swap threads only ever push onto the head of the list, so everything after it is ours to unlink.
+        if (exited && drained && prev)
+        {
+            prev->next = next;
+            frame_queue_destroy(&producer->queue);
+            free(producer);
+        }
+        else
+        {
+            // Make sure the swap path has spare chunks to grow into.
+            if (!exited)
+                frame_queue_refill(&producer->queue);
+            prev = producer;
+        }
+
+        producer = next;
+    }
+
+    // Frames from different threads interleave.
+    if ((producer_count > 1) || ((producer_count == 1) && writer->batch_held))
+        qsort(writer->batch, writer->batch_count, sizeof(writer->batch[0]), logfile_writer_frame_compare);
+
+    for (i = 0; (i < writer->batch_count) && (writer->batch[i].time < time_safe); i++)
+    {
+        struct voglperf_frame_t *frame = &writer->batch[i];
+
+        while ((request_index < request_count) && (requests[request_index].time < frame->time))
+            logfile_writer_apply(writer, &requests[request_index++]);
+
+        // Add this frame time to our logfile.
+        if ((writer->fd != -1) && writer->time_last)
+            logfile_writer_add_frame(writer, frame);
+
+        writer->time_last = frame->time;
+    }
+
+    while ((request_index < request_count) && (requests[request_index].time < time_safe))
+        logfile_writer_apply(writer, &requests[request_index++]);
+
+    // Keep the rest for next time. If that's more requests than we can hold the oldest just go ahead.
+    while (request_count - request_index > LOGFILE_WRITER_MAX_REQUESTS)
+        logfile_writer_apply(writer, &requests[request_index++]);
+
+    writer->batch_held = writer->batch_count - i;
+    memmove(writer->batch, writer->batch + i, writer->batch_held * sizeof(writer->batch[0]));
+    writer->held_request_count = request_count - request_index;
+    memcpy(writer->held_requests, requests + request_index, writer->held_request_count * sizeof(requests[0]));
+
+    logfile_writer_flush(writer);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_threadproc
+//----------------------------------------------------------------------------------------------------------------------
+static void *logfile_writer_threadproc(void *arg)
+{
+    logfile_writer_t *writer = (logfile_writer_t *)arg;
+
+    for (;;)
+    {
+        int quit = __atomic_load_n(&writer->quit, __ATOMIC_ACQUIRE);
+
+        logfile_writer_update(writer, quit);
+        if (quit)
+            break;
+
+        vogl_delay(10);
+    }
+
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_start
+//----------------------------------------------------------------------------------------------------------------------
+static int logfile_writer_start()
+{
+    logfile_writer_t *writer = &g_logfile_writer;
+
+    if (writer->started)
+        return 1;
+
+    // Swap threads add their producer queues once they see we've started.
+    int ret = pthread_create(&writer->thread, NULL, logfile_writer_threadproc, writer);
+    if (ret)
+    {
+        syslog(LOG_ERR, "(voglperf) pthread_create failed: %s\n", strerror(ret));
+        return 0;
+    }
+
+    __atomic_store_n(&writer->started, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_stop
+//  Writes out everything still queued, closes the logfile and joins the writer thread. Producer queues are
+//  left alone since threads that are still running may keep pushing to them.
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_stop()
+{
+    logfile_writer_t *writer = &g_logfile_writer;
+
+    if (!writer->started)
+        return;
+
+    __atomic_store_n(&writer->started, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&writer->quit, 1, __ATOMIC_RELEASE);
+    pthread_join(writer->thread, NULL);
+
+    logfile_writer_free(writer);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_atfork_child
+//  Forked children only get the thread that called fork(). The writer thread and any open logfile stay with the
+//  parent, so start over with nothing open. Buffers the writer thread owned are ours now and get reused.
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_atfork_child()
+{
+    logfile_writer_t *writer = &g_logfile_writer;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    writer->started = 0;
+    writer->quit = 0;
+    writer->producers = NULL;
+    writer->request_count = 0;
+    writer->batch_held = 0;
+    writer->held_request_count = 0;
+
+    if (writer->fd != -1)
+    {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    writer->name[0] = 0;
+    writer->buf_len = 0;
+
+    pthread_mutex_init(&g_logfile_lock, NULL);
+    g_logfile_name[0] = 0;
+    g_logfile_time_end = 0;
+
+    // The parent's capture, it writes it.
+    g_dump_time_end = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// logfile_writer_request
+//----------------------------------------------------------------------------------------------------------------------
+static void logfile_writer_request(int type, const char *logfile_name, uint64_t seconds)
+{
+    logfile_writer_t *writer = &g_logfile_writer;
+
+    pthread_mutex_lock(&writer->lock);
+
+    if (writer->request_count < LOGFILE_WRITER_MAX_REQUESTS)
+    {
+        logfile_request_t *request = &writer->requests[writer->request_count++];
+
+        request->type = type;
+        request->time = __atomic_load_n(&writer->time_pushed, __ATOMIC_RELAXED);
+        request->seconds = seconds;
+        snprintf(request->name, sizeof(request->name), "%s", logfile_name ? logfile_name : "");
+    }
+    else
+    {
+        syslog(LOG_ERR, "(voglperf) Too many logfile requests queued.\n");
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// Call with g_logfile_lock held.
+static void voglperf_logfile_close_locked()
+{
+    if (!g_logfile_name[0])
+        return;
+
+    syslog(LOG_INFO, "(voglperf) logfile_close(%s).\n", g_logfile_name);
+
+    // Writer thread flushes, closes the file and notifies folks.
+    logfile_writer_request(LOGFILE_REQUEST_CLOSE, NULL, 0);
+
+    g_logfile_name[0] = 0;
+    __atomic_store_n(&g_logfile_time_end, 0, __ATOMIC_RELAXED);
+}
+
+static void voglperf_logfile_close()
+{
+    pthread_mutex_lock(&g_logfile_lock);
+    voglperf_logfile_close_locked();
+    pthread_mutex_unlock(&g_logfile_lock);
+}
+
+static int voglperf_logfile_open(const char *logfile_name, uint64_t seconds)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&g_logfile_lock);
+
+    // Make sure nothing is currently open.
+    voglperf_logfile_close_locked();
+
+    syslog(LOG_INFO, "(voglperf) logfile_open(%s) %" PRIu64 " seconds.\n", logfile_name, seconds);
+
+    if (logfile_writer_start())
+    {
+        logfile_writer_request(LOGFILE_REQUEST_OPEN, logfile_name, seconds);
+
+        // Wall clock end time so it doesn't matter how many surfaces are swapping.
+        uint64_t time_end = 0;
+        if (seconds && (seconds < UINT64_MAX / 2000000000))
+            time_end = vogl_get_time_ns() + seconds * 1000000000;
+        __atomic_store_n(&g_logfile_time_end, time_end, __ATOMIC_RELAXED);
+        snprintf(g_logfile_name, sizeof(g_logfile_name), "%s", logfile_name);
+    }
+    else
+    {
+        syslog(LOG_ERR, "(voglperf) Error starting logfile writer for '%s'.\n", logfile_name);
+        ret = -1;
+    }
+
+    pthread_mutex_unlock(&g_logfile_lock);
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_logfile_dump
+//  Has the writer thread write the last seconds (0 for all) of the flight recorder to logfile_name.
+//----------------------------------------------------------------------------------------------------------------------
+static int voglperf_logfile_dump(const char *logfile_name, uint64_t seconds)
+{
+    syslog(LOG_INFO, "(voglperf) logfile_dump(%s) %" PRIu64 " seconds.\n", logfile_name, seconds);
+
+    if (!g_flight_seconds)
+    {
+        syslog(LOG_ERR, "(voglperf) Flight recorder is off, can't dump '%s'.\n", logfile_name);
+        logfile_dump_notify(logfile_name, 0, 0);
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_logfile_lock);
+    int started = logfile_writer_start();
+    pthread_mutex_unlock(&g_logfile_lock);
+
+    if (!started)
+    {
+        syslog(LOG_ERR, "(voglperf) Error starting logfile writer for '%s'.\n", logfile_name);
+        logfile_dump_notify(logfile_name, 0, 0);
+        return -1;
+    }
+
+    logfile_writer_request(LOGFILE_REQUEST_DUMP, logfile_name, seconds);
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_logfile_dump_check
+//  Writes the deferred dump once its time is up, or right away with flush set.
+//----------------------------------------------------------------------------------------------------------------------
+static void voglperf_logfile_dump_check(uint64_t time_cur, int flush)
+{
+    uint64_t time_end = __atomic_load_n(&g_dump_time_end, __ATOMIC_RELAXED);
+    char logfile_name[PATH_MAX];
+    uint64_t seconds = 0;
+
+    if (!time_end || (!flush && (time_cur < time_end)))
+        return;
+
+    pthread_mutex_lock(&g_logfile_lock);
+
+    // Another thread may have beaten us to it.
+    time_end = g_dump_time_end;
+    if (time_end && (flush || (time_cur >= time_end)))
+    {
+        snprintf(logfile_name, sizeof(logfile_name), "%s", g_dump_name);
+        seconds = (time_cur - g_dump_time_start + 999999999) / 1000000000;
+        __atomic_store_n(&g_dump_time_end, 0, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&g_logfile_lock);
+
+    if (seconds)
+        voglperf_logfile_dump(logfile_name, seconds);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_logfile_dump_deferred
+//  Dumps the last seconds of the flight recorder once another post seconds have been recorded, or when we exit if
+//  that's sooner. One for the dump already waiting replaces it (voglperfrun stretching a capture), one for another
+//  logfile writes the waiting one out first.
+//----------------------------------------------------------------------------------------------------------------------
+static void voglperf_logfile_dump_deferred(const char *logfile_name, uint64_t seconds, uint64_t post)
+{
+    uint64_t time_cur = vogl_get_time_ns();
+
+    pthread_mutex_lock(&g_logfile_lock);
+    int other = g_dump_time_end && strcmp(g_dump_name, logfile_name);
+    pthread_mutex_unlock(&g_logfile_lock);
+
+    if (other)
+        voglperf_logfile_dump_check(time_cur, 1);
+
+    syslog(LOG_INFO, "(voglperf) logfile_dump(%s) %" PRIu64 " seconds, writing in %" PRIu64 ".\n", logfile_name,
+           seconds, post);
+
+    pthread_mutex_lock(&g_logfile_lock);
+    snprintf(g_dump_name, sizeof(g_dump_name), "%s", logfile_name);
+    g_dump_time_start = time_cur - ((seconds < time_cur / 1000000000) ? seconds * 1000000000 : time_cur);
+    __atomic_store_n(&g_dump_time_end, time_cur + post * 1000000000, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_logfile_lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_logfile_check_end
+//  Closes the logfile once its time is up.
+//----------------------------------------------------------------------------------------------------------------------
+static void voglperf_logfile_check_end(uint64_t time_cur)
+{
+    uint64_t time_end = __atomic_load_n(&g_logfile_time_end, __ATOMIC_RELAXED);
+
+    if (time_end && (time_cur >= time_end))
+    {
+        pthread_mutex_lock(&g_logfile_lock);
+
+        // Another thread may have beaten us to it, or opened a new logfile.
+        time_end = g_logfile_time_end;
+        if (time_end && (time_cur >= time_end))
+            voglperf_logfile_close_locked();
+
+        pthread_mutex_unlock(&g_logfile_lock);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// showfps_set
 //----------------------------------------------------------------------------------------------------------------------
 static void showfps_set(int showfps)
 {
-#define LOADX11FUNC(_handle, _func) \
-    do \
-    { \
-      X11_##_func = (VOGL_DYNX11FN_##_func) vogl_load_function(_handle, #_func); \
-    } while (0)
+#define LOADX11FUNC(_handle, _func) \
+    do \
+    { \
+      X11_##_func = (VOGL_DYNX11FN_##_func) vogl_load_function(_handle, #_func); \
+    } while (0)
+
+    g_showfps = showfps;
+
+    if (g_showfps)
+    {
+        static void *s_handle_x11 = NULL;
+
+        if (!s_handle_x11)
+        {
+            s_handle_x11 = vogl_load_object("libX11.so.6");
+            if (s_handle_x11)
+            {
+                LOADX11FUNC(s_handle_x11, XLoadQueryFont);
+                LOADX11FUNC(s_handle_x11, XCreateGC);
+                LOADX11FUNC(s_handle_x11, XDrawString);
+                LOADX11FUNC(s_handle_x11, XFreeGC);
+            }
+        }
+
+        // X11 is only needed for contexts the GL overlay can't handle.
+        if (!X11_XLoadQueryFont || !X11_XCreateGC || !X11_XDrawString || !X11_XFreeGC)
+        {
+            syslog(LOG_WARNING, "(voglperf) WARNING: Failed to load X11 function pointers.\n");
+            X11_XCreateGC = NULL;
+            X11_XDrawString = NULL;
+        }
+    }
+
+#undef LOADX11FUNC
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// frame_ring_attach
+//----------------------------------------------------------------------------------------------------------------------
+static void frame_ring_attach(int shmid)
+{
+    struct shmid_ds ds;
+
+    if (shmctl(shmid, IPC_STAT, &ds) == -1)
+    {
+        syslog(LOG_ERR, "(voglperf) shmctl(%d) failed: %s\n", shmid, strerror(errno));
+        return;
+    }
+
+    void *addr = shmat(shmid, NULL, 0);
+    if (addr == (void *)-1)
+    {
+        syslog(LOG_ERR, "(voglperf) shmat(%d) failed: %s\n", shmid, strerror(errno));
+        return;
+    }
+
+    // Make sure the ring voglperfrun set up is one we understand and actually fits in the segment.
+    struct voglperf_frame_ring_t *ring = (struct voglperf_frame_ring_t *)addr;
+    if ((ds.shm_segsz >= sizeof(*ring)) && (ring->magic == VOGLPERF_FRAME_RING_MAGIC) &&
+            (ring->version != VOGLPERF_PROTOCOL_VERSION))
+    {
+        syslog(LOG_ERR, "(voglperf) Frame ring is protocol version %u, we're %u. Using messages instead.\n",
+               ring->version, VOGLPERF_PROTOCOL_VERSION);
+        shmdt(addr);
+        return;
+    }
+    if ((ds.shm_segsz < sizeof(*ring)) || (ring->magic != VOGLPERF_FRAME_RING_MAGIC) ||
+            !ring->size || (ring->size & (ring->size - 1)) ||
+            (ds.shm_segsz < voglperf_frame_ring_bytes(ring->size)))
+    {
+        syslog(LOG_ERR, "(voglperf) Invalid frame ring in shm segment %d.\n", shmid);
+        shmdt(addr);
+        return;
+    }
+
+    // Commands issued before we got here were for somebody else.
+    g_command_count = ring->control.command_count;
+    g_frame_ring = ring;
+    syslog(LOG_INFO, "(voglperf) frame ring attached (shmid: %d, %u frames, caps: 0x%x)\n", shmid, ring->size, ring->caps);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process tracking
+//  Steam runs games through wrapper processes and LD_PRELOAD follows every fork and exec, so voglperfrun hears
+//  from each process we're loaded in: when it starts, when it swaps its first frame and when it exits. It works
+//  out which one is the game from that.
+//----------------------------------------------------------------------------------------------------------------------
+static char g_exe[256];                 // Our executable, for mbuf_pid_t.
+static uint32_t g_process_swapped = 0;  // Set once this process has swapped a frame.
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_caps
+//  What voglperfrun can use with this process: the parts of the frame ring it offered that we attached to, plus the
+//  doorbell. Commands only go through the control block when this says we're reading it.
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t process_caps()
+{
+    uint32_t caps = 0;
+
+    if (g_frame_ring)
+        caps |= g_frame_ring->caps & (VOGLPERF_CAP_FRAME_RING | VOGLPERF_CAP_CONTROL);
+    if (g_doorbell_fd != -1)
+        caps |= VOGLPERF_CAP_DOORBELL;
+    return caps;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_notify
+//  Sends a VOGLPERF_PROCESS_* event to voglperfrun. Also called in forked children, so no locks or allocations.
+//----------------------------------------------------------------------------------------------------------------------
+static int process_notify(uint32_t event)
+{
+    struct mbuf_pid_t mbuf;
+
+    if (g_msqid == -1)
+        return -1;
+
+    mbuf.pid = getpid();
+    mbuf.ppid = getppid();
+    mbuf.event = event;
+    mbuf.caps = process_caps();
+    memcpy(mbuf.exe, g_exe, sizeof(mbuf.exe));
+
+    return voglperf_msgsnd(MSGTYPE_PID_NOTIFY, &mbuf, sizeof(mbuf), IPC_NOWAIT);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// options_apply
+//  Options voglperfrun can change while the game runs.
+//----------------------------------------------------------------------------------------------------------------------
+static void options_apply(int fpsshow, int verbose, uint32_t fpslimit)
+{
+    g_verbose = !!verbose;
+    showfps_set(!!fpsshow);
+    __atomic_store_n(&g_fpslimit, fpslimit, __ATOMIC_RELAXED);
+
+    syslog(LOG_INFO, "(voglperf) showfps:%d verbose:%d fpslimit:%u\n", g_showfps, g_verbose, fpslimit);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// control_update
+//  Runs any new commands from the frame ring's control block. Called every frame from any swap thread; unless
+//  voglperfrun has changed something it's a single load from shared memory.
+//----------------------------------------------------------------------------------------------------------------------
+static void control_update()
+{
+    static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+    static uint32_t s_seq = 0;                  // Control block seq we last applied.
+    static struct voglperf_control_t s_copy;    // Snapshot being applied (s_lock).
+    static uint32_t s_options_count = 0;        // Options we've applied (s_lock).
+
+    struct voglperf_control_t *control = &g_frame_ring->control;
+    uint32_t seq = __atomic_load_n(&control->seq, __ATOMIC_ACQUIRE);
+
+    if ((seq == __atomic_load_n(&s_seq, __ATOMIC_RELAXED)) || (seq & 1))
+        return;
+
+    // Somebody else is already on it.
+    if (pthread_mutex_trylock(&s_lock))
+        return;
+
+    memcpy(&s_copy, control, sizeof(s_copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // voglperfrun changed it again while we were copying. Pick it up next frame.
+    if ((seq != s_seq) && (seq == __atomic_load_n(&control->seq, __ATOMIC_RELAXED)))
+    {
+        uint64_t pid = (uint64_t)getpid();
+
+        // Commands for another process in the game's tree just get marked as seen.
+        if ((s_copy.options_count != s_options_count) && (!s_copy.pid || (s_copy.pid == pid)))
+            options_apply(s_copy.fpsshow, s_copy.verbose, s_copy.fpslimit);
+        s_options_count = s_copy.options_count;
+
+        if (s_copy.command_count - g_command_count > VOGLPERF_CONTROL_COMMANDS)
+        {
+            syslog(LOG_WARNING, "(voglperf) WARNING: Missed %" PRIu64 " commands from voglperfrun.\n",
+                   s_copy.command_count - g_command_count - VOGLPERF_CONTROL_COMMANDS);
+            g_command_count = s_copy.command_count - VOGLPERF_CONTROL_COMMANDS;
+        }
+
+        // Run the rest in the order they were issued.
+        for (; g_command_count < s_copy.command_count; g_command_count++)
+        {
+            struct voglperf_command_t *command = &s_copy.commands[g_command_count % VOGLPERF_CONTROL_COMMANDS];
+
+            if (command->pid && (command->pid != pid))
+                continue;
+
+            command->logfile[sizeof(command->logfile) - 1] = 0;
+            if (command->type == MSGTYPE_LOGFILE_STOP)
+                voglperf_logfile_close();
+            else if (command->type == MSGTYPE_LOGFILE_START)
+                voglperf_logfile_open(command->logfile, command->seconds);
+            else if ((command->type == MSGTYPE_LOGFILE_DUMP) && command->post)
+                voglperf_logfile_dump_deferred(command->logfile, command->seconds, command->post);
+            else if (command->type == MSGTYPE_LOGFILE_DUMP)
+                voglperf_logfile_dump(command->logfile, command->seconds);
+        }
+
+        __atomic_store_n(&s_seq, seq, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&s_lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_init
+//----------------------------------------------------------------------------------------------------------------------
+void voglperf_init()
+{
+    static int s_inited = 0;
+
+    if (!s_inited)
+    {
+        s_inited = 1;
+        g_pid = (uint32_t)getpid();
+
+        // LOG_INFO, LOG_WARNING, LOG_ERR
+        openlog(NULL, LOG_CONS | LOG_PERROR | LOG_PID, LOG_USER);
+
+        char *cmd_line = getenv("VOGLPERF_CMD_LINE");
+        if (cmd_line)
+        {
+            syslog(LOG_INFO, "(voglperf) built %s %s, begin initialization in %s\n", __DATE__, __TIME__, program_invocation_short_name);
+            syslog(LOG_INFO, "(voglperf) VOGLPERF_CMD_LINE: '%s'\n", cmd_line);
+
+            // Attach the frame ring first so the caps we announce below include it.
+            static const char s_shmid_arg[] = "--shmid=";
+            const char *shmid_str = strstr(cmd_line, s_shmid_arg);
+            if (shmid_str)
+            {
+                int shmid = atoi(shmid_str + sizeof(s_shmid_arg) - 1);
+                if (shmid >= 0)
+                    frame_ring_attach(shmid);
+            }
+
+            static const char s_msqid_arg[] = "--msqid=";
+            const char *msqid_str = strstr(cmd_line, s_msqid_arg);
+            if (msqid_str)
+            {
+                int msqid = atoi(msqid_str + sizeof(s_msqid_arg) - 1);
+                if (msqid >= 0)
+                {
+                    ssize_t len = readlink("/proc/self/exe", g_exe, sizeof(g_exe) - 1);
+                    if (len < 0)
+                        snprintf(g_exe, sizeof(g_exe), "%s", program_invocation_name);
+
+                    g_msqid = msqid;
+                    doorbell_connect(msqid);
+
+                    int ret = process_notify(VOGLPERF_PROCESS_START);
+                    if (ret != 0)
+                        g_msqid = -1;
+
+                    syslog(LOG_INFO, "(voglperf) msgsnd pid returns %d (msqid: %d)\n", ret, g_msqid);
+
+                    // Children we fork report in too.
+                    if (g_msqid != -1)
+                        pthread_atfork(NULL, NULL, voglperf_atfork_child);
+                }
+            }
+
+            g_verbose = !!strstr(cmd_line, "--verbose");
+            g_gputime = !!strstr(cmd_line, "--gputime");
+            g_glfinish = !!strstr(cmd_line, "--glfinish");
+
+            static const char s_hitch_factor_arg[] = "--hitch-factor=";
+            const char *hitch_factor_str = strstr(cmd_line, s_hitch_factor_arg);
+            if (hitch_factor_str)
+                g_hitch_factor = (float)atof(hitch_factor_str + sizeof(s_hitch_factor_arg) - 1);
+
+            static const char s_hitch_ms_arg[] = "--hitch-ms=";
+            const char *hitch_ms_str = strstr(cmd_line, s_hitch_ms_arg);
+            if (hitch_ms_str)
+            {
+                double hitch_ms = atof(hitch_ms_str + sizeof(s_hitch_ms_arg) - 1);
+                g_hitch_budget = (hitch_ms > 0.0) ? (uint64_t)(hitch_ms * 1000000.0) : 0;
+            }
+
+            static const char s_flight_seconds_arg[] = "--flight-seconds=";
+            const char *flight_seconds_str = strstr(cmd_line, s_flight_seconds_arg);
+            if (flight_seconds_str)
+            {
+                int flight_seconds = atoi(flight_seconds_str + sizeof(s_flight_seconds_arg) - 1);
+                g_flight_seconds = (flight_seconds > 0) ? (uint32_t)flight_seconds : 0;
+            }
+
+            // Pick the clock before anything takes a timestamp.
+            vogl_clock_init(strstr(cmd_line, "--clock=tsc") ? VOGLPERF_CLOCK_TSC : VOGLPERF_CLOCK_MONOTONIC);
+
+            static const char s_fpslimit_arg[] = "--fpslimit=";
+            const char *fpslimit_str = strstr(cmd_line, s_fpslimit_arg);
+            if (fpslimit_str)
+            {
+                int fpslimit = atoi(fpslimit_str + sizeof(s_fpslimit_arg) - 1);
+                __atomic_store_n(&g_fpslimit, (fpslimit > 0) ? (uint32_t)fpslimit : 0, __ATOMIC_RELAXED);
+            }
+
+            showfps_set(!!strstr(cmd_line, "--showfps"));
+        
+            int debugger_pause = !!strstr(cmd_line, "--debugger-pause");
+            if (debugger_pause && isatty(fileno(stdout)))
+            {
+                int sleeptime = 60000;
+                int debugger_connected = 0;
+
+                syslog(LOG_INFO, "(voglperf) Pausing %d ms or until debugger is attached (pid %d).\n", sleeptime, getpid());
+                syslog(LOG_INFO, "(voglperf)   Or press any key to continue.\n");
+
+                while (sleeptime >= 0)
+                {
+                    vogl_delay(200);
+                    sleeptime -= 200;
+                    debugger_connected = vogl_is_debugger_present();
+                    if (debugger_connected || vogl_kbhit())
+                        break;
+                }
+
+                if (debugger_connected)
+                {
+                    syslog(LOG_INFO, "(voglperf)   Debugger connected...\n");
+                }
+            }
+
+            static const char s_logfile_arg[] = "--logfile=";
+            const char *logfile = strstr(cmd_line, s_logfile_arg);
+            if (logfile)
+            {
+                char logfile_name[PATH_MAX];
+
+                logfile += sizeof(s_logfile_arg) - 1;
+
+                char delim_char = logfile[0];
+
+                if (delim_char == '"' || delim_char == '\'')
+                    logfile++;
+                else
+                    delim_char = ' ';
+
+                const char *logfile_end = logfile;
+                while (*logfile_end && (*logfile_end != delim_char))
+                    logfile_end++;
+
+                snprintf(logfile_name, sizeof(logfile_name), "%.*s", (int)(logfile_end - logfile), logfile);
+                syslog(LOG_INFO, "(voglperf)  Framerate logfile: '%s'\n", logfile_name);
+
+                voglperf_logfile_open(logfile_name, -1);
+            }
+
+            atexit(vogl_perf_destructor_func);
+        }
+
+        syslog(LOG_INFO, "(voglperf) end initialization\n");
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// window system api
+//  Games present through GLX or EGL. Each surface remembers which one it was swapped with so GL entrypoints, the
+//  current context and the drawable size get looked up through the matching API. EGLDisplay and EGLSurface
+//  handles are stored in the same dpy+drawable slots as their GLX counterparts; they're pointers, so they
+//  never collide with X displays and XIDs.
+//----------------------------------------------------------------------------------------------------------------------
+#define EGL_DPY(_dpy) ((Display *)(_dpy))
+#define EGL_DRAWABLE(_surface) ((GLXDrawable)(uintptr_t)(_surface))
+
+//----------------------------------------------------------------------------------------------------------------------
+// egl_get_proc_address
+//  Real eglGetProcAddress. EGL extension entrypoints like eglSwapBuffersWithDamageKHR usually aren't exported by
+//  libEGL, so this is the only way to get at them.
+//----------------------------------------------------------------------------------------------------------------------
+static __eglMustCastToProperFunctionPointerType egl_get_proc_address(const char *name)
+{
+    eglGetProcAddress_func_ptr_t get_proc = (eglGetProcAddress_func_ptr_t)hook_real(HOOK_eglGetProcAddress);
+
+    return get_proc ? get_proc(name) : NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// swap_api_get_proc_address
+//  GL entrypoint for contexts of the given API.
+//----------------------------------------------------------------------------------------------------------------------
+static __GLXextFuncPtr swap_api_get_proc_address(swap_api_t api, const char *name)
+{
+    if (api == SWAP_API_EGL)
+        return (__GLXextFuncPtr)egl_get_proc_address(name);
+
+    glXGetProcAddressARB_func_ptr_t get_proc = (glXGetProcAddressARB_func_ptr_t)hook_real(HOOK_glXGetProcAddressARB);
+
+    return get_proc ? get_proc((const GLubyte *)name) : NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// swap_api_get_current_context
+//  Returns GLXContext or EGLContext current on this thread, or NULL.
+//----------------------------------------------------------------------------------------------------------------------
+static void *swap_api_get_current_context(swap_api_t api)
+{
+    typedef GLXContext (*GLAPIENTRY glXGetCurrentContext_func_ptr_t)(void);
+    typedef EGLContext (*EGLAPIENTRY eglGetCurrentContext_func_ptr_t)(void);
+    static glXGetCurrentContext_func_ptr_t s_pActual_glXGetCurrentContext;
+    static eglGetCurrentContext_func_ptr_t s_pActual_eglGetCurrentContext;
+
+    if (api == SWAP_API_EGL)
+    {
+        if (!s_pActual_eglGetCurrentContext)
+            s_pActual_eglGetCurrentContext = (eglGetCurrentContext_func_ptr_t)dlsym(RTLD_NEXT, "eglGetCurrentContext");
+        return s_pActual_eglGetCurrentContext ? (void *)s_pActual_eglGetCurrentContext() : NULL;
+    }
+
+    if (!s_pActual_glXGetCurrentContext)
+        s_pActual_glXGetCurrentContext = (glXGetCurrentContext_func_ptr_t)dlsym(RTLD_NEXT, "glXGetCurrentContext");
+    return s_pActual_glXGetCurrentContext ? (void *)s_pActual_glXGetCurrentContext() : NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// swap_api_drawable_current
+//  Returns 1 if drawable is what this thread is drawing to.
+//----------------------------------------------------------------------------------------------------------------------
+static int swap_api_drawable_current(swap_api_t api, GLXDrawable drawable)
+{
+    typedef GLXDrawable (*GLAPIENTRY glXGetCurrentDrawable_func_ptr_t)(void);
+    typedef EGLSurface (*EGLAPIENTRY eglGetCurrentSurface_func_ptr_t)(EGLint readdraw);
+    static glXGetCurrentDrawable_func_ptr_t s_pActual_glXGetCurrentDrawable;
+    static eglGetCurrentSurface_func_ptr_t s_pActual_eglGetCurrentSurface;
+
+    if (api == SWAP_API_EGL)
+    {
+        if (!s_pActual_eglGetCurrentSurface)
+            s_pActual_eglGetCurrentSurface = (eglGetCurrentSurface_func_ptr_t)dlsym(RTLD_NEXT, "eglGetCurrentSurface");
+        return s_pActual_eglGetCurrentSurface && (EGL_DRAWABLE(s_pActual_eglGetCurrentSurface(EGL_DRAW)) == drawable);
+    }
+
+    if (!s_pActual_glXGetCurrentDrawable)
+        s_pActual_glXGetCurrentDrawable = (glXGetCurrentDrawable_func_ptr_t)dlsym(RTLD_NEXT, "glXGetCurrentDrawable");
+    return s_pActual_glXGetCurrentDrawable && (s_pActual_glXGetCurrentDrawable() == drawable);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// swap_api_get_drawable_size
+//  Returns 0 if the size couldn't be queried.
+//----------------------------------------------------------------------------------------------------------------------
+static int swap_api_get_drawable_size(swap_api_t api, Display *dpy, GLXDrawable drawable, int *width, int *height)
+{
+    typedef void (*GLAPIENTRY glXQueryDrawable_func_ptr_t)(Display *dpy, GLXDrawable draw, int attribute, unsigned int *value);
+    typedef EGLBoolean (*EGLAPIENTRY eglQuerySurface_func_ptr_t)(EGLDisplay dpy, EGLSurface surface, EGLint attribute, EGLint *value);
+    static glXQueryDrawable_func_ptr_t s_pActual_glXQueryDrawable;
+    static eglQuerySurface_func_ptr_t s_pActual_eglQuerySurface;
+
+    if (api == SWAP_API_EGL)
+    {
+        EGLint egl_width = 0;
+        EGLint egl_height = 0;
+
+        if (!s_pActual_eglQuerySurface)
+            s_pActual_eglQuerySurface = (eglQuerySurface_func_ptr_t)dlsym(RTLD_NEXT, "eglQuerySurface");
+        if (!s_pActual_eglQuerySurface)
+            return 0;
+
+        s_pActual_eglQuerySurface((EGLDisplay)dpy, (EGLSurface)(uintptr_t)drawable, EGL_WIDTH, &egl_width);
+        s_pActual_eglQuerySurface((EGLDisplay)dpy, (EGLSurface)(uintptr_t)drawable, EGL_HEIGHT, &egl_height);
+
+        *width = egl_width;
+        *height = egl_height;
+        return (egl_width > 0) && (egl_height > 0);
+    }
+
+    unsigned int glx_width = 0;
+    unsigned int glx_height = 0;
+
+    if (!s_pActual_glXQueryDrawable)
+        s_pActual_glXQueryDrawable = (glXQueryDrawable_func_ptr_t)dlsym(RTLD_NEXT, "glXQueryDrawable");
+    if (!s_pActual_glXQueryDrawable)
+        return 0;
+
+    s_pActual_glXQueryDrawable(dpy, drawable, GLX_WIDTH, &glx_width);
+    s_pActual_glXQueryDrawable(dpy, drawable, GLX_HEIGHT, &glx_height);
+
+    *width = (int)glx_width;
+    *height = (int)glx_height;
+    return glx_width && glx_height;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glinfo_make_current
+//  Grabs gl strings for dpy+drawable when a new context is made current on it.
+//----------------------------------------------------------------------------------------------------------------------
+static void glinfo_make_current(Display *dpy, GLXDrawable drawable, void *ctx)
+{
+    pthread_mutex_lock(&g_glinfo_lock);
+
+    glinfo_cache_t *glinfo = get_glinfo(dpy, drawable);
+    if (glinfo)
+    {
+        typedef const GLubyte *(*GLAPIENTRY glGetString_func_ptr_t)(GLenum name);
+        static glGetString_func_ptr_t s_pActual_glGetString;
+
+        if (!s_pActual_glGetString)
+            s_pActual_glGetString = (glGetString_func_ptr_t)dlsym(RTLD_NEXT, "glGetString");
+        if (s_pActual_glGetString)
+        {
+            if (glinfo->ctx != ctx)
+            {
+                // Set new ctx and clear strings so they'll be reloaded.
+                glinfo->ctx = ctx;
+                glinfo->glstrings_valid = 0;
+            }
+
+            if (!glinfo->glstrings_valid)
+            {
+                static const GLubyte s_nil[] = { 0 };
+
+                glinfo->glstrings_valid = 1;
+
+                glinfo->renderer = s_pActual_glGetString(GL_RENDERER);
+                glinfo->vendor = s_pActual_glGetString(GL_VENDOR);
+                glinfo->version = s_pActual_glGetString(GL_VERSION);
+
+                if (!glinfo->renderer)
+                    glinfo->renderer = s_nil;
+                if (!glinfo->vendor)
+                    glinfo->vendor = s_nil;
+                if (!glinfo->version)
+                    glinfo->version = s_nil;
+
+                syslog(LOG_INFO, "(voglperf) glinfo: '%s' '%s' '%s'\n", glinfo->vendor, glinfo->renderer, glinfo->version);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&g_glinfo_lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glXMakeCurrent interceptor
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT Bool GLAPIENTRY glXMakeCurrent(Display *dpy, GLXDrawable drawable, GLXContext ctx)
+{
+    HOOK_FUNC(glXMakeCurrent);
+    if (!orig_func)
+        return False;
+
+    voglperf_init();
+
+    if (g_verbose)
+    {
+        syslog(LOG_INFO, "(voglperf) %s %p %lu %p\n", __PRETTY_FUNCTION__, dpy, drawable, ctx);
+    }
+
+    Bool ret = (*orig_func)(dpy, drawable, ctx);
+    if (ret)
+        glinfo_make_current(dpy, drawable, ctx);
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glXMakeContextCurrent / glXMakeCurrentReadSGI interceptors
+//  Separate draw and read drawables. Swaps go to the draw drawable, so that's the one we track.
+//----------------------------------------------------------------------------------------------------------------------
+#define MAKE_CONTEXT_CURRENT_HOOK(_func)                                                                        \
+    VOGL_API_EXPORT Bool GLAPIENTRY _func(Display *dpy, GLXDrawable draw, GLXDrawable read, GLXContext ctx)     \
+    {                                                                                                           \
+        HOOK_FUNC(_func);                                                                                       \
+        if (!orig_func)                                                                                         \
+            return False;                                                                                       \
+                                                                                                                \
+        voglperf_init();                                                                                        \
+                                                                                                                \
+        if (g_verbose)                                                                                          \
+            syslog(LOG_INFO, "(voglperf) %s %p %lu %lu %p\n", __FUNCTION__, dpy, draw, read, ctx);              \
+                                                                                                                \
+        Bool ret = (*orig_func)(dpy, draw, read, ctx);                                                          \
+        if (ret)                                                                                                \
+            glinfo_make_current(dpy, draw, ctx);                                                                \
+        return ret;                                                                                             \
+    }
+
+MAKE_CONTEXT_CURRENT_HOOK(glXMakeContextCurrent)
+MAKE_CONTEXT_CURRENT_HOOK(glXMakeCurrentReadSGI)
+
+#undef MAKE_CONTEXT_CURRENT_HOOK
+
+//----------------------------------------------------------------------------------------------------------------------
+// gpu timer queries (--gputime)
+//  A glQueryCounter(GL_TIMESTAMP) goes in right after each swap and another right before the next one, so the
+//  difference is how long the GPU took to get through the frame. Results are only read back once the GPU says
+//  they're available (normally a couple of frames later) so we never stall the pipeline. If the GPU falls
+//  GPU_QUERY_FRAMES behind we just skip timing frames until it catches up. Query objects aren't shared
+//  between contexts, so each swapping thread keeps a set for each of the last few contexts it swapped from.
+//----------------------------------------------------------------------------------------------------------------------
+#define GPU_QUERY_FRAMES 8
+#define GPU_QUERY_CONTEXTS 4
+
+typedef void (*GLAPIENTRY glGenQueries_func_ptr_t)(GLsizei n, GLuint *ids);
+typedef GLboolean (*GLAPIENTRY glIsQuery_func_ptr_t)(GLuint id);
+typedef void (*GLAPIENTRY glQueryCounter_func_ptr_t)(GLuint id, GLenum target);
+typedef void (*GLAPIENTRY glGetQueryObjectiv_func_ptr_t)(GLuint id, GLenum pname, GLint *params);
+typedef void (*GLAPIENTRY glGetQueryObjectui64v_func_ptr_t)(GLuint id, GLenum pname, GLuint64 *params);
+
+typedef struct gpu_query_set_t
+{
+    void *ctx;                                  // Context queries were created on, NULL if the set's unused.
+    uint64_t last_used;                         // gpu_query_t.swap_count when it was last current.
+    GLuint queries[GPU_QUERY_FRAMES][2];        // Frame begin and end timestamps.
+    uint32_t write_index;                       // Frame being timed.
+    uint32_t read_index;                        // Oldest frame not read back yet.
+    int frame_begun;                            // Begin timestamp issued for write_index.
+} gpu_query_set_t;
+
+typedef struct gpu_query_t
+{
+    int inited;
+    int supported;
+    uint64_t swap_count;
+    gpu_query_set_t sets[GPU_QUERY_CONTEXTS];
+    gpu_query_set_t *set;                       // Current context's, NULL until one has swapped.
+
+    glGenQueries_func_ptr_t GenQueries;
+    glIsQuery_func_ptr_t IsQuery;
+    glQueryCounter_func_ptr_t QueryCounter;
+    glGetQueryObjectiv_func_ptr_t GetQueryObjectiv;
+    glGetQueryObjectui64v_func_ptr_t GetQueryObjectui64v;
+} gpu_query_t;
+
+//----------------------------------------------------------------------------------------------------------------------
+// gpu_query_init
+//  Returns 1 if GL_ARB_timer_query (or GL 3.3+) is available on the current context.
+//----------------------------------------------------------------------------------------------------------------------
+static int gpu_query_init(gpu_query_t *gpu, swap_api_t api)
+{
+    typedef const GLubyte *(*GLAPIENTRY glGetString_func_ptr_t)(GLenum name);
+
+    glGetString_func_ptr_t get_string = (glGetString_func_ptr_t)dlsym(RTLD_NEXT, "glGetString");
+
+    if (!get_string)
+        return 0;
+
+    int major = 0;
+    int minor = 0;
+    const char *version = (const char *)get_string(GL_VERSION);
+    const char *extensions = (const char *)get_string(GL_EXTENSIONS);
+
+    if (version)
+        sscanf(version, "%d.%d", &major, &minor);
+    if ((major * 10 + minor < 33) && !(extensions && strstr(extensions, "GL_ARB_timer_query")))
+        return 0;
+
+    gpu->GenQueries = (glGenQueries_func_ptr_t)swap_api_get_proc_address(api, "glGenQueries");
+    gpu->IsQuery = (glIsQuery_func_ptr_t)swap_api_get_proc_address(api, "glIsQuery");
+    gpu->QueryCounter = (glQueryCounter_func_ptr_t)swap_api_get_proc_address(api, "glQueryCounter");
+    gpu->GetQueryObjectiv = (glGetQueryObjectiv_func_ptr_t)swap_api_get_proc_address(api, "glGetQueryObjectiv");
+    gpu->GetQueryObjectui64v = (glGetQueryObjectui64v_func_ptr_t)swap_api_get_proc_address(api, "glGetQueryObjectui64v");
+
+    return gpu->GenQueries && gpu->IsQuery && gpu->QueryCounter && gpu->GetQueryObjectiv && gpu->GetQueryObjectui64v;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// gpu_query_context
+//  Make sure our queries belong to the current context. Returns 0 if timer queries can't be used.
+//----------------------------------------------------------------------------------------------------------------------
+static int gpu_query_context(gpu_query_t *gpu, swap_api_t api)
+{
+    uint32_t i;
+    void *ctx = swap_api_get_current_context(api);
+    if (!ctx)
+        return 0;
+
+    if (!gpu->inited)
+    {
+        gpu->inited = 1;
+        gpu->supported = gpu_query_init(gpu, api);
+
+        syslog(LOG_INFO, "(voglperf) GPU timer queries %s.\n", gpu->supported ? "enabled" : "not supported");
+    }
+
+    if (!gpu->supported)
+        return 0;
+
+    gpu->swap_count++;
+    if (!gpu->set || (gpu->set->ctx != ctx))
+    {
+        gpu_query_set_t *set = NULL;
+
+        for (i = 0; (i < GPU_QUERY_CONTEXTS) && !set; i++)
+        {
+            if (gpu->sets[i].ctx == ctx)
+                set = &gpu->sets[i];
+        }
+
+        // A new context that got a destroyed one's address doesn't have its queries. The begin timestamp has been
+        //  issued on every set that's swapped, which makes it a query object.
+        if (set && !gpu->IsQuery(set->queries[0][0]))
+            set->ctx = NULL;
+
+        if (!set || !set->ctx)
+        {
+            // Take over the least recently used set. Its queries can't be deleted from here (their context may
+            //  be gone), so with more contexts than sets swapping on one thread some get dropped.
+            if (!set)
+            {
+                set = &gpu->sets[0];
+                for (i = 1; i < GPU_QUERY_CONTEXTS; i++)
+                {
+                    if (gpu->sets[i].last_used < set->last_used)
+                        set = &gpu->sets[i];
+                }
+            }
+
+            memset(set, 0, sizeof(*set));
+            set->ctx = ctx;
+            gpu->GenQueries(GPU_QUERY_FRAMES * 2, &set->queries[0][0]);
+        }
+
+        gpu->set = set;
+    }
+
+    gpu->set->last_used = gpu->swap_count;
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// gpu_query_swap_begin
+//  Called before the real swap. Ends the frame being timed and returns the total GPU time (ns) of the frames whose
+//  results came back since the last swap, with how many there were in *frames. 0 if none did.
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t gpu_query_swap_begin(gpu_query_t *gpu, swap_api_t api, uint32_t *frames)
+{
+    uint64_t gpu_time = 0;
+
+    *frames = 0;
+    if (!gpu_query_context(gpu, api))
+        return 0;
+
+    gpu_query_set_t *set = gpu->set;
+
+    if (set->frame_begun)
+    {
+        gpu->QueryCounter(set->queries[set->write_index % GPU_QUERY_FRAMES][1], GL_TIMESTAMP);
+        set->write_index++;
+        set->frame_begun = 0;
+    }
+
+    // Read back whatever has finished, oldest first.
+    while (set->read_index != set->write_index)
+    {
+        GLint available = 0;
+        GLuint *queries = set->queries[set->read_index % GPU_QUERY_FRAMES];
+
+        gpu->GetQueryObjectiv(queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 time_begin = 0;
+        GLuint64 time_end = 0;
+
+        gpu->GetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &time_begin);
+        gpu->GetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &time_end);
+        // 0 means no result, so bump empty frames up to 1ns.
+        gpu_time += (time_end > time_begin) ? (time_end - time_begin) : 1;
+        (*frames)++;
+
+        set->read_index++;
+    }
+
+    return gpu_time;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// gpu_query_swap_end
+//  Called after the real swap. Starts timing the next frame if there's a free query slot.
+//----------------------------------------------------------------------------------------------------------------------
+static void gpu_query_swap_end(gpu_query_t *gpu)
+{
+    gpu_query_set_t *set = gpu->set;
+
+    if (!gpu->supported || !set)
+        return;
+
+    if (set->write_index - set->read_index < GPU_QUERY_FRAMES)
+    {
+        gpu->QueryCounter(set->queries[set->write_index % GPU_QUERY_FRAMES][0], GL_TIMESTAMP);
+        set->frame_begun = 1;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// gl overlay (--showfps)
+//  Draws fps, percentiles and a scrolling frame time graph into the back buffer right before the real swap, so
+//  it's part of the frame instead of flickering on top of it. Text comes from a small built in 5x7 font baked
+//  into a texture atlas once per context, and the background, text and graph all go out in one glDrawArrays.
+//  Every bit of GL state we touch is saved and put back afterwards. We draw with our own vertex array object so
+//  the app's vertex attribute setup is never disturbed, which means we need GL 3.0 or GL_ARB_vertex_array_object.
+//  Older contexts get the X11 text drawn after the swap instead.
+//----------------------------------------------------------------------------------------------------------------------
+#define OVERLAY_MAX_CONTEXTS 4
+#define OVERLAY_MAX_VERTS 4096
+#define OVERLAY_GRAPH_FRAMES 240        // Frame times in the graph, one pixel wide each.
+#define OVERLAY_GRAPH_HEIGHT 60
+#define OVERLAY_GRAPH_MAX_MS 50.0f      // Frame time at the top of the graph.
+#define OVERLAY_TEXT_SCALE 2
+#define OVERLAY_PADDING 6
+#define OVERLAY_GLYPH_WIDTH 5
+#define OVERLAY_GLYPH_HEIGHT 7
+#define OVERLAY_CELL_WIDTH 6            // Glyph plus spacing, in atlas and on screen (before scaling).
+#define OVERLAY_CELL_HEIGHT 9
+#define OVERLAY_ATLAS_WIDTH (16 * OVERLAY_CELL_WIDTH)   // 128 ASCII chars in 16x8 cells.
+#define OVERLAY_ATLAS_HEIGHT (8 * OVERLAY_CELL_HEIGHT)
+#define OVERLAY_SOLID_CHAR 127          // Atlas cell that's solid white, for untextured quads.
+
+// Rows top to bottom, leftmost pixel in bit 4. Upper case letters are drawn as lower case.
+typedef struct overlay_glyph_t
+{
+    char c;
+    uint8_t rows[OVERLAY_GLYPH_HEIGHT];
+} overlay_glyph_t;
+
+static const overlay_glyph_t s_overlay_font[] =
+{
+    { '0', { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e } },
+    { '1', { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+    { '2', { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f } },
+    { '3', { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e } },
+    { '4', { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 } },
+    { '5', { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e } },
+    { '6', { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e } },
+    { '7', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+    { '8', { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e } },
+    { '9', { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c } },
+    { '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c } },
+    { ':', { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 } },
+    { '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+    { '-', { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 } },
+    { '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+    { '[', { 0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e } },
+    { ']', { 0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e } },
+    { 'a', { 0x00, 0x00, 0x0e, 0x01, 0x0f, 0x11, 0x0f } },
+    { 'b', { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1e } },
+    { 'c', { 0x00, 0x00, 0x0e, 0x10, 0x10, 0x11, 0x0e } },
+    { 'd', { 0x01, 0x01, 0x0d, 0x13, 0x11, 0x11, 0x0f } },
+    { 'e', { 0x00, 0x00, 0x0e, 0x11, 0x1f, 0x10, 0x0e } },
+    { 'f', { 0x06, 0x09, 0x08, 0x1c, 0x08, 0x08, 0x08 } },
+    { 'g', { 0x00, 0x0f, 0x11, 0x11, 0x0f, 0x01, 0x0e } },
+    { 'h', { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11 } },
+    { 'i', { 0x04, 0x00, 0x0c, 0x04, 0x04, 0x04, 0x0e } },
+    { 'j', { 0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0c } },
+    { 'k', { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 } },
+    { 'l', { 0x0c, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+    { 'm', { 0x00, 0x00, 0x1a, 0x15, 0x15, 0x11, 0x11 } },
+    { 'n', { 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11 } },
+    { 'o', { 0x00, 0x00, 0x0e, 0x11, 0x11, 0x11, 0x0e } },
+    { 'p', { 0x00, 0x00, 0x1e, 0x11, 0x1e, 0x10, 0x10 } },
+    { 'q', { 0x00, 0x00, 0x0d, 0x13, 0x0f, 0x01, 0x01 } },
+    { 'r', { 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10 } },
+    { 's', { 0x00, 0x00, 0x0e, 0x10, 0x0e, 0x01, 0x1e } },
+    { 't', { 0x08, 0x08, 0x1c, 0x08, 0x08, 0x09, 0x06 } },
+    { 'u', { 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0d } },
+    { 'v', { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0a, 0x04 } },
+    { 'w', { 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0a } },
+    { 'x', { 0x00, 0x00, 0x11, 0x0a, 0x04, 0x0a, 0x11 } },
+    { 'y', { 0x00, 0x00, 0x11, 0x11, 0x0f, 0x01, 0x0e } },
+    { 'z', { 0x00, 0x00, 0x1f, 0x02, 0x04, 0x08, 0x1f } },
+};
+
+typedef struct overlay_vertex_t
+{
+    float x, y;                 // Pixels from top left of drawable.
+    float u, v;                 // Atlas texture coordinates.
+    uint8_t color[4];           // RGBA
+} overlay_vertex_t;
+
+// GL entrypoints the overlay needs, loaded with glXGetProcAddressARB or eglGetProcAddress.
+#define OVERLAY_GL_FUNCS(X)                                                                                         \
+    X(const GLubyte *, GetString, (GLenum name))                                                                    \
+    X(void, GetIntegerv, (GLenum pname, GLint *data))                                                               \
+    X(void, GetBooleanv, (GLenum pname, GLboolean *data))                                                           \
+    X(GLboolean, IsEnabled, (GLenum cap))                                                                           \
+    X(void, Enable, (GLenum cap))                                                                                   \
+    X(void, Disable, (GLenum cap))                                                                                  \
+    X(void, Viewport, (GLint x, GLint y, GLsizei width, GLsizei height))                                           \
+    X(void, ColorMask, (GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha))                           \
+    X(void, BlendFuncSeparate, (GLenum src_rgb, GLenum dst_rgb, GLenum src_alpha, GLenum dst_alpha))                \
+    X(void, BlendEquationSeparate, (GLenum mode_rgb, GLenum mode_alpha))                                            \
+    X(void, PixelStorei, (GLenum pname, GLint param))                                                               \
+    X(void, ActiveTexture, (GLenum texture))                                                                        \
+    X(void, GenTextures, (GLsizei n, GLuint *textures))                                                             \
+    X(void, BindTexture, (GLenum target, GLuint texture))                                                           \
+    X(void, TexParameteri, (GLenum target, GLenum pname, GLint param))                                              \
+    X(void, TexImage2D, (GLenum target, GLint level, GLint internal_format, GLsizei width, GLsizei height,          \
+                         GLint border, GLenum format, GLenum type, const void *pixels))                             \
+    X(void, GenBuffers, (GLsizei n, GLuint *buffers))                                                               \
+    X(void, BindBuffer, (GLenum target, GLuint buffer))                                                             \
+    X(void, BufferData, (GLenum target, GLsizeiptr size, const void *data, GLenum usage))                           \
+    X(void, GenVertexArrays, (GLsizei n, GLuint *arrays))                                                           \
+    X(void, BindVertexArray, (GLuint array))                                                                        \
+    X(void, EnableVertexAttribArray, (GLuint index))                                                                \
+    X(void, VertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,      \
+                                  const void *pointer))                                                             \
+    X(GLuint, CreateShader, (GLenum type))                                                                          \
+    X(void, ShaderSource, (GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length))         \
+    X(void, CompileShader, (GLuint shader))                                                                         \
+    X(void, GetShaderiv, (GLuint shader, GLenum pname, GLint *params))                                              \
+    X(void, DeleteShader, (GLuint shader))                                                                          \
+    X(GLuint, CreateProgram, (void))                                                                                \
+    X(void, AttachShader, (GLuint program, GLuint shader))                                                          \
+    X(void, BindAttribLocation, (GLuint program, GLuint index, const GLchar *name))                                 \
+    X(void, LinkProgram, (GLuint program))                                                                          \
+    X(void, GetProgramiv, (GLuint program, GLenum pname, GLint *params))                                            \
+    X(void, UseProgram, (GLuint program))                                                                           \
+    X(GLint, GetUniformLocation, (GLuint program, const GLchar *name))                                              \
+    X(void, Uniform2f, (GLint location, GLfloat v0, GLfloat v1))                                                    \
+    X(void, DrawArrays, (GLenum mode, GLint first, GLsizei count))
+
+// Only used if the context has them. OpenGL ES has no glPolygonMode.
+#define OVERLAY_GL_OPTIONAL_FUNCS(X)                                                                                \
+    X(void, PolygonMode, (GLenum face, GLenum mode))                                                                \
+    X(void, BindFramebuffer, (GLenum target, GLuint framebuffer))                                                   \
+    X(void, BindSampler, (GLuint unit, GLuint sampler))
+
+#define OVERLAY_GL_FUNC_TYPEDEF(_ret, _name, _params) typedef _ret (*GLAPIENTRY overlay_gl##_name##_func_ptr_t) _params;
+OVERLAY_GL_FUNCS(OVERLAY_GL_FUNC_TYPEDEF)
+OVERLAY_GL_OPTIONAL_FUNCS(OVERLAY_GL_FUNC_TYPEDEF)
+#undef OVERLAY_GL_FUNC_TYPEDEF
+
+// GL objects and capabilities for one context. Objects can't be used from other (unshared) contexts.
+typedef struct overlay_context_t
+{
+    void *ctx;
+    int inited;
+    int supported;
+    int version;                // major * 10 + minor.
+    int es;                     // OpenGL ES context.
+    int core;                   // Desktop GL core profile.
+    int compat;                 // Compatibility profile, so fixed function state like alpha test still applies.
+    int has_fbo;                // GL_DRAW_FRAMEBUFFER binding.
+    int has_sampler;            // Sampler objects.
+    int has_discard;            // GL_RASTERIZER_DISCARD.
+    GLuint program;
+    GLuint vao;
+    GLuint vbo;
+    GLuint texture;
+    GLint scale_location;
+} overlay_context_t;
+
+typedef struct overlay_t
+{
+    int funcs_loaded;           // 1 if all required entrypoints loaded, -1 if not.
+    swap_api_t funcs_api;       // API entrypoints were loaded through.
+    overlay_context_t contexts[OVERLAY_MAX_CONTEXTS];
+    uint32_t context_next;      // Next slot to reuse when a thread switches between lots of contexts.
+    overlay_vertex_t *verts;
+    uint32_t vert_count;
+
+#define OVERLAY_GL_FUNC_MEMBER(_ret, _name, _params) overlay_gl##_name##_func_ptr_t _name;
+    OVERLAY_GL_FUNCS(OVERLAY_GL_FUNC_MEMBER)
+    OVERLAY_GL_OPTIONAL_FUNCS(OVERLAY_GL_FUNC_MEMBER)
+#undef OVERLAY_GL_FUNC_MEMBER
+} overlay_t;
+
+// State we change when drawing, saved from the app and put back after.
+typedef struct overlay_state_t
+{
+    GLint program;
+    GLint vao;
+    GLint array_buffer;
+    GLint active_texture;
+    GLint texture;
+    GLint sampler;
+    GLint draw_framebuffer;
+    GLint viewport[4];
+    GLint blend_func[4];        // src rgb, dst rgb, src alpha, dst alpha
+    GLint blend_equation[2];    // rgb, alpha
+    GLint polygon_mode[2];
+    GLboolean color_mask[4];
+    GLboolean caps[9];
+} overlay_state_t;
+
+// Blend is turned on, everything else that could get in the way is turned off.
+static const GLenum s_overlay_caps[] =
+{
+    GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST, GL_SCISSOR_TEST, GL_CULL_FACE, GL_COLOR_LOGIC_OP,
+    GL_SAMPLE_ALPHA_TO_COVERAGE, GL_RASTERIZER_DISCARD, GL_ALPHA_TEST
+};
+
+// Vertex shader is preceded by a "#version" line and, for GLSL 1.10, defines mapping in/out to attribute/varying.
+static const char s_overlay_vs[] =
+    "in vec2 pos;\n"
+    "in vec2 uv;\n"
+    "in vec4 color;\n"
+    "out vec2 frag_uv;\n"
+    "out vec4 frag_color;\n"
+    "uniform vec2 scale;\n"
+    "void main()\n"
+    "{\n"
+    "    frag_uv = uv;\n"
+    "    frag_color = color;\n"
+    "    gl_Position = vec4(pos.x * scale.x - 1.0, 1.0 - pos.y * scale.y, 0.0, 1.0);\n"
+    "}\n";
+
+static const char s_overlay_fs[] =
+    "in vec2 frag_uv;\n"
+    "in vec4 frag_color;\n"
+    "uniform sampler2D atlas;\n"
+    "void main()\n"
+    "{\n"
+    "    FRAG_OUT = frag_color * TEXTURE(atlas, frag_uv);\n"
+    "}\n";
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_load_funcs
+//----------------------------------------------------------------------------------------------------------------------
+static int overlay_load_funcs(overlay_t *overlay, swap_api_t api)
+{
+    int ret = 1;
+
+#define OVERLAY_GL_FUNC_LOAD(_ret, _name, _params) \
+    overlay->_name = (overlay_gl##_name##_func_ptr_t)swap_api_get_proc_address(api, "gl" #_name);
+    OVERLAY_GL_FUNCS(OVERLAY_GL_FUNC_LOAD)
+    OVERLAY_GL_OPTIONAL_FUNCS(OVERLAY_GL_FUNC_LOAD)
+#undef OVERLAY_GL_FUNC_LOAD
+
+#define OVERLAY_GL_FUNC_CHECK(_ret, _name, _params)                                     \
+    if (!overlay->_name)                                                                \
+    {                                                                                   \
+        syslog(LOG_WARNING, "(voglperf) WARNING: Overlay couldn't load gl%s.\n", #_name); \
+        ret = 0;                                                                        \
+    }
+    OVERLAY_GL_FUNCS(OVERLAY_GL_FUNC_CHECK)
+#undef OVERLAY_GL_FUNC_CHECK
+
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_compile_shader
+//----------------------------------------------------------------------------------------------------------------------
+static GLuint overlay_compile_shader(overlay_t *overlay, GLenum type, const char *header, const char *source)
+{
+    GLint status = 0;
+    const GLchar *strings[2] = { header, source };
+    GLuint shader = overlay->CreateShader(type);
+
+    overlay->ShaderSource(shader, 2, strings, NULL);
+    overlay->CompileShader(shader);
+    overlay->GetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status)
+    {
+        syslog(LOG_ERR, "(voglperf) Overlay %s shader failed to compile.\n", (type == GL_VERTEX_SHADER) ? "vertex" : "fragment");
+        overlay->DeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_build_atlas
+//  Returns malloc'd RGBA atlas with char c in cell (c % 16, c / 16).
+//----------------------------------------------------------------------------------------------------------------------
+static uint8_t *overlay_build_atlas()
+{
+#define OVERLAY_ATLAS_CELL(_c) (pixels + ((_c) / 16) * OVERLAY_CELL_HEIGHT * OVERLAY_ATLAS_WIDTH + ((_c) % 16) * OVERLAY_CELL_WIDTH)
+
+    size_t i;
+    int x, y;
+    uint32_t *pixels = (uint32_t *)calloc(OVERLAY_ATLAS_WIDTH * OVERLAY_ATLAS_HEIGHT, sizeof(uint32_t));
+
+    if (!pixels)
+        return NULL;
+
+    for (i = 0; i < sizeof(s_overlay_font) / sizeof(s_overlay_font[0]); i++)
+    {
+        uint32_t *cell = OVERLAY_ATLAS_CELL((unsigned char)s_overlay_font[i].c);
+
+        for (y = 0; y < OVERLAY_GLYPH_HEIGHT; y++)
+        {
+            for (x = 0; x < OVERLAY_GLYPH_WIDTH; x++)
+            {
+                if (s_overlay_font[i].rows[y] & (0x10 >> x))
+                    cell[y * OVERLAY_ATLAS_WIDTH + x] = 0xffffffff;
+            }
+        }
+    }
+
+    uint32_t *solid = OVERLAY_ATLAS_CELL(OVERLAY_SOLID_CHAR);
+    for (y = 0; y < OVERLAY_CELL_HEIGHT; y++)
+    {
+        for (x = 0; x < OVERLAY_CELL_WIDTH; x++)
+            solid[y * OVERLAY_ATLAS_WIDTH + x] = 0xffffffff;
+    }
+
+    return (uint8_t *)pixels;
+
+#undef OVERLAY_ATLAS_CELL
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_context_caps
+//  Checks what the current context supports. Only queries, so it's called before app state is saved and the caps
+//  we save and restore match the context.
+//----------------------------------------------------------------------------------------------------------------------
+static int overlay_context_caps(overlay_t *overlay, overlay_context_t *oc)
+{
+    int major = 0;
+    int minor = 0;
+    const char *version = (const char *)overlay->GetString(GL_VERSION);
+
+    // GLES version strings look like "OpenGL ES 3.2 Mesa 23.0". ES 1.x is "OpenGL ES-CM 1.1", which doesn't match.
+    if (version && !strncmp(version, "OpenGL ES ", 10))
+    {
+        oc->es = 1;
+        sscanf(version + 10, "%d.%d", &major, &minor);
+    }
+    else if (version)
+    {
+        sscanf(version, "%d.%d", &major, &minor);
+    }
+
+    oc->version = major * 10 + minor;
+
+    if (oc->es)
+    {
+        // ES 2.0 only has vertex array objects as an OES extension with suffixed entrypoints, so we need 3.0.
+        if (oc->version < 30)
+        {
+            syslog(LOG_INFO, "(voglperf) GL overlay needs OpenGL ES 3.0 (have '%s').\n", version);
+            return 0;
+        }
+
+        oc->has_discard = 1;
+        oc->has_fbo = (overlay->BindFramebuffer != NULL);
+        oc->has_sampler = (overlay->BindSampler != NULL);
+        return 1;
+    }
+
+    // GL_EXTENSIONS can't be queried with glGetString in core profiles, and 3.0+ has what we need anyway.
+    const char *extensions = (oc->version < 30) ? (const char *)overlay->GetString(GL_EXTENSIONS) : NULL;
+
+    if ((oc->version < 20) || ((oc->version < 30) && !(extensions && strstr(extensions, "GL_ARB_vertex_array_object"))))
+    {
+        syslog(LOG_INFO, "(voglperf) GL overlay needs GL 3.0 or GL_ARB_vertex_array_object (have '%s').\n", version ? version : "");
+        return 0;
+    }
+    if (!overlay->PolygonMode)
+    {
+        syslog(LOG_WARNING, "(voglperf) WARNING: Overlay couldn't load glPolygonMode.\n");
+        return 0;
+    }
+
+    if (oc->version >= 32)
+    {
+        GLint profile = 0;
+
+        overlay->GetIntegerv(GL_CONTEXT_PROFILE_MASK, &profile);
+        oc->core = !(profile & GL_CONTEXT_COMPATIBILITY_PROFILE_BIT);
+    }
+
+    oc->compat = (oc->version < 31) || ((oc->version >= 32) && !oc->core);
+    oc->has_discard = (oc->version >= 30);
+    oc->has_fbo = overlay->BindFramebuffer && ((oc->version >= 30) || (extensions && strstr(extensions, "GL_ARB_framebuffer_object")));
+    oc->has_sampler = overlay->BindSampler && ((oc->version >= 33) || (extensions && strstr(extensions, "GL_ARB_sampler_objects")));
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_context_init
+//  Creates our GL objects. Called with app state saved.
+//----------------------------------------------------------------------------------------------------------------------
+static int overlay_context_init(overlay_t *overlay, overlay_context_t *oc)
+{
+    // GLSL ES 3.00 for GLES, 1.50 for core profiles, 1.30 for GL 3.0/3.1, and 1.10 with the 1.30 keywords mapped
+    // back for GL 2.x.
+    const char *vs_header;
+    const char *fs_header;
+    if (oc->es)
+    {
+        vs_header = "#version 300 es\n";
+        fs_header = "#version 300 es\nprecision mediump float;\nout vec4 FRAG_OUT;\n#define TEXTURE texture\n";
+    }
+    else if (oc->core)
+    {
+        vs_header = "#version 150\n";
+        fs_header = "#version 150\nout vec4 FRAG_OUT;\n#define TEXTURE texture\n";
+    }
+    else if (oc->version >= 30)
+    {
+        vs_header = "#version 130\n";
+        fs_header = "#version 130\nout vec4 FRAG_OUT;\n#define TEXTURE texture\n";
+    }
+    else
+    {
+        vs_header = "#version 110\n#define in attribute\n#define out varying\n";
+        fs_header = "#version 110\n#define in varying\n#define FRAG_OUT gl_FragColor\n#define TEXTURE texture2D\n";
+    }
+
+    GLuint vs = overlay_compile_shader(overlay, GL_VERTEX_SHADER, vs_header, s_overlay_vs);
+    GLuint fs = overlay_compile_shader(overlay, GL_FRAGMENT_SHADER, fs_header, s_overlay_fs);
+    if (!vs || !fs)
+        return 0;
+
+    GLint status = 0;
+
+    oc->program = overlay->CreateProgram();
+    overlay->AttachShader(oc->program, vs);
+    overlay->AttachShader(oc->program, fs);
+    overlay->BindAttribLocation(oc->program, 0, "pos");
+    overlay->BindAttribLocation(oc->program, 1, "uv");
+    overlay->BindAttribLocation(oc->program, 2, "color");
+    overlay->LinkProgram(oc->program);
+    overlay->DeleteShader(vs);
+    overlay->DeleteShader(fs);
+
+    overlay->GetProgramiv(oc->program, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        syslog(LOG_ERR, "(voglperf) Overlay shader program failed to link.\n");
+        return 0;
+    }
+
+    oc->scale_location = overlay->GetUniformLocation(oc->program, "scale");
+
+    // Atlas goes on texture unit 0, which the sampler uniform defaults to.
+    uint8_t *atlas = overlay_build_atlas();
+    if (!atlas)
+        return 0;
+
+    GLint unpack[4];
+    GLint unpack_buffer = 0;
+    static const GLenum s_unpack_names[4] = { GL_UNPACK_ALIGNMENT, GL_UNPACK_ROW_LENGTH, GL_UNPACK_SKIP_ROWS, GL_UNPACK_SKIP_PIXELS };
+    int i;
+
+    for (i = 0; i < 4; i++)
+        overlay->GetIntegerv(s_unpack_names[i], &unpack[i]);
+    if (oc->version >= 21)
+    {
+        overlay->GetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpack_buffer);
+        overlay->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    overlay->PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (i = 1; i < 4; i++)
+        overlay->PixelStorei(s_unpack_names[i], 0);
+
+    overlay->GenTextures(1, &oc->texture);
+    overlay->BindTexture(GL_TEXTURE_2D, oc->texture);
+    overlay->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    overlay->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    overlay->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    overlay->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    overlay->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    overlay->TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, OVERLAY_ATLAS_WIDTH, OVERLAY_ATLAS_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, atlas);
+    free(atlas);
+
+    for (i = 0; i < 4; i++)
+        overlay->PixelStorei(s_unpack_names[i], unpack[i]);
+    if (oc->version >= 21)
+        overlay->BindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack_buffer);
+
+    overlay->GenBuffers(1, &oc->vbo);
+    overlay->GenVertexArrays(1, &oc->vao);
+    overlay->BindVertexArray(oc->vao);
+    overlay->BindBuffer(GL_ARRAY_BUFFER, oc->vbo);
+    overlay->EnableVertexAttribArray(0);
+    overlay->EnableVertexAttribArray(1);
+    overlay->EnableVertexAttribArray(2);
+    overlay->VertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(overlay_vertex_t), (const void *)offsetof(overlay_vertex_t, x));
+    overlay->VertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(overlay_vertex_t), (const void *)offsetof(overlay_vertex_t, u));
+    overlay->VertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(overlay_vertex_t), (const void *)offsetof(overlay_vertex_t, color));
+
+    syslog(LOG_INFO, "(voglperf) GL overlay enabled (%s %d.%d%s).\n", oc->es ? "GLES" : "GL", oc->version / 10, oc->version % 10,
+           oc->es ? "" : (oc->core ? " core" : " compat"));
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_get_context
+//  Returns overlay state for the current context, or NULL if we can't draw on it.
+//----------------------------------------------------------------------------------------------------------------------
+static overlay_context_t *overlay_get_context(overlay_t *overlay, swap_api_t api)
+{
+    uint32_t i;
+
+    void *ctx = swap_api_get_current_context(api);
+    if (!ctx)
+        return NULL;
+
+    // Reload entrypoints if this thread switched between GLX and EGL.
+    if (overlay->funcs_loaded && (overlay->funcs_api != api))
+        overlay->funcs_loaded = 0;
+
+    if (!overlay->funcs_loaded)
+    {
+        if (!overlay->verts)
+            overlay->verts = (overlay_vertex_t *)malloc(OVERLAY_MAX_VERTS * sizeof(overlay_vertex_t));
+        overlay->funcs_api = api;
+        overlay->funcs_loaded = (overlay->verts && overlay_load_funcs(overlay, api)) ? 1 : -1;
+    }
+    if (overlay->funcs_loaded != 1)
+        return NULL;
+
+    for (i = 0; i < OVERLAY_MAX_CONTEXTS; i++)
+    {
+        if (overlay->contexts[i].ctx == ctx)
+            return overlay->contexts[i].supported ? &overlay->contexts[i] : NULL;
+    }
+
+    // New context. Objects from whatever context we're replacing can't be deleted from here, so just drop them.
+    overlay_context_t *oc = &overlay->contexts[overlay->context_next++ % OVERLAY_MAX_CONTEXTS];
+
+    memset(oc, 0, sizeof(*oc));
+    oc->ctx = ctx;
+    oc->supported = 1;
+    return oc;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_cap_valid
+//----------------------------------------------------------------------------------------------------------------------
+static int overlay_cap_valid(const overlay_context_t *oc, GLenum cap)
+{
+    if (cap == GL_RASTERIZER_DISCARD)
+        return oc->has_discard;
+    if (cap == GL_ALPHA_TEST)
+        return oc->compat;
+    if (cap == GL_COLOR_LOGIC_OP)
+        return !oc->es;
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_save_state
+//----------------------------------------------------------------------------------------------------------------------
+static void overlay_save_state(overlay_t *overlay, const overlay_context_t *oc, overlay_state_t *state)
+{
+    uint32_t i;
+
+    memset(state, 0, sizeof(*state));
+
+    overlay->GetIntegerv(GL_CURRENT_PROGRAM, &state->program);
+    overlay->GetIntegerv(GL_VERTEX_ARRAY_BINDING, &state->vao);
+    overlay->GetIntegerv(GL_ARRAY_BUFFER_BINDING, &state->array_buffer);
+    overlay->GetIntegerv(GL_ACTIVE_TEXTURE, &state->active_texture);
+
+    // We only use unit 0, so switch to it to read its bindings.
+    overlay->ActiveTexture(GL_TEXTURE0);
+    overlay->GetIntegerv(GL_TEXTURE_BINDING_2D, &state->texture);
+    if (oc->has_sampler)
+        overlay->GetIntegerv(GL_SAMPLER_BINDING, &state->sampler);
+    if (oc->has_fbo)
+        overlay->GetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &state->draw_framebuffer);
+    overlay->GetIntegerv(GL_VIEWPORT, state->viewport);
+    overlay->GetIntegerv(GL_BLEND_SRC_RGB, &state->blend_func[0]);
+    overlay->GetIntegerv(GL_BLEND_DST_RGB, &state->blend_func[1]);
+    overlay->GetIntegerv(GL_BLEND_SRC_ALPHA, &state->blend_func[2]);
+    overlay->GetIntegerv(GL_BLEND_DST_ALPHA, &state->blend_func[3]);
+    overlay->GetIntegerv(GL_BLEND_EQUATION_RGB, &state->blend_equation[0]);
+    overlay->GetIntegerv(GL_BLEND_EQUATION_ALPHA, &state->blend_equation[1]);
+    if (!oc->es)
+        overlay->GetIntegerv(GL_POLYGON_MODE, state->polygon_mode);
+    overlay->GetBooleanv(GL_COLOR_WRITEMASK, state->color_mask);
+
+    for (i = 0; i < sizeof(s_overlay_caps) / sizeof(s_overlay_caps[0]); i++)
+    {
+        if (overlay_cap_valid(oc, s_overlay_caps[i]))
+            state->caps[i] = overlay->IsEnabled(s_overlay_caps[i]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_restore_state
+//----------------------------------------------------------------------------------------------------------------------
+static void overlay_restore_state(overlay_t *overlay, const overlay_context_t *oc, const overlay_state_t *state)
+{
+    uint32_t i;
+
+    for (i = 0; i < sizeof(s_overlay_caps) / sizeof(s_overlay_caps[0]); i++)
+    {
+        if (overlay_cap_valid(oc, s_overlay_caps[i]))
+        {
+            if (state->caps[i])
+                overlay->Enable(s_overlay_caps[i]);
+            else
+                overlay->Disable(s_overlay_caps[i]);
+        }
+    }
+
+    // Core profiles only allow GL_FRONT_AND_BACK, and then both modes are always the same. GLES has no polygon modes.
+    if (!oc->es && (state->polygon_mode[0] == state->polygon_mode[1]))
+    {
+        overlay->PolygonMode(GL_FRONT_AND_BACK, state->polygon_mode[0]);
+    }
+    else if (!oc->es)
+    {
+        overlay->PolygonMode(GL_FRONT, state->polygon_mode[0]);
+        overlay->PolygonMode(GL_BACK, state->polygon_mode[1]);
+    }
+
+    overlay->ColorMask(state->color_mask[0], state->color_mask[1], state->color_mask[2], state->color_mask[3]);
+    overlay->BlendEquationSeparate(state->blend_equation[0], state->blend_equation[1]);
+    overlay->BlendFuncSeparate(state->blend_func[0], state->blend_func[1], state->blend_func[2], state->blend_func[3]);
+    overlay->Viewport(state->viewport[0], state->viewport[1], state->viewport[2], state->viewport[3]);
+    if (oc->has_fbo)
+        overlay->BindFramebuffer(GL_DRAW_FRAMEBUFFER, state->draw_framebuffer);
+    if (oc->has_sampler)
+        overlay->BindSampler(0, state->sampler);
+    overlay->BindTexture(GL_TEXTURE_2D, state->texture);
+    overlay->ActiveTexture(state->active_texture);
+    overlay->BindVertexArray(state->vao);
+    overlay->BindBuffer(GL_ARRAY_BUFFER, state->array_buffer);
+    overlay->UseProgram(state->program);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_add_quad
+//----------------------------------------------------------------------------------------------------------------------
+static void overlay_add_quad(overlay_t *overlay, float x0, float y0, float x1, float y1, int c, uint32_t rgba)
+{
+    static const float s_du = 1.0f / OVERLAY_ATLAS_WIDTH;
+    static const float s_dv = 1.0f / OVERLAY_ATLAS_HEIGHT;
+    uint32_t i;
+
+    if (overlay->vert_count + 6 > OVERLAY_MAX_VERTS)
+        return;
+
+    // Solid quads sample the middle of the white cell, glyphs map the 5x7 glyph onto the quad.
+    float u0 = (c % 16) * OVERLAY_CELL_WIDTH * s_du;
+    float v0 = (c / 16) * OVERLAY_CELL_HEIGHT * s_dv;
+    float u1 = u0;
+    float v1 = v0;
+    if (c == OVERLAY_SOLID_CHAR)
+    {
+        u0 = u1 = u0 + (OVERLAY_CELL_WIDTH / 2) * s_du;
+        v0 = v1 = v0 + (OVERLAY_CELL_HEIGHT / 2) * s_dv;
+    }
+    else
+    {
+        u1 += OVERLAY_GLYPH_WIDTH * s_du;
+        v1 += OVERLAY_GLYPH_HEIGHT * s_dv;
+    }
+
+    const float corners[6][4] =
+    {
+        { x0, y0, u0, v0 }, { x1, y0, u1, v0 }, { x1, y1, u1, v1 },
+        { x0, y0, u0, v0 }, { x1, y1, u1, v1 }, { x0, y1, u0, v1 },
+    };
+
+    for (i = 0; i < 6; i++)
+    {
+        overlay_vertex_t *vert = &overlay->verts[overlay->vert_count++];
+
+        vert->x = corners[i][0];
+        vert->y = corners[i][1];
+        vert->u = corners[i][2];
+        vert->v = corners[i][3];
+        vert->color[0] = (uint8_t)(rgba >> 24);
+        vert->color[1] = (uint8_t)(rgba >> 16);
+        vert->color[2] = (uint8_t)(rgba >> 8);
+        vert->color[3] = (uint8_t)rgba;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_add_text
+//----------------------------------------------------------------------------------------------------------------------
+static void overlay_add_text(overlay_t *overlay, float x, float y, const char *text, uint32_t rgba)
+{
+    float x_start = x;
 
-    g_showfps = showfps;
+    for (; *text; text++)
+    {
+        int c = tolower((unsigned char)*text);
 
-    if (g_showfps)
+        if (c == '\n')
+        {
+            x = x_start;
+            y += OVERLAY_CELL_HEIGHT * OVERLAY_TEXT_SCALE;
+            continue;
+        }
+
+        if ((c > ' ') && (c < OVERLAY_SOLID_CHAR))
+        {
+            overlay_add_quad(overlay, x, y, x + OVERLAY_GLYPH_WIDTH * OVERLAY_TEXT_SCALE,
+                             y + OVERLAY_GLYPH_HEIGHT * OVERLAY_TEXT_SCALE, c, rgba);
+        }
+        x += OVERLAY_CELL_WIDTH * OVERLAY_TEXT_SCALE;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// overlay_draw
+//  Draws text and graph (frame times in ms, oldest at graph_index) onto the current context's back buffer.
+//  Returns 0 if the context can't do the GL overlay.
+//----------------------------------------------------------------------------------------------------------------------
+static int overlay_draw(overlay_t *overlay, swap_api_t api, int width, int height, const char *text,
+                        const float *graph, uint32_t graph_index)
+{
+    uint32_t i;
+    overlay_state_t state;
+    overlay_context_t *oc = overlay_get_context(overlay, api);
+
+    if (!oc)
+        return 0;
+
+    // Size the background to the text.
+    uint32_t columns = 0;
+    uint32_t column = 0;
+    uint32_t lines = text[0] ? 1 : 0;
+    for (i = 0; text[i]; i++)
     {
-        static void *s_handle_x11 = NULL;
+        if (text[i] == '\n')
+        {
+            column = 0;
+            if (text[i + 1])
+                lines++;
+        }
+        else if (++column > columns)
+        {
+            columns = column;
+        }
+    }
 
-        if (!s_handle_x11)
+    const float text_height = lines * OVERLAY_CELL_HEIGHT * OVERLAY_TEXT_SCALE;
+    const float graph_y = OVERLAY_PADDING * 2 + text_height;
+    float bg_width = columns * OVERLAY_CELL_WIDTH * OVERLAY_TEXT_SCALE;
+    if (bg_width < OVERLAY_GRAPH_FRAMES)
+        bg_width = OVERLAY_GRAPH_FRAMES;
+
+    overlay->vert_count = 0;
+    overlay_add_quad(overlay, 0, 0, bg_width + OVERLAY_PADDING * 2, graph_y + OVERLAY_GRAPH_HEIGHT + OVERLAY_PADDING,
+                     OVERLAY_SOLID_CHAR, 0x000000a0);
+    overlay_add_text(overlay, OVERLAY_PADDING, OVERLAY_PADDING, text, 0xffffffff);
+
+    // Frame time graph, newest on the right. Lines at 60 and 30 fps.
+    const float graph_bottom = graph_y + OVERLAY_GRAPH_HEIGHT;
+    const float graph_scale = OVERLAY_GRAPH_HEIGHT / OVERLAY_GRAPH_MAX_MS;
+
+    for (i = 0; i < OVERLAY_GRAPH_FRAMES; i++)
+    {
+        float ms = graph[(graph_index + i) % OVERLAY_GRAPH_FRAMES];
+        float bar = (ms < OVERLAY_GRAPH_MAX_MS) ? (ms * graph_scale) : OVERLAY_GRAPH_HEIGHT;
+        uint32_t rgba = (ms <= 1000.0f / 59) ? 0x40ff40ff : (ms <= 1000.0f / 29) ? 0xffff40ff : 0xff4040ff;
+
+        if (ms > 0.0f)
+            overlay_add_quad(overlay, OVERLAY_PADDING + i, graph_bottom - bar, OVERLAY_PADDING + i + 1, graph_bottom, OVERLAY_SOLID_CHAR, rgba);
+    }
+
+    overlay_add_quad(overlay, OVERLAY_PADDING, graph_bottom - 1000.0f / 60 * graph_scale, OVERLAY_PADDING + OVERLAY_GRAPH_FRAMES,
+                     graph_bottom - 1000.0f / 60 * graph_scale + 1, OVERLAY_SOLID_CHAR, 0xffffff60);
+    overlay_add_quad(overlay, OVERLAY_PADDING, graph_bottom - 1000.0f / 30 * graph_scale, OVERLAY_PADDING + OVERLAY_GRAPH_FRAMES,
+                     graph_bottom - 1000.0f / 30 * graph_scale + 1, OVERLAY_SOLID_CHAR, 0xffffff60);
+
+    int first = !oc->inited;
+    if (first)
+    {
+        oc->inited = 1;
+        oc->supported = overlay_context_caps(overlay, oc);
+        if (!oc->supported)
+            return 0;
+    }
+
+    overlay_save_state(overlay, oc, &state);
+
+    if (first)
+    {
+        oc->supported = overlay_context_init(overlay, oc);
+        if (!oc->supported)
         {
-            s_handle_x11 = vogl_load_object("libX11.so.6");
-            if (s_handle_x11)
-            {
-                LOADX11FUNC(s_handle_x11, XLoadQueryFont);
-                LOADX11FUNC(s_handle_x11, XCreateGC);
-                LOADX11FUNC(s_handle_x11, XDrawString);
-            }
+            overlay_restore_state(overlay, oc, &state);
+            return 0;
         }
+    }
+
+    for (i = 0; i < sizeof(s_overlay_caps) / sizeof(s_overlay_caps[0]); i++)
+    {
+        if (s_overlay_caps[i] == GL_BLEND)
+            overlay->Enable(GL_BLEND);
+        else if (overlay_cap_valid(oc, s_overlay_caps[i]))
+            overlay->Disable(s_overlay_caps[i]);
+    }
+
+    if (oc->has_fbo)
+        overlay->BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    overlay->Viewport(0, 0, width, height);
+    overlay->BlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+    overlay->BlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    overlay->ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    if (!oc->es)
+        overlay->PolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    overlay->UseProgram(oc->program);
+    overlay->Uniform2f(oc->scale_location, 2.0f / width, 2.0f / height);
+    overlay->BindTexture(GL_TEXTURE_2D, oc->texture);
+    if (oc->has_sampler)
+        overlay->BindSampler(0, 0);
+    overlay->BindVertexArray(oc->vao);
+    overlay->BindBuffer(GL_ARRAY_BUFFER, oc->vbo);
+    overlay->BufferData(GL_ARRAY_BUFFER, overlay->vert_count * sizeof(overlay_vertex_t), overlay->verts, GL_STREAM_DRAW);
+    overlay->DrawArrays(GL_TRIANGLES, 0, overlay->vert_count);
+
+    overlay_restore_state(overlay, oc, &state);
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// hitch detector
+//  Flags frames that take longer than g_hitch_factor times the median of the last HITCH_MEDIAN_FRAMES frames
+//  (and at least HITCH_MIN_EXCESS_NS over it, so jitter at high frame rates doesn't count), or longer than
+//  the g_hitch_budget absolute budget. Each hitch becomes an mbuf_hitch_t holding the frames around it. It's sent
+//  once VOGLPERF_HITCH_WINDOW_AFTER more frames have come in, or sooner if another hitch turns up first. Hitch
+//  frames are also marked in the frame record, so logs have them too.
+//----------------------------------------------------------------------------------------------------------------------
+#define HITCH_MEDIAN_FRAMES 32
+#define HITCH_MIN_FRAMES 8                  // Frames needed before the median means anything.
+#define HITCH_MIN_EXCESS_NS 2000000ULL
+
+typedef struct hitch_detector_t
+{
+    uint32_t recent[HITCH_MEDIAN_FRAMES];   // Last frame times (ns), oldest at index once the ring is full.
+    uint32_t sorted[HITCH_MEDIAN_FRAMES];   // Same frame times kept sorted for the median.
+    uint32_t count;
+    uint32_t index;
+    struct mbuf_hitch_t pending;            // Hitch waiting for the frames after it.
+    uint32_t pending_after;                 // Frames still wanted after the pending hitch. 0 if none pending.
+    uint32_t hitches;                       // Hitches this second.
+} hitch_detector_t;
+
+//----------------------------------------------------------------------------------------------------------------------
+// hitch_take
+//  Copies out the pending hitch and stops waiting for frames after it.
+//----------------------------------------------------------------------------------------------------------------------
+static void hitch_take(hitch_detector_t *hitch, struct mbuf_hitch_t *mbuf)
+{
+    *mbuf = hitch->pending;
+    hitch->pending_after = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// hitch_send
+//  Makes syscalls, so don't hold a surface's stats lock.
+//----------------------------------------------------------------------------------------------------------------------
+static void hitch_send(struct mbuf_hitch_t *mbuf)
+{
+    if (g_verbose)
+    {
+        syslog(LOG_INFO, "(voglperf) hitch surface %u: %.2fms (median %.2fms)\n", mbuf->surface,
+               mbuf->frame_time / 1000000.0, mbuf->median / 1000000.0);
+    }
+
+    if (g_msqid != -1)
+    {
+        int ret = voglperf_msgsnd(MSGTYPE_HITCH_NOTIFY, mbuf, sizeof(*mbuf), IPC_NOWAIT);
+        if (ret == -1)
+            syslog(LOG_ERR, "(voglperf) msgsnd hitch failed: %d. %s\n", ret, strerror(errno));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// hitch_add_frame
+//  Returns the median the frame was a hitch against, or 0 if it wasn't one. A hitch that's done waiting for the
+//  frames after it is copied to done for hitch_send(). done->frame_time is 0 if there isn't one.
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t hitch_add_frame(hitch_detector_t *hitch, const struct voglperf_frame_t *frame, uint32_t time_frame,
+                                struct mbuf_hitch_t *done)
+{
+    uint32_t i;
+    uint32_t median = 0;
+    uint32_t reason = 0;
+
+    done->frame_time = 0;
 
-        if (!X11_XLoadQueryFont || !X11_XCreateGC || !X11_XDrawString)
+    // Frames after a pending hitch.
+    if (hitch->pending_after)
+    {
+        struct mbuf_hitch_t *mbuf = &hitch->pending;
+
+        mbuf->window[mbuf->window_before + 1 + mbuf->window_after++] = time_frame;
+        if (!--hitch->pending_after)
+            hitch_take(hitch, done);
+    }
+
+    if (hitch->count >= HITCH_MIN_FRAMES)
+    {
+        median = hitch->sorted[hitch->count / 2];
+
+        float factor = g_hitch_factor;
+        if ((factor > 0.0f) && (time_frame > factor * median) && (time_frame - median >= HITCH_MIN_EXCESS_NS))
+            reason |= VOGLPERF_HITCH_MEDIAN;
+        if (g_hitch_budget && (time_frame > g_hitch_budget))
+            reason |= VOGLPERF_HITCH_BUDGET;
+    }
+
+    if (reason)
+    {
+        struct mbuf_hitch_t *mbuf = &hitch->pending;
+
+        // Don't hold on to the last one any longer, its window runs into this one.
+        if (hitch->pending_after)
+            hitch_take(hitch, done);
+
+        mbuf->time = frame->time;
+        mbuf->surface = frame->surface;
+        mbuf->frame_time = time_frame;
+        mbuf->median = median;
+        mbuf->reason = reason;
+        mbuf->cpu_time = frame->cpu_time;
+        mbuf->swap_time = frame->swap_time;
+        mbuf->window_before = (hitch->count < VOGLPERF_HITCH_WINDOW_BEFORE) ? hitch->count : VOGLPERF_HITCH_WINDOW_BEFORE;
+        mbuf->window_after = 0;
+        mbuf->pid = g_pid;
+        for (i = 0; i < mbuf->window_before; i++)
         {
-            syslog(LOG_WARNING, "(voglperf) WARNING: Failed to load X11 function pointers.\n");
-            g_showfps = 0;
+            uint32_t index = (hitch->index + HITCH_MEDIAN_FRAMES - mbuf->window_before + i) % HITCH_MEDIAN_FRAMES;
+            mbuf->window[i] = hitch->recent[index];
         }
+        mbuf->window[mbuf->window_before] = time_frame;
+        memset(mbuf->window + mbuf->window_before + 1, 0, VOGLPERF_HITCH_WINDOW_AFTER * sizeof(mbuf->window[0]));
+
+        hitch->pending_after = VOGLPERF_HITCH_WINDOW_AFTER;
+        hitch->hitches++;
     }
 
-#undef LOADX11FUNC
+    // Swap the oldest frame time out of the sorted list for this one.
+    uint32_t count = hitch->count;
+    if (count == HITCH_MEDIAN_FRAMES)
+    {
+        uint32_t oldest = hitch->recent[hitch->index];
+
+        for (i = 0; hitch->sorted[i] != oldest; i++)
+            ;
+        memmove(hitch->sorted + i, hitch->sorted + i + 1, (count - i - 1) * sizeof(hitch->sorted[0]));
+        count--;
+    }
+
+    for (i = count; (i > 0) && (hitch->sorted[i - 1] > time_frame); i--)
+        hitch->sorted[i] = hitch->sorted[i - 1];
+    hitch->sorted[i] = time_frame;
+
+    hitch->recent[hitch->index] = time_frame;
+    hitch->index = (hitch->index + 1) % HITCH_MEDIAN_FRAMES;
+    hitch->count = count + 1;
+
+    return reason ? (median ? median : 1) : 0;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-// voglperf_init
+// swap threads
+//  Everything the swap path touches for every frame lives in a swap_thread_t owned by the calling thread, so
+//  games presenting from a render thread, or from several threads at once, only share the stats of surfaces
+//  they present in common (see surface stats). Frames are published to voglperfrun through the MPSC frame ring and to the logfile writer through
+//  the thread's own frame_producer_t. The shared glinfo cache is only locked the first time a thread swaps a
+//  surface.
+//----------------------------------------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------------------------------------
-static void voglperf_init()
+// surface stats
+//  Frame accounting for a surface, shared by every thread that swaps it so a surface presented from several
+//  threads still gets one frame time per present and one fps summary a second. It hangs off the surface's glinfo
+//  cache entry. That and each swap_surface_t using it hold a reference; evicting the drawable drops the cache's.
+//
+//  lock only covers adding a frame that's already been timed: a few dozen stores and no syscalls. Threads take it
+//  once per present, an uncontended atomic like a lock-free publish would be, and only wait on each other when
+//  presenting the same surface at the same moment. Frame times and hitches need every present of the surface in
+//  order, which per-thread accumulators can't give without merging them under a lock anyway. Summaries, hitches
+//  and X11 text are sent after letting go of it.
+//----------------------------------------------------------------------------------------------------------------------
+typedef struct surface_stats_t
 {
-    static int s_inited = 0;
+    pthread_mutex_t lock;       // Held while adding a timed frame to frameinfo, hitch and graph.
+    uint32_t refs;
+    frameinfo_t frameinfo;
+    hitch_detector_t hitch;
+    float graph[OVERLAY_GRAPH_FRAMES];  // Recent frame times (ms) for the overlay graph.
+    uint32_t graph_index;       // Oldest frame time in graph.
+
+    uint64_t limit_deadline;    // CLOCK_MONOTONIC time (ns) the frame limiter releases the next present, whichever
+                                //  thread makes it. 0 to restart. Claimed atomically, outside lock.
+
+    pthread_mutex_t text_lock;  // Guards the rest, which are only touched once a second or by X11 calls.
+    char text[256];             // Last fps summary.
+    char overlay_text[256];     // Same numbers laid out for the overlay.
+    GC gc;                      // X11 showfps fallback.
+    int evicted;                // Drawable is being destroyed, don't draw on it.
+} surface_stats_t;
 
-    if (!s_inited)
+//----------------------------------------------------------------------------------------------------------------------
+// surface_stats_create
+//  Call with g_glinfo_lock held. Comes with the cache entry's reference.
+//----------------------------------------------------------------------------------------------------------------------
+static surface_stats_t *surface_stats_create()
+{
+    surface_stats_t *stats = (surface_stats_t *)calloc(1, sizeof(surface_stats_t));
+
+    if (stats)
     {
-        s_inited = 1;
+        pthread_mutex_init(&stats->lock, NULL);
+        pthread_mutex_init(&stats->text_lock, NULL);
+        stats->refs = 1;
+        stats->frameinfo.frame_min = (uint64_t)-1;
+        voglperf_hist_clear(&stats->frameinfo.hist);
+    }
+    return stats;
+}
 
-        // LOG_INFO, LOG_WARNING, LOG_ERR
-        openlog(NULL, LOG_CONS | LOG_PERROR | LOG_PID, LOG_USER);
+//----------------------------------------------------------------------------------------------------------------------
+// surface_stats_evict
+//  Takes over the cache entry's reference when its drawable is destroyed or its display closed. Frees the GC
+//  now, while dpy is still open, instead of whenever the last swap thread notices.
+//----------------------------------------------------------------------------------------------------------------------
+static void surface_stats_evict(surface_stats_t *stats, Display *dpy)
+{
+    pthread_mutex_lock(&stats->text_lock);
+    if (stats->gc && X11_XFreeGC)
+        X11_XFreeGC(dpy, stats->gc);
+    stats->gc = NULL;
+    stats->evicted = 1;
+    pthread_mutex_unlock(&stats->text_lock);
+
+    surface_stats_release(stats);
+}
 
-        char *cmd_line = getenv("VOGLPERF_CMD_LINE");
-        if (cmd_line)
+//----------------------------------------------------------------------------------------------------------------------
+// surface_stats_release
+//----------------------------------------------------------------------------------------------------------------------
+static void surface_stats_release(surface_stats_t *stats)
+{
+    if (__atomic_sub_fetch(&stats->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    // Nobody will swap it again to fill in the rest of the hitch window.
+    if (stats->hitch.pending_after)
+    {
+        struct mbuf_hitch_t mbuf;
+
+        hitch_take(&stats->hitch, &mbuf);
+        hitch_send(&mbuf);
+    }
+
+    pthread_mutex_destroy(&stats->lock);
+    pthread_mutex_destroy(&stats->text_lock);
+    free(stats);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// surface_stats_flush_hitches
+//  Sends hitches still waiting for the frames after them when we're exiting.
+//----------------------------------------------------------------------------------------------------------------------
+static void surface_stats_flush_hitches()
+{
+    uint32_t i;
+    uint32_t count = 0;
+    surface_stats_t *stats[GLINFO_CACHE_SIZE];
+
+    pthread_mutex_lock(&g_glinfo_lock);
+    for (i = 0; i < GLINFO_CACHE_SIZE; i++)
+    {
+        if (g_glinfo_cache[i].stats)
         {
-            syslog(LOG_INFO, "(voglperf) built %s %s, begin initialization in %s\n", __DATE__, __TIME__, program_invocation_short_name);
-            syslog(LOG_INFO, "(voglperf) VOGLPERF_CMD_LINE: '%s'\n", cmd_line);
+            stats[count] = g_glinfo_cache[i].stats;
+            __atomic_add_fetch(&stats[count]->refs, 1, __ATOMIC_RELAXED);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&g_glinfo_lock);
 
-            static const char s_msqid_arg[] = "--msqid=";
-            const char *msqid_str = strstr(cmd_line, s_msqid_arg);
-            if (msqid_str)
-            {
-                int msqid = atoi(msqid_str + sizeof(s_msqid_arg) - 1);
-                if (msqid >= 0)
-                {
-                    struct mbuf_pid_t mbuf;
+    for (i = 0; i < count; i++)
+    {
+        struct mbuf_hitch_t mbuf;
 
-                    mbuf.mtype = MSGTYPE_PID_NOTIFY;
-                    mbuf.pid = getpid();
+        mbuf.frame_time = 0;
+        pthread_mutex_lock(&stats[i]->lock);
+        if (stats[i]->hitch.pending_after)
+            hitch_take(&stats[i]->hitch, &mbuf);
+        pthread_mutex_unlock(&stats[i]->lock);
 
-					int ret = msgsnd(msqid, &mbuf, sizeof(mbuf) - sizeof(mbuf.mtype), IPC_NOWAIT);
-                    if (ret == 0)
-                        g_msqid = msqid;
+        if (mbuf.frame_time)
+            hitch_send(&mbuf);
+        surface_stats_release(stats[i]);
+    }
+}
 
-                    syslog(LOG_INFO, "(voglperf) msgsnd pid returns %d (msqid: %d)\n", ret, g_msqid);
-                }
-            }
+typedef struct swap_surface_t
+{
+    swap_api_t api;
+    Display *dpy;               // EGLDisplay and EGLSurface for SWAP_API_EGL.
+    GLXDrawable drawable;
+    glinfo_cache_t *glinfo;     // Shared cache entry. Only look at it with g_glinfo_lock held.
+    uint32_t surface;           // glinfo->surface when we first swapped. Differs once the drawable is evicted.
+    int width;                  // Drawable size for the overlay. 0 when it needs to be queried.
+    int height;
+    uint64_t cpu_last;          // This thread's CPU time when its last swap of the surface completed.
+    surface_stats_t *stats;     // Shared with other threads swapping it.
+} swap_surface_t;
+
+typedef struct swap_thread_t
+{
+    gpu_query_t gpu;
+    overlay_t overlay;
+    frame_producer_t *producer; // Logfile writer queue, or NULL until the writer is started.
+
+    swap_surface_t *surfaces;
+    uint32_t surface_count;
+    uint32_t surface_size;
+    uint32_t glinfo_evictions;  // g_glinfo_evictions when surfaces were last checked.
+    uint32_t swapping;          // Swaps begun but not finished. See voglperf_swapping().
+    uint64_t limit_oversleep;   // Average time (ns) clock_nanosleep overslept in the frame limiter.
+} swap_thread_t;
+
+static pthread_key_t g_swap_thread_key;
+static pthread_once_t g_swap_thread_once = PTHREAD_ONCE_INIT;
+static __thread swap_thread_t *s_swap_thread;
 
-            g_verbose = !!strstr(cmd_line, "--verbose");
+//----------------------------------------------------------------------------------------------------------------------
+// swap_thread_exit
+//  Thread exit destructor. Writer frees the producer once it has written out the last frames.
+//----------------------------------------------------------------------------------------------------------------------
+static void swap_thread_exit(void *arg)
+{
+    swap_thread_t *thread = (swap_thread_t *)arg;
+    uint32_t i;
+
+    if (thread->producer)
+        __atomic_store_n(&thread->producer->exited, 1, __ATOMIC_RELEASE);
+
+    s_swap_thread = NULL;
+    for (i = 0; i < thread->surface_count; i++)
+        surface_stats_release(thread->surfaces[i].stats);
+    free(thread->overlay.verts);
+    free(thread->surfaces);
+    free(thread);
+}
 
-            showfps_set(!!strstr(cmd_line, "--showfps"));
-        
-            int debugger_pause = !!strstr(cmd_line, "--debugger-pause");
-            if (debugger_pause && isatty(fileno(stdout)))
-            {
-                int sleeptime = 60000;
-                int debugger_connected = 0;
+//----------------------------------------------------------------------------------------------------------------------
+// swap_thread_key_create
+//----------------------------------------------------------------------------------------------------------------------
+static void swap_thread_key_create()
+{
+    int ret = pthread_key_create(&g_swap_thread_key, swap_thread_exit);
+    if (ret)
+        syslog(LOG_ERR, "(voglperf) pthread_key_create failed: %s\n", strerror(ret));
+}
 
-                syslog(LOG_INFO, "(voglperf) Pausing %d ms or until debugger is attached (pid %d).\n", sleeptime, getpid());
-                syslog(LOG_INFO, "(voglperf)   Or press any key to continue.\n");
+//----------------------------------------------------------------------------------------------------------------------
+// swap_thread_get
+//  Returns swap state for the calling thread.
+//----------------------------------------------------------------------------------------------------------------------
+static swap_thread_t *swap_thread_get()
+{
+    if (!s_swap_thread)
+    {
+        swap_thread_t *thread = (swap_thread_t *)calloc(1, sizeof(swap_thread_t));
+        if (!thread)
+            return NULL;
 
-                while (sleeptime >= 0)
-                {
-                    vogl_delay(200);
-                    sleeptime -= 200;
-                    debugger_connected = vogl_is_debugger_present();
-                    if (debugger_connected || vogl_kbhit())
-                        break;
-                }
+        pthread_once(&g_swap_thread_once, swap_thread_key_create);
+        pthread_setspecific(g_swap_thread_key, thread);
+        s_swap_thread = thread;
+    }
 
-                if (debugger_connected)
-                {
-                    syslog(LOG_INFO, "(voglperf)   Debugger connected...\n");
-                }
-            }
+    return s_swap_thread;
+}
 
-            static const char s_logfile_arg[] = "--logfile=";
-            const char *logfile = strstr(cmd_line, s_logfile_arg);
-            if (logfile)
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_atfork_child
+//  We're a new process with only the thread that forked. Drop what belongs to the parent and report in.
+//----------------------------------------------------------------------------------------------------------------------
+static void voglperf_atfork_child()
+{
+    uint32_t i;
+
+    logfile_writer_atfork_child();
+
+    // Flight recorder frames so far are the parent's.
+    g_flight_recorder.base = __atomic_load_n(&g_flight_recorder.head, __ATOMIC_RELAXED);
+
+    // This thread's frame queue went to the parent's writer thread.
+    if (s_swap_thread)
+        s_swap_thread->producer = NULL;
+
+    // Swap threads that didn't come with us may have been accounting for a frame.
+    for (i = 0; i < GLINFO_CACHE_SIZE; i++)
+    {
+        if (g_glinfo_cache[i].stats)
+        {
+            pthread_mutex_init(&g_glinfo_cache[i].stats->lock, NULL);
+            pthread_mutex_init(&g_glinfo_cache[i].stats->text_lock, NULL);
+        }
+    }
+
+    g_pid = (uint32_t)getpid();
+    g_process_swapped = 0;
+    g_msgs_dropped = 0;
+    process_notify(VOGLPERF_PROCESS_START);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// swap_thread_get_surface
+//----------------------------------------------------------------------------------------------------------------------
+static swap_surface_t *swap_thread_get_surface(swap_thread_t *thread, swap_api_t api, Display *dpy, GLXDrawable drawable)
+{
+    uint32_t i;
+    uint32_t glinfo_evictions = __atomic_load_n(&g_glinfo_evictions, __ATOMIC_ACQUIRE);
+
+    // Forget surfaces whose drawables were destroyed.
+    if (thread->glinfo_evictions != glinfo_evictions)
+    {
+        thread->glinfo_evictions = glinfo_evictions;
+
+        pthread_mutex_lock(&g_glinfo_lock);
+        for (i = 0; i < thread->surface_count;)
+        {
+            swap_surface_t *swap_surface = &thread->surfaces[i];
+
+            if (swap_surface->glinfo->surface != swap_surface->surface)
             {
-                char logfile_name[PATH_MAX];
+                surface_stats_release(swap_surface->stats);
+                *swap_surface = thread->surfaces[--thread->surface_count];
+            }
+            else
+            {
+                i++;
+            }
+        }
+        pthread_mutex_unlock(&g_glinfo_lock);
+    }
 
-                logfile += sizeof(s_logfile_arg) - 1;
+    // Games normally swap one or two surfaces per thread.
+    for (i = 0; i < thread->surface_count; i++)
+    {
+        if ((thread->surfaces[i].dpy == dpy) && (thread->surfaces[i].drawable == drawable) && (thread->surfaces[i].api == api))
+            return &thread->surfaces[i];
+    }
 
-                char delim_char = logfile[0];
+    if (thread->surface_count >= thread->surface_size)
+    {
+        uint32_t surface_size = thread->surface_size ? (thread->surface_size * 2) : 4;
+        swap_surface_t *surfaces = (swap_surface_t *)realloc(thread->surfaces, surface_size * sizeof(swap_surface_t));
+        if (!surfaces)
+            return NULL;
+
+        thread->surfaces = surfaces;
+        thread->surface_size = surface_size;
+    }
+
+    // First swap of this surface on this thread. Get its id and stats from the shared cache.
+    pthread_mutex_lock(&g_glinfo_lock);
+    glinfo_cache_t *glinfo = get_glinfo(dpy, drawable);
+    uint32_t surface = glinfo ? glinfo->surface : 0;
+    surface_stats_t *stats = NULL;
+    if (glinfo)
+    {
+        if (!glinfo->stats)
+            glinfo->stats = surface_stats_create();
+        stats = glinfo->stats;
+        if (stats)
+            __atomic_add_fetch(&stats->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_glinfo_lock);
+
+    if (!stats)
+        return NULL;
+
+    swap_surface_t *swap_surface = &thread->surfaces[thread->surface_count++];
 
-                if (delim_char == '"' || delim_char == '\'')
-                    logfile++;
-                else
-                    delim_char = ' ';
+    memset(swap_surface, 0, sizeof(*swap_surface));
+    swap_surface->api = api;
+    swap_surface->dpy = dpy;
+    swap_surface->drawable = drawable;
+    swap_surface->glinfo = glinfo;
+    swap_surface->surface = surface;
+    swap_surface->stats = stats;
+    return swap_surface;
+}
 
-                const char *logfile_end = logfile;
-                while (*logfile_end && (*logfile_end != delim_char))
-                    logfile_end++;
+//----------------------------------------------------------------------------------------------------------------------
+// swap_thread_begin_logfile
+//  Called before the frame is timed. Until it's pushed the logfile writer holds back frames other threads timed
+//  after time_swap (see logfile_writer_update).
+//----------------------------------------------------------------------------------------------------------------------
+static void swap_thread_begin_logfile(swap_thread_t *thread, uint64_t time_swap)
+{
+    logfile_writer_t *writer = &g_logfile_writer;
 
-                snprintf(logfile_name, sizeof(logfile_name), "%.*s", (int)(logfile_end - logfile), logfile);
-                syslog(LOG_INFO, "(voglperf)  Framerate logfile: '%s'\n", logfile_name);
+    if (!__atomic_load_n(&writer->started, __ATOMIC_ACQUIRE))
+        return;
 
-                voglperf_logfile_open(logfile_name, -1);
-            }
+    if (!thread->producer)
+    {
+        frame_producer_t *producer = (frame_producer_t *)calloc(1, sizeof(frame_producer_t));
 
-            atexit(vogl_perf_destructor_func);
+        if (!producer || !frame_queue_init(&producer->queue))
+        {
+            free(producer);
+            __atomic_add_fetch(&writer->dropped, 1, __ATOMIC_RELAXED);
+            return;
         }
 
-        syslog(LOG_INFO, "(voglperf) end initialization\n");
+        logfile_writer_add_producer(writer, producer);
+        thread->producer = producer;
     }
+
+    __atomic_store_n(&thread->producer->time_busy, time_swap, __ATOMIC_SEQ_CST);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-// glXMakeCurrent interceptor
-//$ TODO: Need to hook glXMakeCurrentReadSGI_func_ptr_t?
+// swap_thread_push_logfile
+//  Hands frame to the logfile writer thread, which does the formatting and I/O.
 //----------------------------------------------------------------------------------------------------------------------
-VOGL_API_EXPORT Bool GLAPIENTRY glXMakeCurrent(Display *dpy, GLXDrawable drawable, GLXContext ctx)
+static void swap_thread_push_logfile(swap_thread_t *thread, const struct voglperf_frame_t *frame)
 {
-    HOOK_FUNC("glXMakeCurrent", Bool, Display *dpy, GLXDrawable drawable, GLXContext ctx);
-    if (!s_orig_func)
-        return False;
+    logfile_writer_t *writer = &g_logfile_writer;
+    frame_producer_t *producer = thread->producer;
 
-    voglperf_init();
+    __atomic_store_n(&writer->time_pushed, frame->time, __ATOMIC_RELAXED);
 
-    if (g_verbose)
+    // Writer wasn't running yet when the frame was timed.
+    if (!producer || !producer->time_busy)
+        return;
+
+    if (!frame_queue_push(&producer->queue, frame))
+        __atomic_add_fetch(&writer->dropped, 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&producer->time_busy, 0, __ATOMIC_RELEASE);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_overlay_draw
+//  Draws the showfps overlay if drawable is what's current on this thread. Returns 0 if it wasn't drawn.
+//----------------------------------------------------------------------------------------------------------------------
+static int voglperf_overlay_draw(swap_thread_t *thread, swap_surface_t *swap_surface)
+{
+    if (!swap_api_drawable_current(swap_surface->api, swap_surface->drawable))
+        return 0;
+
+    // Size is refreshed once a second along with the text.
+    if (!swap_surface->width)
     {
-        syslog(LOG_INFO, "(voglperf) %s %p %lu %p\n", __PRETTY_FUNCTION__, dpy, drawable, ctx);
+        if (!swap_api_get_drawable_size(swap_surface->api, swap_surface->dpy, swap_surface->drawable,
+                                        &swap_surface->width, &swap_surface->height))
+        {
+            swap_surface->width = 0;
+            return 0;
+        }
     }
 
-    Bool ret = (*s_orig_func)(dpy, drawable, ctx);
-    if (!ret)
-        return ret;
+    // Another thread may be accounting for a frame of it.
+    surface_stats_t *stats = swap_surface->stats;
+    char text[sizeof(stats->overlay_text)];
+    float graph[OVERLAY_GRAPH_FRAMES];
+    uint32_t graph_index;
 
-    glinfo_cache_t *glinfo = get_glinfo(dpy, drawable);
-    if (glinfo)
-    {
-        typedef const GLubyte *(*GLAPIENTRY glGetString_func_ptr_t)(GLenum name);
-        static glGetString_func_ptr_t s_pActual_glGetString;
+    pthread_mutex_lock(&stats->text_lock);
+    memcpy(text, stats->overlay_text, sizeof(text));
+    pthread_mutex_unlock(&stats->text_lock);
 
-        if (!s_pActual_glGetString)
-            s_pActual_glGetString = (glGetString_func_ptr_t)dlsym(RTLD_NEXT, "glGetString");
-        if (s_pActual_glGetString)
-        {
-            if (glinfo->ctx != ctx)
-            {
-                // Set new ctx and clear strings so they'll be reloaded.
-                glinfo->ctx = ctx;
-                glinfo->glstrings_valid = 0;
-            }
+    pthread_mutex_lock(&stats->lock);
+    memcpy(graph, stats->graph, sizeof(graph));
+    graph_index = stats->graph_index;
+    pthread_mutex_unlock(&stats->lock);
 
-            if (!glinfo->glstrings_valid)
-            {
-                static const GLubyte s_nil[] = { 0 };
+    return overlay_draw(&thread->overlay, swap_surface->api, swap_surface->width, swap_surface->height, text, graph,
+                        graph_index);
+}
 
-                glinfo->glstrings_valid = 1;
+//----------------------------------------------------------------------------------------------------------------------
+// frame limiter (--fpslimit)
+//  Holds each swap back until its slot in a fixed cadence, so benchmarks can run at a frame cap without vsync.
+//  We sleep until shortly before the deadline and spin the rest of the way: sleeping alone wakes up tens to
+//  hundreds of microseconds late, spinning alone burns a core. How early we stop sleeping follows how much
+//  clock_nanosleep has been oversleeping on this thread. The wait is reported as limit time and kept out of the
+//  app's cpu/swap/offcpu split. A surface presented from several threads has one cadence: each present claims
+//  the next slot before waiting for it.
+//----------------------------------------------------------------------------------------------------------------------
+#define FRAME_LIMIT_SPIN_MIN_NS 50000ULL
+#define FRAME_LIMIT_SPIN_MAX_NS 2000000ULL
 
-                glinfo->renderer = s_pActual_glGetString(GL_RENDERER);
-                glinfo->vendor = s_pActual_glGetString(GL_VENDOR);
-                glinfo->version = s_pActual_glGetString(GL_VERSION);
+static inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
 
-                if (!glinfo->renderer)
-                    glinfo->renderer = s_nil;
-                if (!glinfo->vendor)
-                    glinfo->vendor = s_nil;
-                if (!glinfo->version)
-                    glinfo->version = s_nil;
+//----------------------------------------------------------------------------------------------------------------------
+// frame_limiter_wait
+//  Returns how long the frame was held and sets *error to how late it was let go.
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t frame_limiter_wait(swap_thread_t *thread, swap_surface_t *swap_surface, uint32_t fpslimit, uint64_t *error)
+{
+    uint64_t interval = 1000000000ULL / fpslimit;
+    uint64_t time_start = vogl_get_time_ns();
+    uint64_t *limit_deadline = &swap_surface->stats->limit_deadline;
+    uint64_t deadline = __atomic_load_n(limit_deadline, __ATOMIC_RELAXED);
+    int restart;
+
+    *error = 0;
+
+    // Start a new cadence on the first frame and when the app falls more than a frame behind (instead of letting a
+    // burst of frames through to catch up). Slots other threads have claimed can put the deadline a few intervals
+    // ahead, and one old interval after the cap goes up, so only one more than a second out is stale.
+    do
+    {
+        restart = !deadline || (time_start > deadline + interval) || (deadline > time_start + 1000000000ULL);
+    } while (!__atomic_compare_exchange_n(limit_deadline, &deadline, restart ? (time_start + interval) : (deadline + interval),
+                                          0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 
-                syslog(LOG_INFO, "(voglperf) glinfo: '%s' '%s' '%s'\n", glinfo->vendor, glinfo->renderer, glinfo->version);
-            }
-        }
+    if (restart || (time_start >= deadline))
+        return 0;
+
+    uint64_t spin = 2 * thread->limit_oversleep + FRAME_LIMIT_SPIN_MIN_NS;
+    if (spin > FRAME_LIMIT_SPIN_MAX_NS)
+        spin = FRAME_LIMIT_SPIN_MAX_NS;
+
+    if (deadline - time_start > spin)
+    {
+        uint64_t wake = deadline - spin;
+        struct timespec ts;
+
+        ts.tv_sec = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+
+        // Running average over the last 8 or so sleeps.
+        uint64_t woke = vogl_get_time_ns();
+        uint64_t oversleep = (woke > wake) ? (woke - wake) : 0;
+        thread->limit_oversleep = thread->limit_oversleep - (thread->limit_oversleep / 8) + (oversleep / 8);
     }
 
-    return ret;
+    uint64_t time_cur;
+    while ((time_cur = vogl_get_time_ns()) < deadline)
+        cpu_relax();
+
+    *error = time_cur - deadline;
+    return time_cur - time_start;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-// voglperf_swap_buffers
+// voglperf_swap_begin
+//  Called right before the real swap.
 //----------------------------------------------------------------------------------------------------------------------
-static void voglperf_swap_buffers(Display *dpy, GLXDrawable drawable, int flush_logfile)
+void voglperf_swap_begin(swap_begin_t *swap_begin, swap_api_t api, Display *dpy, GLXDrawable drawable)
 {
-    typedef struct frameinfo_t
+    swap_thread_t *thread = swap_thread_get();
+
+    if (thread)
+        thread->swapping++;
+
+    swap_begin->api = api;
+    swap_begin->thread = thread;
+    swap_begin->swap_surface = thread ? swap_thread_get_surface(thread, api, dpy, drawable) : NULL;
+    flight_recorder_alloc();
+    swap_begin->gpu_frames = 0;
+    swap_begin->gpu_time = (thread && g_gputime && (api != SWAP_API_VULKAN)) ?
+                           gpu_query_swap_begin(&thread->gpu, api, &swap_begin->gpu_frames) : 0;
+    swap_begin->time = vogl_get_time_ns();
+    swap_begin->cpu = vogl_get_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    // After the GPU timestamp so overlay rendering isn't counted as GPU frame time. Its CPU cost shows up
+    // as swap time.
+    swap_begin->overlay_drawn = 0;
+    if (g_showfps && swap_begin->swap_surface && (api != SWAP_API_VULKAN))
+        swap_begin->overlay_drawn = voglperf_overlay_draw(thread, swap_begin->swap_surface);
+
+    // Last thing before the swap so the frame goes out right on its deadline.
+    uint32_t fpslimit = __atomic_load_n(&g_fpslimit, __ATOMIC_RELAXED);
+    swap_begin->limit_time = 0;
+    swap_begin->limit_error = 0;
+    if (fpslimit && swap_begin->swap_surface)
     {
-        uint64_t time_benchmark;
-        uint64_t time_last_frame;
-        uint64_t frame_min;
-        uint64_t frame_max;
-        unsigned int frame_count;
-        char text[256];
-    } frameinfo_t;
-    static frameinfo_t s_frameinfo = { 0, 0, (uint64_t)-1, 0, 0, { 0 } };
+        swap_begin->limit_time = frame_limiter_wait(thread, swap_begin->swap_surface, fpslimit, &swap_begin->limit_error);
+    }
+    else if (swap_begin->swap_surface && __atomic_load_n(&swap_begin->swap_surface->stats->limit_deadline, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&swap_begin->swap_surface->stats->limit_deadline, 0, __ATOMIC_RELAXED);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_swap_buffers
+//  Called after the real swap returns.
+//----------------------------------------------------------------------------------------------------------------------
+void voglperf_swap_buffers(Display *dpy, GLXDrawable drawable, const swap_begin_t *swap_begin)
+{
     static const uint64_t g_BILLION = 1000000000;
     static const double g_rcpMILLION = (1.0 / 1000000);
 
-    // Get current time.
-    struct timespec time;
-    clock_gettime(CLOCK_MONOTONIC, &time);
+    uint64_t time_swap = swap_begin->time;
+    uint64_t cpu_swap = swap_begin->cpu;
 
-    uint64_t time_cur = (time.tv_sec * g_BILLION) + time.tv_nsec;
+    // Tells voglperfrun this is the process doing the rendering.
+    if (!__atomic_load_n(&g_process_swapped, __ATOMIC_RELAXED) && !__atomic_exchange_n(&g_process_swapped, 1, __ATOMIC_RELAXED))
+        process_notify(VOGLPERF_PROCESS_SWAP);
 
-    if (s_frameinfo.time_last_frame)
+    // Wait for the GPU to finish the frame so swap time includes all of the GPU work (--glfinish).
+    if (g_glfinish && (swap_begin->api != SWAP_API_VULKAN))
     {
-        uint64_t time_frame = time_cur - s_frameinfo.time_last_frame;
+        typedef void (*GLAPIENTRY glFinish_func_ptr_t)(void);
+        static glFinish_func_ptr_t s_pActual_glFinish;
 
-        if (g_logfile_fd != -1)
-        {
-            // Add this frame time to our logfile.
-            snprintf(g_logfile_buf + g_logfile_buf_len, sizeof(g_logfile_buf) - g_logfile_buf_len, "%.2f\n", time_frame * g_rcpMILLION);
-            g_logfile_buf_len += strlen(g_logfile_buf + g_logfile_buf_len);
-        }
+        if (!s_pActual_glFinish)
+            s_pActual_glFinish = (glFinish_func_ptr_t)dlsym(RTLD_NEXT, "glFinish");
+        if (s_pActual_glFinish)
+            s_pActual_glFinish();
+    }
+
+    // Everything is tracked per surface so games presenting to several windows get sane frame times. A surface
+    // swapped from several threads has its frames accounted for one at a time, but each thread times its own
+    // present before waiting on the others.
+    swap_thread_t *thread = swap_begin->thread;
+    swap_surface_t *swap_surface = swap_begin->swap_surface;
+    if (swap_surface)
+        swap_thread_begin_logfile(thread, time_swap);
+
+    // Get current time.
+    uint64_t time_cur = vogl_get_time_ns();
+    uint64_t cpu_cur = vogl_get_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    if (thread)
+        thread->swapping--;
+    if (!swap_surface)
+        return;
 
+    // Start timing the next frame on the GPU.
+    if (g_gputime && (swap_begin->api != SWAP_API_VULKAN))
+        gpu_query_swap_end(&thread->gpu);
+
+    // Split the frame into time the app spent on the cpu, time blocked in swap, and whatever is left over.
+    uint64_t cpu_time = 0;
+    if (swap_surface->cpu_last && (cpu_swap > swap_surface->cpu_last))
+        cpu_time = cpu_swap - swap_surface->cpu_last;
+
+    swap_surface->cpu_last = cpu_cur;
+
+    // The limiter's wait sits between time_swap and the real swap. It isn't swap time.
+    uint64_t swap_time = time_cur - time_swap;
+    swap_time = (swap_time > swap_begin->limit_time) ? (swap_time - swap_begin->limit_time) : 0;
+
+    struct voglperf_frame_t frame;
+    frame.time = time_cur;
+    frame.swap_time = (swap_time > UINT32_MAX) ? UINT32_MAX : (uint32_t)swap_time;
+    frame.gpu_time = (swap_begin->gpu_time > UINT32_MAX) ? UINT32_MAX : (uint32_t)swap_begin->gpu_time;
+    frame.surface = swap_surface->surface;
+    frame.limit_time = (swap_begin->limit_time > UINT32_MAX) ? UINT32_MAX : (uint32_t)swap_begin->limit_time;
+    frame.hitch_median = 0;
+    frame.pid = g_pid;
+    frame.gpu_frames = swap_begin->gpu_frames;
+
+    struct mbuf_fps_t mbuf;
+    struct mbuf_hitch_t hitch;
+    int summary = 0;
+    int summary_gpu = 0;
+    int summary_limit = 0;
+
+    surface_stats_t *stats = swap_surface->stats;
+    frameinfo_t *frameinfo = &stats->frameinfo;
+    pthread_mutex_lock(&stats->lock);
+
+    // Another thread's present can land after this one began, or even finish after this one did. That frame
+    // gets a frame time of 0 instead of wrapping around.
+    uint64_t time_last_frame = frameinfo->time_last_frame;
+    uint64_t time_app = (time_last_frame && (time_swap > time_last_frame)) ? (time_swap - time_last_frame) : 0;
+    if (cpu_time > time_app)
+        cpu_time = time_app;
+    frame.cpu_time = (cpu_time > UINT32_MAX) ? UINT32_MAX : (uint32_t)cpu_time;
+
+    uint64_t time_frame = (time_last_frame && (time_cur > time_last_frame)) ? (time_cur - time_last_frame) : 0;
+    hitch.frame_time = 0;
+    if (time_frame)
+        frame.hitch_median = hitch_add_frame(&stats->hitch, &frame, (time_frame > UINT32_MAX) ? UINT32_MAX : (uint32_t)time_frame, &hitch);
+
+    // Hand every frame to voglperfrun. No syscalls, just a few stores into shared memory.
+    if (g_frame_ring)
+        voglperf_frame_ring_push(g_frame_ring, &frame);
+
+    // And to the logfile writer and flight recorder.
+    swap_thread_push_logfile(thread, &frame);
+    flight_recorder_push(&frame);
+
+    if (time_frame)
+    {
         // If this time would push our total benchmark time over 1 second, spew out the benchmark data.
-        if (((s_frameinfo.time_benchmark + time_frame) >= g_BILLION) || flush_logfile)
+        if ((frameinfo->time_benchmark + time_frame) >= g_BILLION)
         {
-            struct mbuf_fps_t mbuf;
+            mbuf.surface = swap_surface->surface;
+            mbuf.drawable = (uint32_t)drawable;
+            mbuf.fps = (float)(frameinfo->frame_count * (double)g_BILLION / frameinfo->time_benchmark);
+            mbuf.frame_count = frameinfo->frame_count;
+            mbuf.frame_time = (float)(frameinfo->time_benchmark * g_rcpMILLION);
+            mbuf.frame_min = (float)(frameinfo->frame_min * g_rcpMILLION);
+            mbuf.frame_max = (float)(frameinfo->frame_max * g_rcpMILLION);
+            mbuf.dropped = (uint32_t)(__atomic_load_n(&g_logfile_writer.dropped, __ATOMIC_RELAXED) +
+                                      (g_frame_ring ? __atomic_load_n(&g_frame_ring->dropped, __ATOMIC_RELAXED) : 0));
+            mbuf.frame_p50 = (float)(voglperf_hist_percentile(&frameinfo->hist, 50.0) * g_rcpMILLION);
+            mbuf.frame_p90 = (float)(voglperf_hist_percentile(&frameinfo->hist, 90.0) * g_rcpMILLION);
+            mbuf.frame_p99 = (float)(voglperf_hist_percentile(&frameinfo->hist, 99.0) * g_rcpMILLION);
+            mbuf.frame_p999 = (float)(voglperf_hist_percentile(&frameinfo->hist, 99.9) * g_rcpMILLION);
+            mbuf.fps_low1 = (float)voglperf_hist_low_fps(&frameinfo->hist, 1.0);
+            mbuf.frame_cpu = (float)(frameinfo->time_cpu * g_rcpMILLION / frameinfo->frame_count);
+            mbuf.frame_swap = (float)(frameinfo->time_swap * g_rcpMILLION / frameinfo->frame_count);
+            mbuf.frame_off_cpu = (float)(voglperf_frame_off_cpu(frameinfo->time_benchmark, frameinfo->time_cpu, frameinfo->time_swap,
+                                                                frameinfo->time_limit) * g_rcpMILLION / frameinfo->frame_count);
+            mbuf.frame_gpu = frameinfo->gpu_count ? (float)(frameinfo->time_gpu * g_rcpMILLION / frameinfo->gpu_count) : 0.0f;
+            mbuf.frame_limit = (float)(frameinfo->time_limit * g_rcpMILLION / frameinfo->frame_count);
+            mbuf.limit_error = (float)(frameinfo->limit_error_max * g_rcpMILLION);
+            mbuf.hitches = stats->hitch.hitches;
+            mbuf.msgs_dropped = __atomic_load_n(&g_msgs_dropped, __ATOMIC_RELAXED);
+            mbuf.pid = g_pid;
+            summary = 1;
+            summary_gpu = (frameinfo->gpu_count != 0);
+            summary_limit = (frameinfo->time_limit != 0);
 
-            mbuf.mtype = MSGTYPE_FPS_NOTIFY;
-            mbuf.fps = (float)(s_frameinfo.frame_count * (double)g_BILLION / s_frameinfo.time_benchmark);
-            mbuf.frame_count = s_frameinfo.frame_count;
-            mbuf.frame_time = (float)(s_frameinfo.time_benchmark * g_rcpMILLION);
-            mbuf.frame_min = (float)(s_frameinfo.frame_min * g_rcpMILLION);
-            mbuf.frame_max = (float)(s_frameinfo.frame_max * g_rcpMILLION);
+            // Reset for next benchmark run.
+            frameinfo->time_benchmark = 0;
+            frameinfo->frame_min = (uint64_t)-1;
+            frameinfo->frame_max = 0;
+            frameinfo->frame_count = 0;
+            frameinfo->time_cpu = 0;
+            frameinfo->time_swap = 0;
+            frameinfo->time_gpu = 0;
+            frameinfo->gpu_count = 0;
+            frameinfo->time_limit = 0;
+            frameinfo->limit_error_max = 0;
+            stats->hitch.hitches = 0;
+            voglperf_hist_clear(&frameinfo->hist);
+        }
 
-            snprintf(s_frameinfo.text, sizeof(s_frameinfo.text),
-                         "%.2f fps frames:%u time:%.2fms min:%.2fms max:%.2fms",
-                         mbuf.fps, mbuf.frame_count, mbuf.frame_time, mbuf.frame_min, mbuf.frame_max);
-            if (g_verbose)
-            {
-                syslog(LOG_INFO, "(voglperf) %s\n", s_frameinfo.text);
-            }
+        if (frameinfo->frame_min > time_frame)
+            frameinfo->frame_min = time_frame;
+        if (frameinfo->frame_max < time_frame)
+            frameinfo->frame_max = time_frame;
+
+        frameinfo->frame_count++;
+        frameinfo->time_benchmark += time_frame;
+        frameinfo->time_cpu += frame.cpu_time;
+        frameinfo->time_swap += frame.swap_time;
+        frameinfo->time_gpu += frame.gpu_time;
+        frameinfo->gpu_count += frame.gpu_frames;
+        frameinfo->time_limit += frame.limit_time;
+        if (frameinfo->limit_error_max < swap_begin->limit_error)
+            frameinfo->limit_error_max = swap_begin->limit_error;
+        voglperf_hist_add(&frameinfo->hist, time_frame);
+
+        stats->graph[stats->graph_index] = (float)(time_frame * g_rcpMILLION);
+        stats->graph_index = (stats->graph_index + 1) % OVERLAY_GRAPH_FRAMES;
+    }
 
-            if (g_msqid != -1)
-            {
-                int ret = msgsnd(g_msqid, &mbuf, sizeof(mbuf) - sizeof(mbuf.mtype), IPC_NOWAIT);
-                if (ret == -1)
-                {
-                    syslog(LOG_ERR, "(voglperf) msgsnd fps failed: %d. %s\n", ret, strerror(errno));
-                    g_msqid = -1;
-                }
-            }
+    if (time_cur > time_last_frame)
+        frameinfo->time_last_frame = time_cur;
 
-            if (g_logfile_fd != -1)
-            {
-                HANDLE_EINTR(write(g_logfile_fd, g_logfile_buf, g_logfile_buf_len));
-                g_logfile_buf_len = 0;
-            }
+    int second_start = (frameinfo->frame_count == 1);
+    pthread_mutex_unlock(&stats->lock);
 
-            // Reset for next benchmark run.
-            s_frameinfo.time_benchmark = 0;
-            s_frameinfo.frame_min = (uint64_t)-1;
-            s_frameinfo.frame_max = 0;
-            s_frameinfo.frame_count = 0;
+    if (hitch.frame_time)
+        hitch_send(&hitch);
+
+    if (summary)
+    {
+        char text[sizeof(stats->text)];
+        char overlay_text[sizeof(stats->overlay_text)];
+
+        snprintf(text, sizeof(text),
+                     "%.2f fps frames:%u time:%.2fms min:%.2fms max:%.2fms p50:%.2fms p99:%.2fms 1%%low:%.2ffps "
+                     "cpu:%.2fms swap:%.2fms offcpu:%.2fms",
+                     mbuf.fps, mbuf.frame_count, mbuf.frame_time, mbuf.frame_min, mbuf.frame_max,
+                     mbuf.frame_p50, mbuf.frame_p99, mbuf.fps_low1,
+                     mbuf.frame_cpu, mbuf.frame_swap, mbuf.frame_off_cpu);
+        if (summary_gpu)
+        {
+            size_t len = strlen(text);
+            snprintf(text + len, sizeof(text) - len, " gpu:%.2fms", mbuf.frame_gpu);
+        }
+        if (summary_limit)
+        {
+            size_t len = strlen(text);
+            snprintf(text + len, sizeof(text) - len, " limit:%.2fms limiterr:%.0fus",
+                     mbuf.frame_limit, mbuf.limit_error * 1000.0f);
+        }
+        if (mbuf.hitches)
+        {
+            size_t len = strlen(text);
+            snprintf(text + len, sizeof(text) - len, " hitches:%u", mbuf.hitches);
+        }
+        if (g_verbose)
+        {
+            syslog(LOG_INFO, "(voglperf) %s\n", text);
         }
 
-        if (s_frameinfo.frame_min > time_frame)
-            s_frameinfo.frame_min = time_frame;
-        if (s_frameinfo.frame_max < time_frame)
-            s_frameinfo.frame_max = time_frame;
+        overlay_text[0] = 0;
+        if (g_showfps)
+        {
+            int len = snprintf(overlay_text, sizeof(overlay_text),
+                               "%.1f fps  %.2f ms\np50 %.2f  p99 %.2f  1%% low %.1f fps\ncpu %.2f  swap %.2f",
+                               mbuf.fps, mbuf.frame_time / mbuf.frame_count, mbuf.frame_p50, mbuf.frame_p99,
+                               mbuf.fps_low1, mbuf.frame_cpu, mbuf.frame_swap);
+            if (summary_gpu && (len > 0) && (len < (int)sizeof(overlay_text)))
+                snprintf(overlay_text + len, sizeof(overlay_text) - len, "  gpu %.2f", mbuf.frame_gpu);
+
+            // Pick up window resizes.
+            swap_surface->width = 0;
+        }
 
-        s_frameinfo.frame_count++;
-        s_frameinfo.time_benchmark += time_frame;
+        pthread_mutex_lock(&stats->text_lock);
+        memcpy(stats->text, text, sizeof(text));
+        memcpy(stats->overlay_text, overlay_text, sizeof(overlay_text));
+        pthread_mutex_unlock(&stats->text_lock);
 
-        if (g_logfile_time)
+        if (g_msqid != -1)
         {
-            if (g_logfile_time <= time_frame)
-            {
-                g_logfile_time = 0;
-                voglperf_logfile_close();
-            }
-            else
+            int ret = voglperf_msgsnd(MSGTYPE_FPS_NOTIFY, &mbuf, sizeof(mbuf), IPC_NOWAIT);
+
+            // Full queues are counted and reported in the next one that gets through. Only give up once
+            //  voglperfrun and its queue are gone.
+            if ((ret == -1) && (errno != EAGAIN))
             {
-                g_logfile_time -= time_frame;
+                syslog(LOG_ERR, "(voglperf) msgsnd fps failed: %d. %s\n", ret, strerror(errno));
+                g_msqid = -1;
             }
         }
     }
 
-    s_frameinfo.time_last_frame = time_cur;
+    voglperf_logfile_check_end(time_cur);
+    voglperf_logfile_dump_check(time_cur, 0);
 
-    if (g_showfps && dpy && drawable)
+    // X11 text for GLX contexts the GL overlay can't draw on.
+    if (g_showfps && !swap_begin->overlay_drawn && (swap_surface->api == SWAP_API_GLX) && dpy && drawable &&
+            X11_XCreateGC && X11_XDrawString)
     {
-        glinfo_cache_t *glinfo = get_glinfo(dpy, drawable);
-
-        if (glinfo)
+        pthread_mutex_lock(&stats->text_lock);
+        if (!stats->gc && !stats->evicted)
         {
-            if (!glinfo->gc)
-            {
-                XGCValues ctx_vals;
-                unsigned long gcflags = GCForeground | GCBackground;
-
-                // static const char g_MessageBoxFontLatin1[] = "-*-*-medium-r-normal--0-120-*-*-p-0-iso8859-1";
-                // XFontStruct *font_struct = X11_XLoadQueryFont(dpy, g_MessageBoxFontLatin1);
-                // if (font_struct)
-                // {
-                //     gcflags |= GCFont;
-                //     ctx_vals.font = font_struct->fid;
-                // }
-
-                ctx_vals.foreground = 0xff0000;
-                ctx_vals.background = 0x000000;
-
-                //$ TODO: Free these?
-                //   X11_XFreeGC(dpy, gc);
-                //   X11_XFreeFont( dpy, font_struct );
-                glinfo->gc = X11_XCreateGC(dpy, drawable, gcflags, &ctx_vals);
-            }
+            XGCValues ctx_vals;
+            unsigned long gcflags = GCForeground | GCBackground;
+
+            // static const char g_MessageBoxFontLatin1[] = "-*-*-medium-r-normal--0-120-*-*-p-0-iso8859-1";
+            // XFontStruct *font_struct = X11_XLoadQueryFont(dpy, g_MessageBoxFontLatin1);
+            // if (font_struct)
+            // {
+            //     gcflags |= GCFont;
+            //     ctx_vals.font = font_struct->fid;
+            // }
+
+            ctx_vals.foreground = 0xff0000;
+            ctx_vals.background = 0x000000;
+
+            // Freed when the drawable is destroyed or its display closed.
+            stats->gc = X11_XCreateGC(dpy, drawable, gcflags, &ctx_vals);
+        }
 
-            if (glinfo->gc)
-            {
-                // This will flash as we're adding it after the present.
-                // Might also not work on some drivers as they don't sync between X11 and GL.
-                X11_XDrawString(dpy, drawable, glinfo->gc, 10, 20, s_frameinfo.text, (int)strlen(s_frameinfo.text));
-            }
+        if (stats->gc)
+        {
+            // This will flash as we're adding it after the present.
+            // Might also not work on some drivers as they don't sync between X11 and GL.
+            X11_XDrawString(dpy, drawable, stats->gc, 10, 20, stats->text, (int)strlen(stats->text));
         }
+        pthread_mutex_unlock(&stats->text_lock);
     }
 
-    if (!flush_logfile && (s_frameinfo.frame_count == 1))
+    if (g_frame_ring)
+    {
+        // Commands from voglperfrun apply on the very next frame.
+        control_update();
+    }
+    else if (second_start)
     {
+        // No shared memory. Poll the message queue once a second.
+        struct voglperf_msgbuf_t msgbuf;
+        ssize_t len;
+
         struct mbuf_logfile_stop_t mbuf_stop;
-        if (msgrcv(g_msqid, &mbuf_stop, sizeof(mbuf_stop), MSGTYPE_LOGFILE_STOP, IPC_NOWAIT) != -1)
+        len = msgrcv(g_msqid, &msgbuf, sizeof(msgbuf.mtext), MSGTYPE_LOGFILE_STOP, IPC_NOWAIT | MSG_NOERROR);
+        if (voglperf_msg_unpack(&msgbuf, len, MSGTYPE_LOGFILE_STOP, &mbuf_stop, sizeof(mbuf_stop)))
             voglperf_logfile_close();
 
         struct mbuf_logfile_start_t mbuf_start;
-        if (msgrcv(g_msqid, &mbuf_start, sizeof(mbuf_start), MSGTYPE_LOGFILE_START, IPC_NOWAIT) != -1)
+        len = msgrcv(g_msqid, &msgbuf, sizeof(msgbuf.mtext), MSGTYPE_LOGFILE_START, IPC_NOWAIT | MSG_NOERROR);
+        if (voglperf_msg_unpack(&msgbuf, len, MSGTYPE_LOGFILE_START, &mbuf_start, sizeof(mbuf_start)))
             voglperf_logfile_open(mbuf_start.logfile, mbuf_start.time);
 
-        struct mbuf_options_t mbuf_options;
-        if (msgrcv(g_msqid, &mbuf_options, sizeof(mbuf_options), MSGTYPE_OPTIONS, IPC_NOWAIT) != -1)
-        {
-            g_verbose = !!mbuf_options.verbose;
-            showfps_set(!!mbuf_options.fpsshow);
+        struct mbuf_logfile_start_t mbuf_dump;
+        len = msgrcv(g_msqid, &msgbuf, sizeof(msgbuf.mtext), MSGTYPE_LOGFILE_DUMP, IPC_NOWAIT | MSG_NOERROR);
+        if (voglperf_msg_unpack(&msgbuf, len, MSGTYPE_LOGFILE_DUMP, &mbuf_dump, sizeof(mbuf_dump)))
+            voglperf_logfile_dump(mbuf_dump.logfile, mbuf_dump.time);
 
-            syslog(LOG_INFO, "(voglperf) showfps:%d verbose:%d\n", g_showfps, g_verbose);
-        }
+        struct mbuf_options_t mbuf_options;
+        len = msgrcv(g_msqid, &msgbuf, sizeof(msgbuf.mtext), MSGTYPE_OPTIONS, IPC_NOWAIT | MSG_NOERROR);
+        if (voglperf_msg_unpack(&msgbuf, len, MSGTYPE_OPTIONS, &mbuf_options, sizeof(mbuf_options)))
+            options_apply(mbuf_options.fpsshow, mbuf_options.verbose, mbuf_options.fpslimit);
     }
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_swapping
+//----------------------------------------------------------------------------------------------------------------------
+int voglperf_swapping()
+{
+    return s_swap_thread && s_swap_thread->swapping;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // glXSwapBuffers interceptor
 //----------------------------------------------------------------------------------------------------------------------
 VOGL_API_EXPORT void GLAPIENTRY glXSwapBuffers(Display *dpy, GLXDrawable drawable)
 {
-    HOOK_FUNC("glXSwapBuffers", Bool, Display *dpy, GLXDrawable drawable);
-    if (!s_orig_func)
+    HOOK_FUNC(glXSwapBuffers);
+    if (!orig_func)
         return;
 
     voglperf_init();
@@ -740,38 +5136,256 @@ VOGL_API_EXPORT void GLAPIENTRY glXSwapBuffers(Display *dpy, GLXDrawable drawabl
         syslog(LOG_INFO, "(voglperf) %s %p %lu\n", __PRETTY_FUNCTION__, dpy, drawable);
     }
 
+    swap_begin_t swap_begin;
+    voglperf_swap_begin(&swap_begin, SWAP_API_GLX, dpy, drawable);
+
     // Call real glxSwapBuffers function.
-    (*s_orig_func)(dpy, drawable);
+    (*orig_func)(dpy, drawable);
 
-    voglperf_swap_buffers(dpy, drawable, 0);
+    voglperf_swap_buffers(dpy, drawable, &swap_begin);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-// glXGetProcAddressARB interceptor
+// glXSwapBuffersMscOML interceptor
 //----------------------------------------------------------------------------------------------------------------------
-VOGL_API_EXPORT __GLXextFuncPtr GLAPIENTRY glXGetProcAddressARB(const GLubyte *procname)
+VOGL_API_EXPORT int64_t GLAPIENTRY glXSwapBuffersMscOML(Display *dpy, GLXDrawable drawable,
+                                                        int64_t target_msc, int64_t divisor, int64_t remainder)
 {
-    HOOK_FUNC("glXGetProcAddressARB", __GLXextFuncPtr, const GLubyte *procname);
-    if (!s_orig_func)
-        return NULL;
+    HOOK_FUNC(glXSwapBuffersMscOML);
+    if (!orig_func)
+        return -1;
 
-    if (procname)
+    voglperf_init();
+
+    if (g_verbose)
+    {
+        syslog(LOG_INFO, "(voglperf) %s %p %lu %" PRId64 " %" PRId64 " %" PRId64 "\n", __PRETTY_FUNCTION__,
+               dpy, drawable, target_msc, divisor, remainder);
+    }
+
+    swap_begin_t swap_begin;
+    voglperf_swap_begin(&swap_begin, SWAP_API_GLX, dpy, drawable);
+
+    int64_t ret = (*orig_func)(dpy, drawable, target_msc, divisor, remainder);
+
+    voglperf_swap_buffers(dpy, drawable, &swap_begin);
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// drawable destroy interceptors
+//  Evict destroyed drawables from the glinfo cache so it doesn't fill up and reused XIDs start fresh.
+//----------------------------------------------------------------------------------------------------------------------
+#define DESTROY_DRAWABLE_HOOK(_func, _type)                                             \
+    VOGL_API_EXPORT void GLAPIENTRY _func(Display *dpy, _type drawable)                 \
+    {                                                                                   \
+        HOOK_FUNC(_func);                                                               \
+        if (!orig_func)                                                                 \
+            return;                                                                     \
+                                                                                        \
+        if (g_verbose)                                                                  \
+            syslog(LOG_INFO, "(voglperf) %s %p %lu\n", __FUNCTION__, dpy, drawable);    \
+                                                                                        \
+        glinfo_evict(dpy, (GLXDrawable)drawable);                                       \
+        (*orig_func)(dpy, drawable);                                                    \
+    }
+
+DESTROY_DRAWABLE_HOOK(glXDestroyWindow, GLXWindow)
+DESTROY_DRAWABLE_HOOK(glXDestroyPixmap, GLXPixmap)
+DESTROY_DRAWABLE_HOOK(glXDestroyGLXPixmap, GLXPixmap)
+DESTROY_DRAWABLE_HOOK(glXDestroyPbuffer, GLXPbuffer)
+
+#undef DESTROY_DRAWABLE_HOOK
+
+//----------------------------------------------------------------------------------------------------------------------
+// XDestroyWindow interceptor
+//  Games often swap plain X windows instead of GLXWindows. Destroying a window destroys its children too.
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT int XDestroyWindow(Display *dpy, Window window)
+{
+    HOOK_FUNC(XDestroyWindow);
+    if (!orig_func)
+        return 0;
+
+    if (g_verbose)
+        syslog(LOG_INFO, "(voglperf) %s %p %lu\n", __FUNCTION__, dpy, window);
+
+    glinfo_evict(dpy, (GLXDrawable)window);
+    glinfo_evict_subwindows(dpy, window);
+    return (*orig_func)(dpy, window);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// XDestroySubwindows interceptor
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT int XDestroySubwindows(Display *dpy, Window window)
+{
+    HOOK_FUNC(XDestroySubwindows);
+    if (!orig_func)
+        return 0;
+
+    if (g_verbose)
+        syslog(LOG_INFO, "(voglperf) %s %p %lu\n", __FUNCTION__, dpy, window);
+
+    glinfo_evict_subwindows(dpy, window);
+    return (*orig_func)(dpy, window);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// XCloseDisplay interceptor
+//  Closing the display destroys its windows without XDestroyWindow calls.
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT int XCloseDisplay(Display *dpy)
+{
+    HOOK_FUNC(XCloseDisplay);
+    if (!orig_func)
+        return 0;
+
+    if (g_verbose)
+        syslog(LOG_INFO, "(voglperf) %s %p\n", __FUNCTION__, dpy);
+
+    glinfo_evict_display(dpy);
+    return (*orig_func)(dpy);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// glXGetProcAddressARB / glXGetProcAddress interceptors
+//----------------------------------------------------------------------------------------------------------------------
+#define GLX_GET_PROC_ADDRESS_HOOK(_func)                                                \
+    VOGL_API_EXPORT __GLXextFuncPtr GLAPIENTRY _func(const GLubyte *procname)           \
+    {                                                                                   \
+        HOOK_FUNC(_func);                                                               \
+        if (!orig_func)                                                                 \
+            return NULL;                                                                \
+                                                                                        \
+        if (procname)                                                                   \
+        {                                                                               \
+            hook_func_t ret = hook_find((const char *)procname, HOOK_GPA_GLX);          \
+            if (ret)                                                                    \
+                return (__GLXextFuncPtr)ret;                                            \
+        }                                                                               \
+                                                                                        \
+        return (*orig_func)(procname);                                                  \
+    }
+
+GLX_GET_PROC_ADDRESS_HOOK(glXGetProcAddressARB)
+GLX_GET_PROC_ADDRESS_HOOK(glXGetProcAddress)
+
+#undef GLX_GET_PROC_ADDRESS_HOOK
+
+//----------------------------------------------------------------------------------------------------------------------
+// eglSwapBuffers interceptor
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT EGLBoolean EGLAPIENTRY eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
+{
+    HOOK_FUNC(eglSwapBuffers);
+    if (!orig_func)
+        return EGL_FALSE;
+
+    voglperf_init();
+
+    if (g_verbose)
+    {
+        syslog(LOG_INFO, "(voglperf) %s %p %p\n", __PRETTY_FUNCTION__, dpy, surface);
+    }
+
+    swap_begin_t swap_begin;
+    voglperf_swap_begin(&swap_begin, SWAP_API_EGL, EGL_DPY(dpy), EGL_DRAWABLE(surface));
+
+    // Call real eglSwapBuffers function.
+    EGLBoolean ret = (*orig_func)(dpy, surface);
+
+    voglperf_swap_buffers(EGL_DPY(dpy), EGL_DRAWABLE(surface), &swap_begin);
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// eglSwapBuffersWithDamage interceptors
+//  These are extensions, so libEGL may not export them and the real ones come from eglGetProcAddress.
+//----------------------------------------------------------------------------------------------------------------------
+#define SWAP_BUFFERS_WITH_DAMAGE_HOOK(_func)                                                   \
+    VOGL_API_EXPORT EGLBoolean EGLAPIENTRY _func(EGLDisplay dpy, EGLSurface surface,           \
+                                                 const EGLint *rects, EGLint n_rects)          \
+    {                                                                                          \
+        HOOK_FUNC(_func);                                                                      \
+        if (!orig_func)                                                                        \
+            return EGL_FALSE;                                                                  \
+                                                                                               \
+        voglperf_init();                                                                       \
+                                                                                               \
+        if (g_verbose)                                                                         \
+            syslog(LOG_INFO, "(voglperf) %s %p %p %d\n", __FUNCTION__, dpy, surface, n_rects); \
+                                                                                               \
+        swap_begin_t swap_begin;                                                               \
+        voglperf_swap_begin(&swap_begin, SWAP_API_EGL, EGL_DPY(dpy), EGL_DRAWABLE(surface));   \
+                                                                                               \
+        EGLBoolean ret = (*orig_func)(dpy, surface, rects, n_rects);                           \
+                                                                                               \
+        voglperf_swap_buffers(EGL_DPY(dpy), EGL_DRAWABLE(surface), &swap_begin);               \
+        return ret;                                                                            \
+    }
+
+SWAP_BUFFERS_WITH_DAMAGE_HOOK(eglSwapBuffersWithDamageKHR)
+SWAP_BUFFERS_WITH_DAMAGE_HOOK(eglSwapBuffersWithDamageEXT)
+
+#undef SWAP_BUFFERS_WITH_DAMAGE_HOOK
+
+//----------------------------------------------------------------------------------------------------------------------
+// eglMakeCurrent interceptor
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT EGLBoolean EGLAPIENTRY eglMakeCurrent(EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx)
+{
+    HOOK_FUNC(eglMakeCurrent);
+    if (!orig_func)
+        return EGL_FALSE;
+
+    voglperf_init();
+
+    if (g_verbose)
     {
-        __GLXextFuncPtr ret = NULL;
+        syslog(LOG_INFO, "(voglperf) %s %p %p %p %p\n", __PRETTY_FUNCTION__, dpy, draw, read, ctx);
+    }
+
+    EGLBoolean ret = (*orig_func)(dpy, draw, read, ctx);
+    if (ret)
+        glinfo_make_current(EGL_DPY(dpy), EGL_DRAWABLE(draw), ctx);
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// eglDestroySurface interceptor
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT EGLBoolean EGLAPIENTRY eglDestroySurface(EGLDisplay dpy, EGLSurface surface)
+{
+    HOOK_FUNC(eglDestroySurface);
+    if (!orig_func)
+        return EGL_FALSE;
+
+    if (g_verbose)
+        syslog(LOG_INFO, "(voglperf) %s %p %p\n", __FUNCTION__, dpy, surface);
+
+    glinfo_evict(EGL_DPY(dpy), EGL_DRAWABLE(surface));
+    return (*orig_func)(dpy, surface);
+}
 
-        if (!strcmp((const char *)procname, "glXSwapBuffers"))
-            ret = (__GLXextFuncPtr)glXSwapBuffers;
-        else if (!strcmp((const char *)procname, "glXMakeCurrent"))
-            ret = (__GLXextFuncPtr)glXMakeCurrent;
+//----------------------------------------------------------------------------------------------------------------------
+// eglGetProcAddress interceptor
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT __eglMustCastToProperFunctionPointerType EGLAPIENTRY eglGetProcAddress(const char *procname)
+{
+    HOOK_FUNC(eglGetProcAddress);
+    if (!orig_func)
+        return NULL;
 
+    if (procname)
+    {
+        // Extension hooks like eglSwapBuffersWithDamageKHR only come back if the driver has the real thing.
+        hook_func_t ret = hook_find(procname, HOOK_GPA_EGL);
         if (ret)
-        {
-            syslog(LOG_INFO, "(voglperf) %s hooking %s.\n", __FUNCTION__, procname);
-            return ret;
-        }
+            return (__eglMustCastToProperFunctionPointerType)ret;
     }
 
-    return (*s_orig_func)(procname);
+    return (*orig_func)(procname);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -827,8 +5441,8 @@ static const char *get_calling_module_name()
 //----------------------------------------------------------------------------------------------------------------------
 VOGL_API_EXPORT void *dlopen(const char *pFile, int mode)
 {
-    HOOK_FUNC("dlopen", void *, const char *pFile, int mode);
-    if (!s_orig_func)
+    HOOK_FUNC(dlopen);
+    if (!orig_func)
         return NULL;
 
     if (pFile)
@@ -851,7 +5465,7 @@ VOGL_API_EXPORT void *dlopen(const char *pFile, int mode)
     }
 
     // Call real dlopen function.
-    return (*s_orig_func)(pFile, mode);
+    return (*orig_func)(pFile, mode);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -859,6 +5473,7 @@ VOGL_API_EXPORT void *dlopen(const char *pFile, int mode)
 //----------------------------------------------------------------------------------------------------------------------
 __attribute__((constructor)) static void vogl_perf_constructor_func()
 {
+    pthread_once(&g_hooks_once, hooks_init);
     voglperf_init();
 }
 
@@ -867,20 +5482,27 @@ __attribute__((constructor)) static void vogl_perf_constructor_func()
 //----------------------------------------------------------------------------------------------------------------------
 __attribute__((destructor)) static void vogl_perf_destructor_func()
 {
+    surface_stats_flush_hitches();
+
+    // Whatever a triggered capture has of its window is better than nothing.
+    voglperf_logfile_dump_check(vogl_get_time_ns(), 1);
+
     voglperf_logfile_close();
+    logfile_writer_stop();
 
     if (g_msqid != -1)
     {
-        struct mbuf_fps_t mbuf;
-
         // Let voglperfrun know we're exiting.
-        mbuf.mtype = MSGTYPE_FPS_NOTIFY;
-        mbuf.frame_count = (uint32_t)-1;
-
-        int ret = msgsnd(g_msqid, &mbuf, sizeof(mbuf) - sizeof(mbuf.mtype), IPC_NOWAIT);
+        int ret = process_notify(VOGLPERF_PROCESS_EXIT);
         if (ret == -1)
             syslog(LOG_ERR, "(voglperf) msgsnd failed: %d. %s\n", ret, strerror(errno));
 
         g_msqid = -1;
     }
+
+    if (g_frame_ring)
+    {
+        shmdt(g_frame_ring);
+        g_frame_ring = NULL;
+    }
 }
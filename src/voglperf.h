@@ -23,6 +23,48 @@
  *
  **************************************************************************/
 
+//----------------------------------------------------------------------------------------------------------------------
+// Wire format
+//  A 32-bit libvoglperf.so talks to a 64-bit voglperfrun and the other way around, so everything passed between
+//  them (message payloads and the shared memory frame ring) only uses fixed size types, keeps 64-bit fields 8 byte
+//  aligned and is padded out to a multiple of 8. Sizes are checked at the bottom of this file, so a layout that
+//  differs between the i386 and x86_64 builds doesn't compile.
+//
+//  Message payloads start with a voglperf_msg_header_t. msgsnd's long mtype is a different size on each and isn't
+//  part of them: voglperf_msg_pack puts the payload in a voglperf_msgbuf_t to send (mtype from voglperf_msg_mtype)
+//  and voglperf_msg_unpack checks and copies it back out. Fields are only ever added to the end of a payload. Receivers zero anything an older
+//  sender didn't fill in and ignore whatever a newer one added, and senders can leave off the unused end of a
+//  string. VOGLPERF_PROTOCOL_VERSION changes when that isn't enough.
+//
+//  Handshake: voglperfrun puts its version and VOGLPERF_CAP_* flags in the frame ring header, and each process's
+//  VOGLPERF_PROCESS_START message carries the hook's. Either side only uses a feature when both have it.
+//----------------------------------------------------------------------------------------------------------------------
+#define VOGLPERF_PROTOCOL_VERSION 1
+
+enum
+{
+    VOGLPERF_CAP_FRAME_RING = 0x1,  // Frame times through the shared memory ring.
+    VOGLPERF_CAP_CONTROL    = 0x2,  // Commands through the ring's control block.
+    VOGLPERF_CAP_DOORBELL   = 0x4,  // Wakes voglperfrun through VOGLPERF_DOORBELL_NAME.
+};
+#define VOGLPERF_CAPS (VOGLPERF_CAP_FRAME_RING | VOGLPERF_CAP_CONTROL | VOGLPERF_CAP_DOORBELL)
+
+struct voglperf_msg_header_t
+{
+    uint16_t version;   // Sender's VOGLPERF_PROTOCOL_VERSION.
+    uint16_t type;      // MSGTYPE_*.
+    uint32_t size;      // Payload bytes sent, this header included.
+};
+
+#define VOGLPERF_MSG_MAX (PATH_MAX + 64) // Largest payload.
+
+// What goes through msgsnd / msgrcv. mtext is bytes so it starts right after mtype on either architecture.
+struct voglperf_msgbuf_t
+{
+    long mtype;
+    char mtext[VOGLPERF_MSG_MAX];
+};
+
 enum
 {
     // _NOTIFY messages sent from hook to voglperfrun.
@@ -33,41 +75,382 @@ enum
     // Messages send from voglperfrun to hook.
     MSGTYPE_LOGFILE_START = 5,
     MSGTYPE_LOGFILE_STOP = 6,
-    MSGTYPE_OPTIONS = 7
+    MSGTYPE_OPTIONS = 7,
+    // More _NOTIFY messages from hook to voglperfrun.
+    MSGTYPE_HITCH_NOTIFY = 8,
+    // Write out the flight recorder (voglperfrun to hook) and the reply.
+    MSGTYPE_LOGFILE_DUMP = 9,
+    MSGTYPE_LOGFILE_DUMP_NOTIFY = 10
+};
+
+// msgsnd mtype of everything the hook sends, whatever its type, so voglperfrun reads it all back in the order it
+// was sent (a logfile stop and the start replacing it, say). Commands from voglperfrun are queued with mtype ==
+// type so the hook can pick each one out.
+#define VOGLPERF_MTYPE_NOTIFY 1000
+
+static inline long voglperf_msg_mtype(uint16_t type)
+{
+    switch (type)
+    {
+    case MSGTYPE_LOGFILE_START:
+    case MSGTYPE_LOGFILE_STOP:
+    case MSGTYPE_OPTIONS:
+    case MSGTYPE_LOGFILE_DUMP:
+        return type;
+    default:
+        return VOGLPERF_MTYPE_NOTIFY;
+    }
+}
+
+// Fills in payload's header and copies the first size bytes of it into msgbuf. Returns the length to msgsnd.
+static inline size_t voglperf_msg_pack(struct voglperf_msgbuf_t *msgbuf, uint16_t type, void *payload, size_t size)
+{
+    struct voglperf_msg_header_t *header = (struct voglperf_msg_header_t *)payload;
+
+    header->version = VOGLPERF_PROTOCOL_VERSION;
+    header->type = type;
+    header->size = (uint32_t)size;
+
+    msgbuf->mtype = voglperf_msg_mtype(type);
+    memcpy(msgbuf->mtext, payload, size);
+    return size;
+}
+
+// Copies a received message (len bytes from msgrcv) into payload, size bytes. Returns 0 if it isn't a type message
+// from a protocol version we understand.
+static inline int voglperf_msg_unpack(const struct voglperf_msgbuf_t *msgbuf, ssize_t len, uint16_t type, void *payload, size_t size)
+{
+    struct voglperf_msg_header_t header;
+
+    if ((len < (ssize_t)sizeof(header)) || (msgbuf->mtype != voglperf_msg_mtype(type)))
+        return 0;
+
+    memcpy(&header, msgbuf->mtext, sizeof(header));
+    if ((header.version != VOGLPERF_PROTOCOL_VERSION) || (header.type != type) || (header.size > (size_t)len))
+        return 0;
+
+    if (header.size > size)
+        header.size = (uint32_t)size;
+    memcpy(payload, msgbuf->mtext, header.size);
+    memset((char *)payload + header.size, 0, size - header.size);
+    return 1;
+}
+
+
+// Abstract unix datagram socket (msqid) voglperfrun sleeps on. The hook sends it a byte after every message it
+// queues so the launcher doesn't have to poll the message queue.
+#define VOGLPERF_DOORBELL_NAME "voglperf.doorbell.%d"
+
+// Process events (mbuf_pid_t.event). Every process libvoglperf.so ends up in reports these, including the wrappers
+// Steam launches games through and anything they fork or exec.
+enum
+{
+    VOGLPERF_PROCESS_START = 0, // Loaded, or forked from a process it was loaded in.
+    VOGLPERF_PROCESS_SWAP = 1,  // Swapped its first frame.
+    VOGLPERF_PROCESS_EXIT = 2
 };
 
 struct mbuf_pid_t
 {
-    long mtype; // MSGTYPE_PID
+    struct voglperf_msg_header_t header; // MSGTYPE_PID_NOTIFY
     uint64_t pid;
+    uint64_t ppid;
+    uint32_t event;     // VOGLPERF_PROCESS_*.
+    uint32_t caps;      // VOGLPERF_CAP_* this process can use.
+    char exe[256];      // Executable (/proc/self/exe), truncated to keep the message small.
 };
 
 struct mbuf_fps_t
 {
-    long mtype; // MSGTYPE_FPS
+    struct voglperf_msg_header_t header; // MSGTYPE_FPS_NOTIFY
+    uint32_t surface; // Surface (see voglperf_frame_t) and X drawable these stats are for.
+    uint32_t drawable;
     float fps;
     uint32_t frame_count;
     float frame_time;
     float frame_min;
     float frame_max;
+    uint32_t dropped; // Total frames dropped by logfile writer and frame ring.
+    float frame_p50;  // Frame time percentiles (ms) for this second.
+    float frame_p90;
+    float frame_p99;
+    float frame_p999;
+    float fps_low1;   // Average fps of the slowest frames making up 1% of the time.
+    float frame_cpu;  // Average app CPU, swap blocked and off CPU time per frame (ms).
+    float frame_swap;
+    float frame_off_cpu;
+    float frame_gpu;  // Average GPU time of frames timed this second (ms). 0 if --gputime is off.
+    float frame_limit; // Average time (ms) the frame limiter held each frame back. 0 if --fpslimit is off.
+    float limit_error; // Latest the frame limiter released a frame past its deadline this second (ms).
+    uint32_t hitches;  // Hitches (see mbuf_hitch_t) this second.
+    uint32_t msgs_dropped; // Total messages this process couldn't queue because voglperfrun fell behind.
+    uint32_t pid;      // Process that swapped. Every process numbers its surfaces from 0.
+};
+
+// Why a frame was counted as a hitch.
+enum
+{
+    VOGLPERF_HITCH_MEDIAN = 0x1,  // Longer than --hitch-factor times the rolling median frame time.
+    VOGLPERF_HITCH_BUDGET = 0x2,  // Longer than --hitch-ms.
+};
+
+#define VOGLPERF_HITCH_WINDOW_BEFORE 8  // Frames of context kept either side of a hitch.
+#define VOGLPERF_HITCH_WINDOW_AFTER 8
+#define VOGLPERF_HITCH_WINDOW (VOGLPERF_HITCH_WINDOW_BEFORE + 1 + VOGLPERF_HITCH_WINDOW_AFTER)
+
+struct mbuf_hitch_t
+{
+    struct voglperf_msg_header_t header; // MSGTYPE_HITCH_NOTIFY
+    uint64_t time;          // CLOCK_MONOTONIC time (ns) the hitch frame's swap completed.
+    uint32_t surface;
+    uint32_t frame_time;    // Hitch frame time (ns).
+    uint32_t median;        // Rolling median frame time (ns) before the hitch.
+    uint32_t reason;        // VOGLPERF_HITCH_* flags.
+    uint32_t cpu_time;      // Split of the hitch frame, see voglperf_frame_t.
+    uint32_t swap_time;
+    uint32_t window_before; // Frames in window before and after the hitch. The hitch is window[window_before].
+    uint32_t window_after;
+    uint32_t window[VOGLPERF_HITCH_WINDOW]; // Frame times (ns) around the hitch.
+    uint32_t pid;           // Process that swapped.
 };
 
 struct mbuf_logfile_start_t
 {
-    long mtype; // MSGTYPE_LOGFILE_START
+    struct voglperf_msg_header_t header; // MSGTYPE_LOGFILE_START and MSGTYPE_LOGFILE_START_NOTIFY
     uint64_t time;
     char logfile[PATH_MAX];
 };
 
 struct mbuf_logfile_stop_t
 {
-    long mtype; // MSGTYPE_LOGFILE_STOP
+    struct voglperf_msg_header_t header; // MSGTYPE_LOGFILE_STOP and MSGTYPE_LOGFILE_STOP_NOTIFY
+    char logfile[PATH_MAX];
+};
+
+#define VOGLPERF_FLIGHT_SECONDS_DEFAULT 60 // Seconds of frames libvoglperf.so keeps for "logfile dump".
+
+struct mbuf_logfile_dump_t
+{
+    struct voglperf_msg_header_t header; // MSGTYPE_LOGFILE_DUMP_NOTIFY (MSGTYPE_LOGFILE_DUMP sends an mbuf_logfile_start_t)
+    uint64_t frame_count;   // Frames written, 0 if there was nothing to dump or the file couldn't be written.
+    uint64_t time;          // Time (ns) the frames in the logfile cover.
     char logfile[PATH_MAX];
 };
 
 struct mbuf_options_t
 {
-    long mtype; // MSGTYPE_OPTIONS
+    struct voglperf_msg_header_t header; // MSGTYPE_OPTIONS
     uint16_t fpsshow;
     uint16_t verbose;
+    uint32_t fpslimit; // Frame rate cap, 0 for none.
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Frame ring
+//  Multiple producer / single consumer ring of frame timestamps. voglperfrun creates one in a SysV shared
+//  memory segment and hands the id to libvoglperf.so with --shmid. Any thread in the game can push a frame
+//  without locks or syscalls, and voglperfrun drains it in update_app_messages(). Each slot carries a
+//  sequence number (bounded MPMC queue from Dmitry Vyukov): producers claim a slot with a CAS on
+//  write_index and publish it by bumping the slot's seq, so the consumer never sees a half written frame.
+//----------------------------------------------------------------------------------------------------------------------
+#define VOGLPERF_FRAME_RING_SIZE (256 * 1024) // Number of frames. Must be a power of 2.
+
+struct voglperf_frame_t
+{
+    uint64_t time;      // CLOCK_MONOTONIC time (ns) the swap completed.
+    uint32_t cpu_time;  // Render thread CPU time (ns) from the previous swap completing to this swap starting.
+    uint32_t swap_time; // Time (ns) spent blocked in the real swap call.
+    uint32_t gpu_time;  // GPU time (ns) of the frames whose timer queries came back since the last swap (--gputime),
+                        // or 0. Queries take a few frames to come back, so this belongs to earlier frames.
+    uint32_t surface;   // Which dpy+drawable was swapped. Numbered from 0 in the order they first swap.
+    uint32_t limit_time; // Time (ns) the frame limiter (--fpslimit) held this frame back before the swap.
+    uint32_t hitch_median; // Rolling median frame time (ns) if this frame was a hitch, else 0.
+    uint32_t pid;       // Process that swapped. Every process libvoglperf.so is in shares the ring.
+    uint32_t gpu_frames; // Frames gpu_time adds up.
+};
+
+// Time between frames that the render thread wasn't running, swapping or held back by the frame limiter
+// (descheduled, waiting on locks, etc.)
+static inline uint64_t voglperf_frame_off_cpu(uint64_t time_frame, uint64_t cpu_time, uint64_t swap_time, uint64_t limit_time)
+{
+    uint64_t time_busy = cpu_time + swap_time + limit_time;
+
+    return (time_frame > time_busy) ? (time_frame - time_busy) : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Control block
+//  Commands from voglperfrun, in the frame ring's shared memory header. voglperfrun updates it as a seqlock (seq is
+//  odd while it's writing) and swap threads compare seq against the last one they applied with a single load each
+//  frame, so commands take effect on the next frame without any syscalls. Options are just the latest values.
+//  Logfile commands go in a small ring and get run in the order they were issued, so a start and stop between two
+//  frames or a couple of dumps all happen. Without the shared memory segment the same commands go through the
+//  message queue instead (MSGTYPE_LOGFILE_START etc.)
+//----------------------------------------------------------------------------------------------------------------------
+#define VOGLPERF_CONTROL_COMMANDS 16 // Commands voglperfrun can issue between two frames.
+
+struct voglperf_command_t
+{
+    uint32_t type;              // MSGTYPE_LOGFILE_START, MSGTYPE_LOGFILE_STOP or MSGTYPE_LOGFILE_DUMP.
+    uint32_t post;              // MSGTYPE_LOGFILE_DUMP: seconds to keep recording before writing it, 0 for now.
+    uint64_t pid;               // Process it's for (the one voglperfrun picked as rendering), 0 for any.
+    uint64_t seconds;           // Logfile length, or how much of the flight recorder to dump.
+    char logfile[PATH_MAX];
+};
+
+struct voglperf_control_t
+{
+    uint32_t seq;               // Odd while voglperfrun is updating the fields below.
+    uint32_t pad;
+    uint64_t pid;               // Process the options are for, 0 for any.
+
+    uint16_t fpsshow;           // Options (MSGTYPE_OPTIONS).
+    uint16_t verbose;
+    uint32_t fpslimit;
+    uint32_t options_count;     // Bumped each time they change.
+    uint32_t pad2;
+
+    uint64_t command_count;     // Commands issued so far. Command n is commands[n % VOGLPERF_CONTROL_COMMANDS].
+    struct voglperf_command_t commands[VOGLPERF_CONTROL_COMMANDS];
+};
+
+static inline void voglperf_control_write_begin(struct voglperf_control_t *control)
+{
+    __atomic_store_n(&control->seq, control->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void voglperf_control_write_end(struct voglperf_control_t *control)
+{
+    __atomic_store_n(&control->seq, control->seq + 1, __ATOMIC_RELEASE);
+}
+
+struct voglperf_frame_slot_t
+{
+    uint64_t seq;     // == index + 1 once the frame for index is written, index + size once it's read.
+    struct voglperf_frame_t frame;
 };
+
+#define VOGLPERF_FRAME_RING_MAGIC 0x676f7076 // "vpog"
+
+struct voglperf_frame_ring_t
+{
+    uint32_t magic;   // VOGLPERF_FRAME_RING_MAGIC.
+    uint16_t version; // VOGLPERF_PROTOCOL_VERSION and VOGLPERF_CAP_* of the voglperfrun that set it up.
+    uint16_t caps;
+    uint32_t size;    // Number of frames in ring (power of 2).
+    uint32_t pad;
+    uint64_t dropped; // Frames dropped by producers because ring was full.
+
+    // Producer and consumer indices live on their own cache lines.
+    uint64_t write_index __attribute__((aligned(64)));
+    uint64_t read_index __attribute__((aligned(64)));
+
+    struct voglperf_control_t control __attribute__((aligned(64)));
+
+    struct voglperf_frame_slot_t slots[] __attribute__((aligned(64)));
+};
+
+static inline size_t voglperf_frame_ring_bytes(uint32_t size)
+{
+    return sizeof(struct voglperf_frame_ring_t) + size * sizeof(struct voglperf_frame_slot_t);
+}
+
+static inline void voglperf_frame_ring_init(struct voglperf_frame_ring_t *ring, uint32_t size)
+{
+    uint32_t i;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->magic = VOGLPERF_FRAME_RING_MAGIC;
+    ring->version = VOGLPERF_PROTOCOL_VERSION;
+    ring->caps = VOGLPERF_CAPS;
+    ring->size = size;
+
+    for (i = 0; i < size; i++)
+        ring->slots[i].seq = i;
+}
+
+// Producer (any thread): returns 0 and bumps dropped count if the ring is full.
+static inline int voglperf_frame_ring_push(struct voglperf_frame_ring_t *ring, const struct voglperf_frame_t *frame)
+{
+    struct voglperf_frame_slot_t *slot;
+    uint64_t write_index = __atomic_load_n(&ring->write_index, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        slot = &ring->slots[write_index & (ring->size - 1)];
+
+        int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - write_index);
+        if (diff == 0)
+        {
+            // Slot is free. Claim it (on failure write_index is reloaded for us).
+            if (__atomic_compare_exchange_n(&ring->write_index, &write_index, write_index + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // Consumer hasn't read this slot from the last time around yet.
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        else
+        {
+            // Another producer claimed it first.
+            write_index = __atomic_load_n(&ring->write_index, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->frame = *frame;
+    __atomic_store_n(&slot->seq, write_index + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Consumer: copies up to count frames into frames and returns the number copied.
+static inline uint32_t voglperf_frame_ring_pop(struct voglperf_frame_ring_t *ring, struct voglperf_frame_t *frames, uint32_t count)
+{
+    uint64_t read_index = ring->read_index;
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        struct voglperf_frame_slot_t *slot = &ring->slots[(read_index + i) & (ring->size - 1)];
+
+        // Stop at the first slot a producer hasn't finished writing.
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != read_index + i + 1)
+            break;
+
+        frames[i] = slot->frame;
+        __atomic_store_n(&slot->seq, read_index + i + ring->size, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&ring->read_index, read_index + i, __ATOMIC_RELAXED);
+    return i;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Layout checks
+//  Everything above has to be the same size and layout in 32-bit and 64-bit builds (see Wire format).
+//----------------------------------------------------------------------------------------------------------------------
+#ifdef __cplusplus
+#define VOGLPERF_STATIC_ASSERT(_x) static_assert(_x, #_x)
+#else
+#define VOGLPERF_STATIC_ASSERT(_x) _Static_assert(_x, #_x)
+#endif
+
+VOGLPERF_STATIC_ASSERT(sizeof(struct voglperf_msg_header_t) == 8);
+VOGLPERF_STATIC_ASSERT(sizeof(struct mbuf_pid_t) == 288);
+VOGLPERF_STATIC_ASSERT(sizeof(struct mbuf_fps_t) == 96);
+VOGLPERF_STATIC_ASSERT(sizeof(struct mbuf_hitch_t) == 120);
+VOGLPERF_STATIC_ASSERT(sizeof(struct mbuf_logfile_start_t) == PATH_MAX + 16);
+VOGLPERF_STATIC_ASSERT(sizeof(struct mbuf_logfile_stop_t) == PATH_MAX + 8);
+VOGLPERF_STATIC_ASSERT(sizeof(struct mbuf_logfile_dump_t) == PATH_MAX + 24);
+VOGLPERF_STATIC_ASSERT(sizeof(struct mbuf_options_t) == 16);
+VOGLPERF_STATIC_ASSERT(sizeof(struct mbuf_logfile_dump_t) <= VOGLPERF_MSG_MAX);
+VOGLPERF_STATIC_ASSERT(sizeof(struct voglperf_frame_t) == 40);
+VOGLPERF_STATIC_ASSERT(sizeof(struct voglperf_frame_slot_t) == 48);
+VOGLPERF_STATIC_ASSERT(sizeof(struct voglperf_command_t) == PATH_MAX + 24);
+VOGLPERF_STATIC_ASSERT(sizeof(struct voglperf_control_t) == 40 + VOGLPERF_CONTROL_COMMANDS * (PATH_MAX + 24));
+VOGLPERF_STATIC_ASSERT(offsetof(struct voglperf_frame_ring_t, write_index) == 64);
+VOGLPERF_STATIC_ASSERT(offsetof(struct voglperf_frame_ring_t, read_index) == 128);
+VOGLPERF_STATIC_ASSERT(offsetof(struct voglperf_frame_ring_t, control) == 192);
+VOGLPERF_STATIC_ASSERT(offsetof(struct voglperf_frame_ring_t, slots) == 192 + ((sizeof(struct voglperf_control_t) + 63) & ~63));
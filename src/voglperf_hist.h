@@ -0,0 +1,159 @@
+/**************************************************************************
+ *
+ * Copyright 2013-2014 RAD Game Tools and Valve Software
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+//----------------------------------------------------------------------------------------------------------------------
+// Frame time histogram
+//  Fixed size log-linear (HDR style) histogram of nanosecond frame times. Values are bucketed in ~1us units.
+//  The first VOGLPERF_HIST_SUB buckets are exact, after that each power of two is split into
+//  VOGLPERF_HIST_SUB / 2 buckets, so every bucket is within ~1.6% of the values in it. Inserts are O(1),
+//  and histograms can be merged by adding bucket counts.
+//----------------------------------------------------------------------------------------------------------------------
+#define VOGLPERF_HIST_UNIT_SHIFT 10                         // 1024ns units.
+#define VOGLPERF_HIST_SUB_BITS 7
+#define VOGLPERF_HIST_SUB (1 << VOGLPERF_HIST_SUB_BITS)      // 128 exact buckets.
+#define VOGLPERF_HIST_HALF (VOGLPERF_HIST_SUB / 2)           // Buckets per power of two after that.
+#define VOGLPERF_HIST_MAX_SHIFT 24                          // Covers frames up to ~4.5 hours.
+#define VOGLPERF_HIST_BUCKETS ((VOGLPERF_HIST_MAX_SHIFT + 2) * VOGLPERF_HIST_HALF)
+
+struct voglperf_hist_t
+{
+    uint64_t count;             // Number of values.
+    uint64_t total;             // Sum of values (ns).
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[VOGLPERF_HIST_BUCKETS];
+};
+
+static inline void voglperf_hist_clear(struct voglperf_hist_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+    hist->min = (uint64_t)-1;
+}
+
+static inline uint32_t voglperf_hist_index(uint64_t value)
+{
+    uint64_t units = value >> VOGLPERF_HIST_UNIT_SHIFT;
+
+    if (units < VOGLPERF_HIST_SUB)
+        return (uint32_t)units;
+
+    // Shift so units lands in [HALF, SUB) and use the shift as the exponent.
+    uint32_t shift = (63 - __builtin_clzll(units)) - (VOGLPERF_HIST_SUB_BITS - 1);
+    if (shift > VOGLPERF_HIST_MAX_SHIFT)
+        return VOGLPERF_HIST_BUCKETS - 1;
+
+    return shift * VOGLPERF_HIST_HALF + (uint32_t)(units >> shift);
+}
+
+// Returns the middle of the range of values that land in bucket index.
+static inline uint64_t voglperf_hist_value(uint32_t index)
+{
+    if (index < VOGLPERF_HIST_SUB)
+        return ((uint64_t)index << VOGLPERF_HIST_UNIT_SHIFT) + (1 << (VOGLPERF_HIST_UNIT_SHIFT - 1));
+
+    uint32_t shift = index / VOGLPERF_HIST_HALF - 1;
+    uint64_t units = (uint64_t)(index - shift * VOGLPERF_HIST_HALF) << shift;
+
+    return (units << VOGLPERF_HIST_UNIT_SHIFT) + (1ULL << (shift + VOGLPERF_HIST_UNIT_SHIFT - 1));
+}
+
+static inline void voglperf_hist_add(struct voglperf_hist_t *hist, uint64_t value)
+{
+    hist->buckets[voglperf_hist_index(value)]++;
+    hist->count++;
+    hist->total += value;
+    if (value < hist->min)
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+static inline void voglperf_hist_merge(struct voglperf_hist_t *dst, const struct voglperf_hist_t *src)
+{
+    uint32_t i;
+
+    for (i = 0; i < VOGLPERF_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+
+    dst->count += src->count;
+    dst->total += src->total;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+// Value (ns) at or below which percentile (0-100) of the values fall.
+static inline uint64_t voglperf_hist_percentile(const struct voglperf_hist_t *hist, double percentile)
+{
+    uint32_t i;
+    uint64_t sum = 0;
+    uint64_t target = (uint64_t)(hist->count * percentile / 100.0 + 0.5);
+
+    if (!hist->count)
+        return 0;
+    if (!target)
+        target = 1;
+
+    for (i = 0; i < VOGLPERF_HIST_BUCKETS; i++)
+    {
+        sum += hist->buckets[i];
+        if (sum >= target)
+        {
+            // Don't report past the actual extremes.
+            uint64_t value = voglperf_hist_value(i);
+            return (value < hist->min) ? hist->min : (value > hist->max) ? hist->max : value;
+        }
+    }
+
+    return hist->max;
+}
+
+// Average fps of the slowest frames which add up to percent of the total time ("1% low" fps).
+static inline double voglperf_hist_low_fps(const struct voglperf_hist_t *hist, double percent)
+{
+    int32_t i;
+    double count = 0.0;
+    double time = 0.0;
+    double time_target = hist->total * percent / 100.0;
+
+    for (i = VOGLPERF_HIST_BUCKETS - 1; (i >= 0) && (time < time_target); i--)
+    {
+        if (!hist->buckets[i])
+            continue;
+
+        double value = (double)voglperf_hist_value(i);
+        double num = hist->buckets[i];
+
+        // Only take as many frames from this bucket as we need to hit the target.
+        if (time + num * value > time_target)
+            num = (time_target - time) / value;
+
+        count += num;
+        time += num * value;
+    }
+
+    return (time > 0.0) ? (count * 1000000000.0 / time) : 0.0;
+}
@@ -0,0 +1,148 @@
+/**************************************************************************
+ *
+ * Copyright 2013-2014 RAD Game Tools and Valve Software
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+//----------------------------------------------------------------------------------------------------------------------
+// Binary frame logfile (.vpl)
+//
+//   voglperf_log_header_t
+//   voglperf_log_block_t + column data
+//   ...
+//   voglperf_log_index_t * block_count
+//
+// Each block holds up to block_frames frames. Every channel set in the block's channel mask is stored as a
+// column of LEB128 varints, in channel order. Frame times are nanosecond deltas starting from the block's time_base, so any
+// block decodes on its own and readers can use the index to seek straight to a time range. The index and
+// final counts are written when the log is closed. If that never happened (game crashed) index_offset is
+// 0 and readers walk the block headers instead.
+//
+// All fields are explicitly sized and 8 byte aligned so 32 and 64-bit builds agree on the layout.
+//----------------------------------------------------------------------------------------------------------------------
+#define VOGLPERF_LOG_MAGIC "VOGLPLOG"
+#define VOGLPERF_LOG_VERSION 1
+#define VOGLPERF_LOG_BLOCK_MAGIC 0x4b4c4256 // "VBLK"
+#define VOGLPERF_LOG_BLOCK_FRAMES 4096
+#define VOGLPERF_LOG_EXTENSION ".vpl"
+
+// Comment line following hitch frames in csv logfiles: frame ms, rolling median ms.
+#define VOGLPERF_LOG_CSV_HITCH_FORMAT "# hitch: %.2fms, median %.2fms\n"
+
+// Timestamp sources (--clock). Both count nanoseconds of CLOCK_MONOTONIC, TSC times are calibrated against it.
+enum
+{
+    VOGLPERF_CLOCK_MONOTONIC = 0,       // clock_gettime(CLOCK_MONOTONIC).
+    VOGLPERF_CLOCK_TSC,                 // Invariant TSC read with rdtsc.
+    VOGLPERF_CLOCK_COUNT
+};
+
+static inline const char *voglperf_clock_name(uint32_t clock)
+{
+    return (clock == VOGLPERF_CLOCK_TSC) ? "tsc" : "monotonic";
+}
+
+enum
+{
+    VOGLPERF_LOG_CHANNEL_FRAME_TIME = 0, // Time (ns) since the previous frame in the log, from any surface.
+    VOGLPERF_LOG_CHANNEL_CPU_TIME,       // App CPU time (ns). See voglperf_frame_t.
+    VOGLPERF_LOG_CHANNEL_SWAP_TIME,      // Swap blocked time (ns).
+    VOGLPERF_LOG_CHANNEL_GPU_TIME,       // GPU time (ns) of a recent frame, 0 if none came back. See voglperf_frame_t.
+    VOGLPERF_LOG_CHANNEL_SURFACE,        // Surface id the frame was swapped on.
+    VOGLPERF_LOG_CHANNEL_LIMIT_TIME,     // Time (ns) the frame limiter held the frame. Only if it was on at open.
+    VOGLPERF_LOG_CHANNEL_HITCH_MEDIAN,   // Rolling median frame time (ns) for hitch frames, 0 for the rest.
+    VOGLPERF_LOG_CHANNEL_COUNT
+};
+
+struct voglperf_log_header_t
+{
+    char magic[8];              // VOGLPERF_LOG_MAGIC
+    uint32_t version;           // VOGLPERF_LOG_VERSION
+    uint32_t header_size;       // sizeof(voglperf_log_header_t). First block follows.
+    uint32_t channels;          // Mask of (1 << VOGLPERF_LOG_CHANNEL_*) logged.
+    uint32_t block_frames;      // Max frames per block.
+    uint64_t wall_time;         // time() when logfile was opened.
+    uint64_t time_start;        // CLOCK_MONOTONIC time (ns) frame times start from.
+    uint64_t frame_count;       // Total frames. Written on close.
+    uint64_t block_count;       // Entries in block index. Written on close.
+    uint64_t index_offset;      // File offset of block index. 0 if log wasn't closed.
+    char program[64];           // Name of program being logged.
+    uint64_t dropped;           // Frames lost because the hook ran out of buffer. Written on close.
+    uint32_t clock;             // VOGLPERF_CLOCK_* frame times were taken with.
+    uint32_t pad;
+    uint64_t tsc_hz;            // Calibrated TSC frequency if clock is VOGLPERF_CLOCK_TSC.
+};
+
+struct voglperf_log_block_t
+{
+    uint32_t magic;             // VOGLPERF_LOG_BLOCK_MAGIC
+    uint32_t frame_count;       // Frames in this block.
+    uint32_t channels;          // Mask of channels with columns in this block.
+    uint32_t data_size;         // Bytes of column data following this header.
+    uint64_t time_base;         // CLOCK_MONOTONIC time (ns) of frame before the first frame in this block.
+    uint64_t time_end;          // CLOCK_MONOTONIC time (ns) of the last frame in this block.
+};
+
+struct voglperf_log_index_t
+{
+    uint64_t time_base;         // Same as block time_base.
+    uint64_t time_end;          // Same as block time_end.
+    uint64_t offset;            // File offset of voglperf_log_block_t.
+    uint32_t frame_count;       // Frames in block.
+    uint32_t pad;
+};
+
+// Max bytes a varint encoded uint64_t can take.
+#define VOGLPERF_VARINT_MAX_BYTES 10
+
+static inline uint8_t *voglperf_varint_write(uint8_t *dst, uint64_t val)
+{
+    while (val >= 0x80)
+    {
+        *dst++ = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    *dst++ = (uint8_t)val;
+    return dst;
+}
+
+// Returns pointer past the varint or NULL if it runs past end.
+static inline const uint8_t *voglperf_varint_read(const uint8_t *src, const uint8_t *end, uint64_t *val)
+{
+    uint64_t ret = 0;
+    unsigned int shift = 0;
+
+    while ((src < end) && (shift < 64))
+    {
+        uint8_t byte = *src++;
+
+        ret |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *val = ret;
+            return src;
+        }
+        shift += 7;
+    }
+
+    return NULL;
+}
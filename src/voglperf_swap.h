@@ -0,0 +1,72 @@
+/**************************************************************************
+ *
+ * Copyright 2013-2014 RAD Game Tools and Valve Software
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+//----------------------------------------------------------------------------------------------------------------------
+// Swap accounting
+//  Internal interface between the GLX/EGL hooks in voglperf.c and the Vulkan layer in voglperf_vulkan.c. Every
+//  present, whatever API it came through, is bracketed by voglperf_swap_begin() and voglperf_swap_buffers() and
+//  ends up in the same frame ring, logfile and fps messages. Surfaces are keyed by a dpy+drawable pair: X display
+//  and GLX drawable, EGLDisplay and EGLSurface, or VkDevice and VkSwapchainKHR.
+//----------------------------------------------------------------------------------------------------------------------
+#ifndef VOGLPERF_SWAP_H
+#define VOGLPERF_SWAP_H
+
+#include <GL/glx.h>
+
+typedef enum swap_api_t
+{
+    SWAP_API_GLX,
+    SWAP_API_EGL,
+    SWAP_API_VULKAN,
+} swap_api_t;
+
+typedef struct swap_begin_t
+{
+    uint64_t time;                  // CLOCK_MONOTONIC before the swap.
+    uint64_t cpu;                   // CLOCK_THREAD_CPUTIME_ID before the swap.
+    uint64_t gpu_time;              // GPU time of frames that recently finished (--gputime) or 0.
+    uint32_t gpu_frames;            // Frames gpu_time adds up.
+    uint64_t limit_time;            // Time the frame limiter (--fpslimit) held this frame before the swap.
+    uint64_t limit_error;           // How late the limiter released it past its deadline.
+    swap_api_t api;
+    struct swap_thread_t *thread;
+    struct swap_surface_t *swap_surface;    // NULL if we couldn't track this surface.
+    int overlay_drawn;              // GL overlay went into this frame.
+} swap_begin_t;
+
+void voglperf_init();
+
+// Call right before and right after the real swap.
+void voglperf_swap_begin(swap_begin_t *swap_begin, swap_api_t api, Display *dpy, GLXDrawable drawable);
+void voglperf_swap_buffers(Display *dpy, GLXDrawable drawable, const swap_begin_t *swap_begin);
+
+// Returns 1 if this thread is in the middle of a swap we're timing, so a present it makes underneath (GL on
+// Vulkan, or our layer loaded twice) shouldn't be counted again.
+int voglperf_swapping();
+
+// dpy+drawable was destroyed. Drops it from the glinfo cache.
+void glinfo_evict(Display *dpy, GLXDrawable drawable);
+
+#endif // VOGLPERF_SWAP_H
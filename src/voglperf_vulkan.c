@@ -0,0 +1,430 @@
+/**************************************************************************
+ *
+ * Copyright 2013-2014 RAD Game Tools and Valve Software
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+//----------------------------------------------------------------------------------------------------------------------
+// Vulkan layer
+//  Implicit layer (see voglperf_layer.json.in) living in libvoglperf.so itself, so presents go through the same
+//  swap accounting as GLX and EGL swaps and show up in the frame ring, logfile and fps messages. Each
+//  VkSwapchainKHR is its own surface. The loader dlopens us by the path in the manifest; when we're also
+//  LD_PRELOADed that's the same copy, otherwise it's a fresh one that sets itself up on vkCreateInstance.
+//
+//  Only vkQueuePresentKHR is timed. GPU timer queries and the in-game overlay are GL only for now.
+//----------------------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vk_layer.h>
+
+#include "voglperf_swap.h"
+
+#define VOGL_API_EXPORT __attribute__((visibility("default")))
+
+#define VK_LAYER_MAX_PRESENT_SWAPCHAINS 8   // Swapchains timed per vkQueuePresentKHR. Rest are passed through.
+
+// Dispatchable handles (instances, physical devices, devices, queues) start with the loader's dispatch table
+// pointer, which is shared by everything created from the same instance or device.
+#define VK_DISPATCH_KEY(_handle) (*(void **)(_handle))
+
+// Surface keys for swap accounting. Non-dispatchable handles are 64-bit even in 32-bit builds, where we lose
+// the top bits. Drivers hand out pointers or small ids there, so that's fine.
+#define VK_DPY(_device) ((Display *)(_device))
+#define VK_DRAWABLE(_swapchain) ((GLXDrawable)(uintptr_t)(_swapchain))
+
+typedef struct vk_instance_t
+{
+    void *key;
+    int used;
+    struct vk_instance_t *next;
+    VkInstance instance;
+    PFN_vkGetInstanceProcAddr GetInstanceProcAddr;
+    PFN_vkDestroyInstance DestroyInstance;
+} vk_instance_t;
+
+typedef struct vk_device_t
+{
+    void *key;
+    int used;
+    struct vk_device_t *next;
+    VkDevice device;
+    PFN_vkGetDeviceProcAddr GetDeviceProcAddr;
+    PFN_vkDestroyDevice DestroyDevice;
+    PFN_vkQueuePresentKHR QueuePresentKHR;
+    PFN_vkDestroySwapchainKHR DestroySwapchainKHR;
+} vk_device_t;
+
+// Lists of every instance and device. Entries are only claimed or released under g_vk_lock, are never freed (a
+// destroyed one gets reused), and a key is published last, so presents can look up their device without locking.
+static pthread_mutex_t g_vk_lock = PTHREAD_MUTEX_INITIALIZER;
+static vk_instance_t *g_vk_instances = NULL;
+static vk_device_t *g_vk_devices = NULL;
+
+//----------------------------------------------------------------------------------------------------------------------
+// vk_instance_get
+//----------------------------------------------------------------------------------------------------------------------
+static vk_instance_t *vk_instance_get(void *key)
+{
+    vk_instance_t *inst;
+
+    for (inst = __atomic_load_n(&g_vk_instances, __ATOMIC_ACQUIRE); inst; inst = inst->next)
+    {
+        if (__atomic_load_n(&inst->key, __ATOMIC_ACQUIRE) == key)
+            return inst;
+    }
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// vk_instance_alloc
+//  Claims a free entry, growing the list if there isn't one. Returns NULL if we're out of memory.
+//----------------------------------------------------------------------------------------------------------------------
+static vk_instance_t *vk_instance_alloc()
+{
+    vk_instance_t *inst;
+
+    pthread_mutex_lock(&g_vk_lock);
+
+    for (inst = g_vk_instances; inst && inst->used; inst = inst->next)
+        ;
+    if (!inst && (inst = (vk_instance_t *)calloc(1, sizeof(*inst))))
+    {
+        inst->next = g_vk_instances;
+        __atomic_store_n(&g_vk_instances, inst, __ATOMIC_RELEASE);
+    }
+    if (inst)
+        inst->used = 1;
+
+    pthread_mutex_unlock(&g_vk_lock);
+    return inst;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// vk_instance_free
+//----------------------------------------------------------------------------------------------------------------------
+static void vk_instance_free(vk_instance_t *inst)
+{
+    pthread_mutex_lock(&g_vk_lock);
+    __atomic_store_n(&inst->key, NULL, __ATOMIC_RELEASE);
+    inst->used = 0;
+    pthread_mutex_unlock(&g_vk_lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// vk_device_get
+//----------------------------------------------------------------------------------------------------------------------
+static vk_device_t *vk_device_get(void *key)
+{
+    vk_device_t *dev;
+
+    for (dev = __atomic_load_n(&g_vk_devices, __ATOMIC_ACQUIRE); dev; dev = dev->next)
+    {
+        if (__atomic_load_n(&dev->key, __ATOMIC_ACQUIRE) == key)
+            return dev;
+    }
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// vk_device_alloc
+//  Claims a free entry, growing the list if there isn't one. Returns NULL if we're out of memory.
+//----------------------------------------------------------------------------------------------------------------------
+static vk_device_t *vk_device_alloc()
+{
+    vk_device_t *dev;
+
+    pthread_mutex_lock(&g_vk_lock);
+
+    for (dev = g_vk_devices; dev && dev->used; dev = dev->next)
+        ;
+    if (!dev && (dev = (vk_device_t *)calloc(1, sizeof(*dev))))
+    {
+        dev->next = g_vk_devices;
+        __atomic_store_n(&g_vk_devices, dev, __ATOMIC_RELEASE);
+    }
+    if (dev)
+        dev->used = 1;
+
+    pthread_mutex_unlock(&g_vk_lock);
+    return dev;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// vk_device_free
+//----------------------------------------------------------------------------------------------------------------------
+static void vk_device_free(vk_device_t *dev)
+{
+    pthread_mutex_lock(&g_vk_lock);
+    __atomic_store_n(&dev->key, NULL, __ATOMIC_RELEASE);
+    dev->used = 0;
+    pthread_mutex_unlock(&g_vk_lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_vkQueuePresentKHR
+//----------------------------------------------------------------------------------------------------------------------
+static VKAPI_ATTR VkResult VKAPI_CALL voglperf_vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR *pPresentInfo)
+{
+    uint32_t i;
+    swap_begin_t swap_begin[VK_LAYER_MAX_PRESENT_SWAPCHAINS];
+    vk_device_t *dev = vk_device_get(VK_DISPATCH_KEY(queue));
+
+    // Every device is created through us, so there's no next layer to hand this to if it isn't in the list.
+    if (!dev)
+        return VK_ERROR_DEVICE_LOST;
+
+    // Nested in a GL swap (zink) or another copy of this layer, which is already timing it.
+    if (voglperf_swapping())
+        return dev->QueuePresentKHR(queue, pPresentInfo);
+
+    uint32_t count = pPresentInfo->swapchainCount;
+    if (count > VK_LAYER_MAX_PRESENT_SWAPCHAINS)
+        count = VK_LAYER_MAX_PRESENT_SWAPCHAINS;
+
+    for (i = 0; i < count; i++)
+        voglperf_swap_begin(&swap_begin[i], SWAP_API_VULKAN, VK_DPY(dev->device), VK_DRAWABLE(pPresentInfo->pSwapchains[i]));
+
+    // Call real vkQueuePresentKHR function.
+    VkResult ret = dev->QueuePresentKHR(queue, pPresentInfo);
+
+    for (i = 0; i < count; i++)
+        voglperf_swap_buffers(VK_DPY(dev->device), VK_DRAWABLE(pPresentInfo->pSwapchains[i]), &swap_begin[i]);
+
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_vkDestroySwapchainKHR
+//----------------------------------------------------------------------------------------------------------------------
+static VKAPI_ATTR void VKAPI_CALL voglperf_vkDestroySwapchainKHR(VkDevice device, VkSwapchainKHR swapchain,
+                                                                const VkAllocationCallbacks *pAllocator)
+{
+    vk_device_t *dev = vk_device_get(VK_DISPATCH_KEY(device));
+
+    if (!dev)
+        return;
+
+    if (swapchain != VK_NULL_HANDLE)
+        glinfo_evict(VK_DPY(device), VK_DRAWABLE(swapchain));
+    dev->DestroySwapchainKHR(device, swapchain, pAllocator);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_vkDestroyDevice
+//----------------------------------------------------------------------------------------------------------------------
+static VKAPI_ATTR void VKAPI_CALL voglperf_vkDestroyDevice(VkDevice device, const VkAllocationCallbacks *pAllocator)
+{
+    if (device == VK_NULL_HANDLE)
+        return;
+
+    vk_device_t *dev = vk_device_get(VK_DISPATCH_KEY(device));
+    if (!dev)
+        return;
+
+    PFN_vkDestroyDevice destroy_device = dev->DestroyDevice;
+
+    vk_device_free(dev);
+
+    destroy_device(device, pAllocator);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_vkCreateDevice
+//----------------------------------------------------------------------------------------------------------------------
+static VKAPI_ATTR VkResult VKAPI_CALL voglperf_vkCreateDevice(VkPhysicalDevice physicalDevice, const VkDeviceCreateInfo *pCreateInfo,
+                                                             const VkAllocationCallbacks *pAllocator, VkDevice *pDevice)
+{
+    VkLayerDeviceCreateInfo *chain = (VkLayerDeviceCreateInfo *)pCreateInfo->pNext;
+
+    // Find the loader's link info for the next layer down.
+    while (chain && !((chain->sType == VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO) && (chain->function == VK_LAYER_LINK_INFO)))
+        chain = (VkLayerDeviceCreateInfo *)chain->pNext;
+
+    vk_instance_t *inst = vk_instance_get(VK_DISPATCH_KEY(physicalDevice));
+    if (!chain || !inst)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    PFN_vkGetInstanceProcAddr get_instance_proc_addr = chain->u.pLayerInfo->pfnNextGetInstanceProcAddr;
+    PFN_vkGetDeviceProcAddr get_device_proc_addr = chain->u.pLayerInfo->pfnNextGetDeviceProcAddr;
+    PFN_vkCreateDevice create_device = (PFN_vkCreateDevice)get_instance_proc_addr(inst->instance, "vkCreateDevice");
+    if (!create_device)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    // Claim our entry first: once the device exists we have to be able to dispatch for it.
+    vk_device_t *dev = vk_device_alloc();
+    if (!dev)
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    // Advance the link for the next layer.
+    chain->u.pLayerInfo = chain->u.pLayerInfo->pNext;
+
+    VkResult ret = create_device(physicalDevice, pCreateInfo, pAllocator, pDevice);
+    if (ret != VK_SUCCESS)
+    {
+        vk_device_free(dev);
+        return ret;
+    }
+
+    dev->device = *pDevice;
+    dev->GetDeviceProcAddr = get_device_proc_addr;
+    dev->DestroyDevice = (PFN_vkDestroyDevice)get_device_proc_addr(*pDevice, "vkDestroyDevice");
+    dev->QueuePresentKHR = (PFN_vkQueuePresentKHR)get_device_proc_addr(*pDevice, "vkQueuePresentKHR");
+    dev->DestroySwapchainKHR = (PFN_vkDestroySwapchainKHR)get_device_proc_addr(*pDevice, "vkDestroySwapchainKHR");
+    __atomic_store_n(&dev->key, VK_DISPATCH_KEY(*pDevice), __ATOMIC_RELEASE);
+    return VK_SUCCESS;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_vkDestroyInstance
+//----------------------------------------------------------------------------------------------------------------------
+static VKAPI_ATTR void VKAPI_CALL voglperf_vkDestroyInstance(VkInstance instance, const VkAllocationCallbacks *pAllocator)
+{
+    if (instance == VK_NULL_HANDLE)
+        return;
+
+    vk_instance_t *inst = vk_instance_get(VK_DISPATCH_KEY(instance));
+    if (!inst)
+        return;
+
+    PFN_vkDestroyInstance destroy_instance = inst->DestroyInstance;
+
+    vk_instance_free(inst);
+
+    destroy_instance(instance, pAllocator);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_vkCreateInstance
+//----------------------------------------------------------------------------------------------------------------------
+static VKAPI_ATTR VkResult VKAPI_CALL voglperf_vkCreateInstance(const VkInstanceCreateInfo *pCreateInfo,
+                                                               const VkAllocationCallbacks *pAllocator, VkInstance *pInstance)
+{
+    VkLayerInstanceCreateInfo *chain = (VkLayerInstanceCreateInfo *)pCreateInfo->pNext;
+
+    voglperf_init();
+
+    while (chain && !((chain->sType == VK_STRUCTURE_TYPE_LOADER_INSTANCE_CREATE_INFO) && (chain->function == VK_LAYER_LINK_INFO)))
+        chain = (VkLayerInstanceCreateInfo *)chain->pNext;
+    if (!chain)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    PFN_vkGetInstanceProcAddr get_instance_proc_addr = chain->u.pLayerInfo->pfnNextGetInstanceProcAddr;
+    PFN_vkCreateInstance create_instance = (PFN_vkCreateInstance)get_instance_proc_addr(VK_NULL_HANDLE, "vkCreateInstance");
+    if (!create_instance)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    // Without the next layer's vkGetInstanceProcAddr we can't dispatch anything for the instance, so claim our
+    //  entry before creating it.
+    vk_instance_t *inst = vk_instance_alloc();
+    if (!inst)
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    chain->u.pLayerInfo = chain->u.pLayerInfo->pNext;
+
+    VkResult ret = create_instance(pCreateInfo, pAllocator, pInstance);
+    if (ret != VK_SUCCESS)
+    {
+        vk_instance_free(inst);
+        return ret;
+    }
+
+    inst->instance = *pInstance;
+    inst->GetInstanceProcAddr = get_instance_proc_addr;
+    inst->DestroyInstance = (PFN_vkDestroyInstance)get_instance_proc_addr(*pInstance, "vkDestroyInstance");
+    __atomic_store_n(&inst->key, VK_DISPATCH_KEY(*pInstance), __ATOMIC_RELEASE);
+
+    syslog(LOG_INFO, "(voglperf) Vulkan layer enabled.\n");
+    return VK_SUCCESS;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_get_device_func
+//  Our device level hooks, or NULL.
+//----------------------------------------------------------------------------------------------------------------------
+static PFN_vkVoidFunction voglperf_get_device_func(const char *name)
+{
+    if (!strcmp(name, "vkQueuePresentKHR"))
+        return (PFN_vkVoidFunction)voglperf_vkQueuePresentKHR;
+    if (!strcmp(name, "vkDestroySwapchainKHR"))
+        return (PFN_vkVoidFunction)voglperf_vkDestroySwapchainKHR;
+    if (!strcmp(name, "vkDestroyDevice"))
+        return (PFN_vkVoidFunction)voglperf_vkDestroyDevice;
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_vkGetDeviceProcAddr
+//  Layer entrypoint. Named in the manifest instead of exported as vkGetDeviceProcAddr so we don't interpose on
+//  the app's own Vulkan calls when we're LD_PRELOADed.
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL voglperf_vkGetDeviceProcAddr(VkDevice device, const char *pName);
+
+VOGL_API_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL voglperf_vkGetDeviceProcAddr(VkDevice device, const char *pName)
+{
+    if (!pName)
+        return NULL;
+
+    if (!strcmp(pName, "vkGetDeviceProcAddr"))
+        return (PFN_vkVoidFunction)voglperf_vkGetDeviceProcAddr;
+
+    PFN_vkVoidFunction func = voglperf_get_device_func(pName);
+    if (func)
+        return func;
+
+    vk_device_t *dev = (device != VK_NULL_HANDLE) ? vk_device_get(VK_DISPATCH_KEY(device)) : NULL;
+    return dev ? dev->GetDeviceProcAddr(device, pName) : NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// voglperf_vkGetInstanceProcAddr
+//  Layer entrypoint.
+//----------------------------------------------------------------------------------------------------------------------
+VOGL_API_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL voglperf_vkGetInstanceProcAddr(VkInstance instance, const char *pName);
+
+VOGL_API_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL voglperf_vkGetInstanceProcAddr(VkInstance instance, const char *pName)
+{
+    if (!pName)
+        return NULL;
+
+    if (!strcmp(pName, "vkGetInstanceProcAddr"))
+        return (PFN_vkVoidFunction)voglperf_vkGetInstanceProcAddr;
+    if (!strcmp(pName, "vkGetDeviceProcAddr"))
+        return (PFN_vkVoidFunction)voglperf_vkGetDeviceProcAddr;
+    if (!strcmp(pName, "vkCreateInstance"))
+        return (PFN_vkVoidFunction)voglperf_vkCreateInstance;
+    if (!strcmp(pName, "vkDestroyInstance"))
+        return (PFN_vkVoidFunction)voglperf_vkDestroyInstance;
+    if (!strcmp(pName, "vkCreateDevice"))
+        return (PFN_vkVoidFunction)voglperf_vkCreateDevice;
+
+    PFN_vkVoidFunction func = voglperf_get_device_func(pName);
+    if (func)
+        return func;
+
+    vk_instance_t *inst = (instance != VK_NULL_HANDLE) ? vk_instance_get(VK_DISPATCH_KEY(instance)) : NULL;
+    return inst ? inst->GetInstanceProcAddr(instance, pName) : NULL;
+}
@@ -23,7 +23,6 @@
  *
  **************************************************************************/
 
-//$ TODO: Only msgsnd length of buffer when strings are involved.
 //$ TODO: limit text length in message field in index.html?
 
 #include <stdio.h>
@@ -36,6 +35,14 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/msg.h>
+#include <sys/shm.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stddef.h>
 
 #include <histedit.h>
 #include <pthread.h>
@@ -43,6 +50,8 @@
 #include <algorithm>
 
 #include "voglperf.h"
+#include "voglperf_log.h"
+#include "voglperf_hist.h"
 #include "voglutils.h"
 
 #define F_DRYRUN         0x00000001
@@ -53,8 +62,70 @@
 #define F_FPSSHOW        0x00000020
 #define F_DEBUGGERPAUSE  0x00000040
 #define F_LOGFILE        0x00000080
+#define F_LOGBINARY      0x00000100
+#define F_GPUTIME        0x00000200
+#define F_GLFINISH       0x00000400
+#define F_VULKAN         0x00000800
 #define F_QUIT           0x00010000
 
+// What woke up the main loop (epoll_event.data.u64).
+enum
+{
+    EVENT_WEBBY,    // Web server sockets (webby_get_fd).
+    EVENT_COMMAND,  // Editline thread added to thread_commands (command_fd).
+    EVENT_OUTPUT,   // Game output pipe.
+    EVENT_DOORBELL, // libvoglperf.so queued messages (doorbell_fd).
+    EVENT_PROCESS   // A process in the game's tree exited (process_t::pidfd).
+};
+
+// Where a game launch is at (run_data.state). Launches are driven from the main loop so commands keep working while
+// a slow title boots.
+enum
+{
+    GAME_STOPPED,
+    GAME_WAIT_PID,      // Launched, waiting for a process to load libvoglperf.so and report in.
+    GAME_WAIT_FRAME,    // Waiting for the first frame.
+    GAME_RUNNING
+};
+
+#define GAME_WAIT_PID_TIMEOUT 30 // Seconds to wait for the first process to report in.
+
+#define MAX_HITCHES 1024    // Hitch events kept for the "hitches" command.
+
+#define TRIGGER_PRE_DEFAULT 10  // Seconds captured before a trigger's condition started holding.
+#define TRIGGER_POST_DEFAULT 5  // Seconds captured after it fires.
+#define TRIGGER_STALL_SECONDS 2 // Rendering process is treated as hung after this long without an fps summary.
+
+// Values from the per-second fps summaries that trigger rules can test.
+enum
+{
+    TRIGGER_METRIC_FPS,
+    TRIGGER_METRIC_LOW1,
+    TRIGGER_METRIC_P50,
+    TRIGGER_METRIC_P90,
+    TRIGGER_METRIC_P99,
+    TRIGGER_METRIC_P999,
+    TRIGGER_METRIC_MAX,
+    TRIGGER_METRIC_HITCHES,
+    TRIGGER_METRIC_COUNT
+};
+
+static const struct trigger_metric_t
+{
+    const char *name;
+    const char *units;
+} g_trigger_metrics[TRIGGER_METRIC_COUNT] =
+{
+    { "fps"     , "fps" },
+    { "low1"    , "fps" },
+    { "p50"     , "ms"  },
+    { "p90"     , "ms"  },
+    { "p99"     , "ms"  },
+    { "p999"    , "ms"  },
+    { "max"     , "ms"  },
+    { "hitches" , ""    },
+};
+
 static struct voglperf_options_t
 {
     const char *name;
@@ -65,13 +136,17 @@ static struct voglperf_options_t
 } g_options[] =
 {
     { "logfile"        , 'l' , true,  F_LOGFILE       , "Frame time logging on."                       },
+    { "logbinary"      , 'b' , false, F_LOGBINARY     , "Write binary (" VOGLPERF_LOG_EXTENSION ") logfiles."          },
     { "verbose"        , 'v' , false, F_VERBOSE       , "Verbose output."                              },
     { "fpsprint"       , 'f' , false, F_FPSPRINT      , "Print fps summary every second."              },
-    { "fpsshow"        , 's' , false, F_FPSSHOW       , "Show fps in game."                            },
+    { "fpsshow"        , 's' , false, F_FPSSHOW       , "Show fps in game (GL 3.0 or GLES 3.0 overlay)."},
     { "dry-run"        , 'y' , true,  F_DRYRUN        , "Only echo commands which would be executed."  },
     { "ld-debug"       , 'd' , true,  F_LDDEBUGSPEW   , "Add LD_DEBUG=lib to game launch."             },
     { "xterm"          , 'x' , true,  F_XTERM         , "Launch game under xterm."                     },
     { "debugger-pause" , 'g' , true,  F_DEBUGGERPAUSE , "Pause the game in libvoglperf.so on startup." },
+    { "gputime"        , 't' , true,  F_GPUTIME       , "Time frames on the GPU with GL timer queries." },
+    { "glfinish"       , 'n' , true,  F_GLFINISH      , "glFinish after every swap (GPU sync baseline)." },
+    { "vulkan"         , 'k' , true,  F_VULKAN        , "Time Vulkan presents with the voglperf layer." },
 };
 
 struct voglperf_data_t
@@ -82,34 +157,199 @@ struct voglperf_data_t
         port = port_in;
 
         msqid = -1;
+        shmid = -1;
+        frame_ring = NULL;
+        epoll_fd = -1;
+        command_fd = -1;
+        doorbell_fd = -1;
         flags = 0;
-
+        fpslimit = 0;
+        clock = VOGLPERF_CLOCK_MONOTONIC;
+        hitch_factor = -1.0;
+        hitch_ms = 0.0;
+        flight_seconds = VOGLPERF_FLIGHT_SECONDS_DEFAULT;
+        trigger_pre = TRIGGER_PRE_DEFAULT;
+        trigger_post = TRIGGER_POST_DEFAULT;
+
+        run_data.state = GAME_STOPPED;
+        run_data.time_launch = 0;
+        run_data.time_first_frame = 0;
+        run_data.stop_pending = false;
+        run_data.stopping = false;
         run_data.pid = (uint64_t)-1;
         run_data.file = NULL;
         run_data.fileid = -1;
         run_data.is_local_file = false;
+        run_data.frames_dropped = 0;
+        run_data.time_start = 0;
+        run_data.hitch_count = 0;
+        run_data.capture_start = 0;
+        run_data.capture_end = 0;
+        run_data.time_fps = 0;
+        run_data.fps_surface = 0;
+        run_data.time_stalled = 0;
+        run_data.swap_count = 0;
+        run_data.render_pid = 0;
+        run_data.msgs_high = 0;
+        run_data.msgs_high_bytes = 0;
+        run_data.msgs_capacity = 0;
+        run_data.frames_high = 0;
+        run_data.msgs_dropped = 0;
+        run_data.high_water_warned = false;
+        run_data.msgs_rejected = 0;
+        surface = -1;
+        voglperf_hist_clear(&session_hist);
+        run_count = 0;
+        session_hitch_count = 0;
+
+        convert_time_start = 0.0;
+        convert_time_end = -1.0;
     }
 
     int msqid;              // Message queue id. Used to communicate with libvoglperf.so.
+    int shmid;              // Shared memory id of frame_ring.
+    voglperf_frame_ring_t *frame_ring; // Per-frame timestamps pushed by libvoglperf.so.
+    int epoll_fd;           // Everything the main loop waits on (EVENT_*).
+    int command_fd;         // eventfd signaled when thread_commands gets added to.
+    int doorbell_fd;        // Socket libvoglperf.so rings when it queues messages (VOGLPERF_DOORBELL_NAME).
     std::string ipaddr;     // Web IP address.
     std::string port;       // Web port.
 
     unsigned int flags;     // Command line flags (F_DRYRUN, F_XTERM, etc.)
+    uint32_t fpslimit;      // Frame rate cap (--fpslimit), 0 for none.
+    uint32_t clock;         // VOGLPERF_CLOCK_* libvoglperf.so takes timestamps with (--clock).
+    double hitch_factor;    // --hitch-factor for libvoglperf.so, < 0 for its default.
+    double hitch_ms;        // --hitch-ms for libvoglperf.so, 0 for none.
+    uint32_t flight_seconds; // Seconds of frames libvoglperf.so keeps for "logfile dump" (--flight-seconds), 0 for off.
     std::string logfile;    // Logfile name.
 
+    std::string convert_file;   // Binary logfile to convert to csv (--convert).
+    double convert_time_start;  // Seconds range to convert (--convert-range).
+    double convert_time_end;
+
     std::string gameid;     // Steam game id or local executable name.
     std::string game_args;  // Arguments for the "gameid" when it's a local executable.
 
     struct run_data_t
     {
-        uint64_t pid;           // Pid of running app (or -1).
+        uint32_t state;             // GAME_*.
+        uint64_t time_launch;       // Time (ns) the game was launched.
+        uint64_t time_first_frame;  // Time (ns) its first frame came in, 0 before.
+        bool stop_pending;          // "game stop" before anything reported in. Stopped once something does.
+        bool stopping;              // "game stop" sent. Processes that report in after it get stopped too.
+        uint64_t pid;           // Pid of running app (or -1). The rendering process once one has swapped.
         FILE *file;             // popen file handle.
         int fileid;             // popen file id.
         bool is_local_file;     // true if we're launching a local file, false if it's a steam game.
         std::string game_name;  // game name or "gameid##" if not known.
         std::string launch_cmd; // Game launch command.
+
+        // Stats for each surface (dpy + drawable) built from every frame drained from frame_ring.
+        struct frame_stats_t
+        {
+            frame_stats_t()
+            {
+                clear();
+            }
+
+            void clear()
+            {
+                drawable = 0;
+                frame_count = 0;
+                time_last = 0;
+                time_total = 0;
+                frame_min = (uint64_t)-1;
+                frame_max = 0;
+                time_cpu = 0;
+                time_swap = 0;
+                time_gpu = 0;
+                gpu_count = 0;
+                time_limit = 0;
+                voglperf_hist_clear(&hist);
+            }
+
+            uint32_t drawable;      // X drawable (from fps messages).
+            uint64_t frame_count;   // Frame times received.
+            uint64_t time_last;     // Timestamp of last frame (ns).
+            uint64_t time_total;    // Sum of frame times (ns).
+            uint64_t frame_min;     // Shortest frame (ns).
+            uint64_t frame_max;     // Longest frame (ns).
+            uint64_t time_cpu;      // Sum of app CPU times (ns).
+            uint64_t time_swap;     // Sum of swap blocked times (ns).
+            uint64_t time_gpu;      // Sum of GPU times (ns) and frames which had one.
+            uint64_t gpu_count;
+            uint64_t time_limit;    // Sum of times (ns) the frame limiter held frames.
+            voglperf_hist_t hist;   // Frame time histogram for this run.
+        };
+        std::vector<frame_stats_t> surfaces;
+        uint64_t frames_dropped;    // Frames the hook dropped because the ring was full.
+        uint64_t time_start;        // Timestamp (ns) of the first frame, hitch times are relative to it.
+        uint64_t hitch_count;       // Hitches this run.
+        uint64_t capture_start;     // CLOCK_MONOTONIC time (ns) a triggered capture starts from.
+        uint64_t capture_end;       // Time (ns) to dump the triggered capture, 0 if there isn't one pending.
+        std::string capture_logfile; // Logfile the game writes the capture to itself once its window is up (or it
+                                     //  exits), empty if we dump it at capture_end. Cleared once it's written.
+        uint64_t time_fps;          // Time (ns) the latest fps summary from the rendering process came in, 0 for none.
+        uint32_t fps_surface;       // Surface it was for.
+        uint64_t time_stalled;      // Time (ns) since it that's been counted against triggers as hung.
+
+        // Every process libvoglperf.so has reported in from this run: the game, the wrappers it was launched through
+        // and anything they forked or exec'd.
+        struct process_t
+        {
+            uint64_t pid;
+            uint64_t ppid;
+            std::string exe;
+            uint32_t swap_order;    // Order processes first swapped in, from 1. 0 if it hasn't swapped.
+            int pidfd;              // Readable once it exits, -1 if pidfds aren't supported.
+            uint32_t caps;          // VOGLPERF_CAP_* it told us it's using.
+            bool exited;
+        };
+        std::vector<process_t> processes;
+        uint32_t swap_count;        // Processes that have swapped.
+        uint64_t render_pid;        // Process we've picked as the one rendering, 0 if none has swapped yet.
+
+        // High-water marks: the most messages (and bytes of msgs_capacity) seen waiting in the message queue and
+        //  frames waiting in frame_ring when they were drained.
+        uint64_t msgs_high;
+        uint64_t msgs_high_bytes;
+        uint64_t msgs_capacity;
+        uint64_t frames_high;
+        uint32_t msgs_dropped;      // Messages libvoglperf.so couldn't queue because the queue was full.
+        bool high_water_warned;
+        uint32_t msgs_rejected;     // Messages from a libvoglperf.so with a different VOGLPERF_PROTOCOL_VERSION.
     } run_data;
 
+    int surface;            // Surface to show stats for (-1 for all).
+
+    voglperf_hist_t session_hist; // Frame times from every finished run merged together.
+
+    struct hitch_t
+    {
+        uint32_t run;               // Which launch this session it came from, from 1.
+        double time;                // Seconds since the run's first frame.
+        mbuf_hitch_t mbuf;
+    };
+    std::vector<hitch_t> hitches;   // Last MAX_HITCHES hitches this session, oldest first.
+    uint32_t run_count;             // Games launched this session.
+    uint64_t session_hitch_count;   // Every hitch this session, including ones no longer in hitches.
+
+    // Capture rules (--trigger, "trigger add"). Each one fires once its condition has held for its number of
+    // seconds in a row on a surface (a hung game holding fps < anything, etc.), and the flight recorder around it
+    // gets dumped to a logfile.
+    struct trigger_t
+    {
+        uint32_t metric;            // TRIGGER_METRIC_*.
+        bool greater;               // Fires while metric > value, otherwise metric < value.
+        double value;
+        uint32_t seconds;           // Seconds in a row the condition has to hold.
+        uint64_t fired;             // Times it's fired this session.
+        std::vector<uint64_t> held; // Time (ns) the condition has held for in a row, per surface.
+    };
+    std::vector<trigger_t> triggers;
+    uint32_t trigger_pre;           // Seconds before the condition started holding to capture (--trigger-window).
+    uint32_t trigger_post;          // Seconds after it fires to capture.
+
     // Commands from user.
     std::vector<std::string> commands;
 
@@ -121,6 +361,107 @@ struct voglperf_data_t
     std::vector<std::string> thread_commands;
 };
 
+//----------------------------------------------------------------------------------------------------------------------
+// get_time_ns
+//  CLOCK_MONOTONIC, same as the frame timestamps from libvoglperf.so.
+//----------------------------------------------------------------------------------------------------------------------
+static uint64_t get_time_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// event_add
+//  Wake the main loop up when fd is readable.
+//----------------------------------------------------------------------------------------------------------------------
+static bool event_add(voglperf_data_t &data, int fd, uint64_t event)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = event;
+    if (epoll_ctl(data.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        webby_ws_printf("WARNING: epoll_ctl() failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// get_trigger_str
+//----------------------------------------------------------------------------------------------------------------------
+static std::string get_trigger_str(const voglperf_data_t::trigger_t &trigger)
+{
+    const trigger_metric_t &metric = g_trigger_metrics[trigger.metric];
+
+    return string_format("%s %c %g%s for %us", metric.name, trigger.greater ? '>' : '<', trigger.value,
+                         (metric.units[0] == 'm') ? metric.units : "", trigger.seconds);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// parse_trigger
+//  Rules look like "p99 > 33ms for 2s", "fps<45:3" or "hitches > 0". Units and the for/over are optional,
+//  seconds default to 1.
+//----------------------------------------------------------------------------------------------------------------------
+static bool parse_trigger(const std::string &rule, voglperf_data_t::trigger_t &trigger)
+{
+    std::string str;
+
+    for (size_t i = 0; i < rule.size(); i++)
+    {
+        if (!isspace(rule[i]))
+            str += tolower(rule[i]);
+    }
+
+    size_t op = str.find_first_of("<>");
+    if ((op == std::string::npos) || !op)
+        return false;
+
+    std::string name = str.substr(0, op);
+    if (name == "p99.9")
+        name = "p999";
+
+    trigger.metric = TRIGGER_METRIC_COUNT;
+    for (uint32_t i = 0; i < TRIGGER_METRIC_COUNT; i++)
+    {
+        if (name == g_trigger_metrics[i].name)
+            trigger.metric = i;
+    }
+    if (trigger.metric == TRIGGER_METRIC_COUNT)
+        return false;
+
+    const char *ptr = str.c_str() + op + 1;
+    char *end = NULL;
+
+    trigger.greater = (str[op] == '>');
+    trigger.value = strtod(ptr, &end);
+    if (end == ptr)
+        return false;
+
+    // Skip units and "for" / "over" to get to the seconds.
+    ptr = end;
+    while (isalpha(*ptr) || (*ptr == ':'))
+        ptr++;
+
+    trigger.seconds = 1;
+    if (*ptr)
+    {
+        long seconds = strtol(ptr, &end, 10);
+
+        if ((end == ptr) || (seconds <= 0) || (seconds > 3600) || (*end && strcmp(end, "s")))
+            return false;
+        trigger.seconds = (uint32_t)seconds;
+    }
+
+    trigger.fired = 0;
+    trigger.held.clear();
+    return true;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // parse_options
 //----------------------------------------------------------------------------------------------------------------------
@@ -158,6 +499,55 @@ static error_t parse_options(int key, char *arg, struct argp_state *state)
         }
         break;
 
+    case 'c':
+        arguments->convert_file = arg;
+        break;
+
+    case 'm':
+        arguments->fpslimit = (uint32_t)std::max(atoi(arg), 0);
+        break;
+
+    case 'K':
+        arguments->hitch_factor = std::max(atof(arg), 0.0);
+        break;
+
+    case 'B':
+        arguments->hitch_ms = std::max(atof(arg), 0.0);
+        break;
+
+    case 'F':
+        arguments->flight_seconds = (uint32_t)std::max(atoi(arg), 0);
+        break;
+
+    case 'T':
+    {
+        voglperf_data_t::trigger_t trigger;
+
+        if (!parse_trigger(arg, trigger))
+            errorf("ERROR: Invalid --trigger '%s'. Expected METRIC < or > VALUE [SECONDS].\n", arg);
+        arguments->triggers.push_back(trigger);
+        break;
+    }
+
+    case 'W':
+        if (sscanf(arg, "%u:%u", &arguments->trigger_pre, &arguments->trigger_post) != 2)
+            errorf("ERROR: Invalid --trigger-window '%s'. Expected PRE:POST seconds.\n", arg);
+        break;
+
+    case 'o':
+        if (!strcmp(arg, voglperf_clock_name(VOGLPERF_CLOCK_TSC)))
+            arguments->clock = VOGLPERF_CLOCK_TSC;
+        else if (!strcmp(arg, voglperf_clock_name(VOGLPERF_CLOCK_MONOTONIC)))
+            arguments->clock = VOGLPERF_CLOCK_MONOTONIC;
+        else
+            errorf("ERROR: Invalid --clock '%s'. Expected monotonic or tsc.\n", arg);
+        break;
+
+    case 'r':
+        if (sscanf(arg, "%lf:%lf", &arguments->convert_time_start, &arguments->convert_time_end) < 1)
+            errorf("ERROR: Invalid --convert-range '%s'. Expected START[:END] seconds.\n", arg);
+        break;
+
     case '?':
         printf("\nUsage:\n");
         printf("  %s [options] [SteamGameID | ExecutableName]\n", program_invocation_short_name);
@@ -173,10 +563,13 @@ static error_t parse_options(int key, char *arg, struct argp_state *state)
 
         printf("\n");
         printf("To view frametime graph with gnpulot:\n");
-        printf("  gnuplot -p -e 'set terminal wxt size 1280,720;set ylabel \"milliseconds\";set yrange [0:100]; plot \"FILENAME\" with lines'\n");
+        printf("  gnuplot -p -e 'set terminal wxt size 1280,720;set ylabel \"milliseconds\";set yrange [0:100];set datafile separator \",\"; plot \"FILENAME\" using 1 with lines'\n");
         printf("\n");
         printf("Create frametime graph png file:\n");
-        printf("  gnuplot -p -e 'set output \"blah.png\";set terminal pngcairo size 1280,720 enhanced;set ylabel \"milliseconds\";set yrange [0:100]; plot \"FILENAME\" with lines'\n");
+        printf("  gnuplot -p -e 'set output \"blah.png\";set terminal pngcairo size 1280,720 enhanced;set ylabel \"milliseconds\";set yrange [0:100];set datafile separator \",\"; plot \"FILENAME\" using 1 with lines'\n");
+        printf("\n");
+        printf("Convert binary logfile to csv for gnuplot:\n");
+        printf("  %s --convert=FILENAME%s [--convert-range=START:END]\n", program_invocation_short_name, VOGLPERF_LOG_EXTENSION);
 
         exit(0);
 
@@ -232,6 +625,7 @@ static void update_app_output(voglperf_data_t &data, bool close_pipe = false)
 
     if (close_pipe)
     {
+        epoll_ctl(data.epoll_fd, EPOLL_CTL_DEL, data.run_data.fileid, NULL);
         pclose(data.run_data.file);
         data.run_data.file = NULL;
         data.run_data.fileid = -1;
@@ -317,17 +711,31 @@ static bool game_start_init_launch_cmd(voglperf_data_t &data)
     std::string LD_PRELOAD = get_ld_preload_str("./libvoglperf32.so", "./libvoglperf64.so", !!(data.flags & F_LDDEBUGSPEW));
     webby_ws_printf("\n%s\n", LD_PRELOAD.c_str());
 
+    // Point the Vulkan loader at our implicit layer and switch it on.
+    if (data.flags & F_VULKAN)
+    {
+        std::string vulkan_layer = get_vulkan_layer_str();
+
+        webby_ws_printf("%s\n", vulkan_layer.c_str());
+        if (!vulkan_layer.empty())
+            LD_PRELOAD += " " + vulkan_layer;
+    }
+
     // set up VOGLPERF_CMD_LINE string
     std::string VOGL_CMD_LINE = "VOGLPERF_CMD_LINE=\"";
 
     // Hand out our message queue id so we can get framerate data back, etc.
     VOGL_CMD_LINE += string_format("--msqid=%u ", data.msqid);
 
+    // Shared memory frame ring so we get every frame time.
+    if (data.frame_ring)
+        VOGL_CMD_LINE += string_format("--shmid=%u ", data.shmid);
+
     // When the logfile starts, we should get a message and it will record the name here.
     data.logfile = "";
     if (data.flags & F_LOGFILE)
     {
-        std::string logfile = get_logfile_name(data.run_data.game_name);
+        std::string logfile = get_logfile_name(data.run_data.game_name, !!(data.flags & F_LOGBINARY));
         VOGL_CMD_LINE += "--logfile='" + logfile + "'";
     }
 
@@ -337,6 +745,20 @@ static bool game_start_init_launch_cmd(voglperf_data_t &data)
         VOGL_CMD_LINE += " --debugger-pause";
     if (data.flags & F_VERBOSE)
         VOGL_CMD_LINE += " --verbose";
+    if (data.flags & F_GPUTIME)
+        VOGL_CMD_LINE += " --gputime";
+    if (data.flags & F_GLFINISH)
+        VOGL_CMD_LINE += " --glfinish";
+    if (data.fpslimit)
+        VOGL_CMD_LINE += string_format(" --fpslimit=%u", data.fpslimit);
+    if (data.clock != VOGLPERF_CLOCK_MONOTONIC)
+        VOGL_CMD_LINE += string_format(" --clock=%s", voglperf_clock_name(data.clock));
+    if (data.hitch_factor >= 0.0)
+        VOGL_CMD_LINE += string_format(" --hitch-factor=%g", data.hitch_factor);
+    if (data.hitch_ms > 0.0)
+        VOGL_CMD_LINE += string_format(" --hitch-ms=%g", data.hitch_ms);
+    if (data.flight_seconds != VOGLPERF_FLIGHT_SECONDS_DEFAULT)
+        VOGL_CMD_LINE += string_format(" --flight-seconds=%u", data.flight_seconds);
 
     VOGL_CMD_LINE += "\"";
 
@@ -371,32 +793,61 @@ static bool game_start_init_launch_cmd(voglperf_data_t &data)
     return true;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// process_signal
+//  Through its pidfd when we have one, so a recycled pid can't get it.
+//----------------------------------------------------------------------------------------------------------------------
+static void process_signal(const voglperf_data_t::run_data_t::process_t &process, int sig)
+{
+    int ret = (process.pidfd != -1) ? (int)syscall(SYS_pidfd_send_signal, process.pidfd, sig, NULL, 0) :
+                                      kill((pid_t)process.pid, sig);
+
+    webby_ws_printf("signal(%" PRIu64 ", %s): %s\n", process.pid, strsignal(sig), (ret ? strerror(errno) : "Success"));
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // game_stop
 //----------------------------------------------------------------------------------------------------------------------
 static void game_stop(voglperf_data_t &data)
 {
-    if (data.run_data.pid == (uint64_t)-1)
+    if (data.run_data.state == GAME_STOPPED)
     {
         webby_ws_printf("ERROR: Game not running.\n");
         return;
     }
+    if (data.run_data.state == GAME_WAIT_PID)
+    {
+        webby_ws_printf("Game hasn't started yet, stopping it once it does...\n");
+        data.run_data.stop_pending = true;
+        return;
+    }
 
     webby_ws_printf("Exiting game...\n");
 
-    int ret = kill(data.run_data.pid, SIGTERM);
-    webby_ws_printf("signal(%" PRIu64 ", SIGTERM): %s\n", data.run_data.pid,
-                    (ret ? strerror(errno) : "Success"));
+    // The rendering process and everything else in the tree, so neither the game nor the wrappers it was launched
+    //  through are left running.
+    data.run_data.stopping = true;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = 0; i < data.run_data.processes.size(); i++)
+        {
+            const voglperf_data_t::run_data_t::process_t &process = data.run_data.processes[i];
+
+            if (!process.exited && ((process.pid == data.run_data.render_pid) == (pass == 0)))
+                process_signal(process, SIGTERM);
+        }
+    }
 
     //$ TODO: Send SIGKILL if the above didn't work?
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 // game_start
+//  Launches the game. update_game_launch takes it from there.
 //----------------------------------------------------------------------------------------------------------------------
 static void game_start(voglperf_data_t &data)
 {
-    if (data.run_data.pid != (uint64_t)-1)
+    if (data.run_data.state != GAME_STOPPED)
     {
         webby_ws_printf("ERROR: Game already running.\n");
         return;
@@ -413,7 +864,41 @@ static void game_start(voglperf_data_t &data)
     if (data.flags & (F_DRYRUN | F_QUIT))
         return;
 
+    // Start with an empty frame ring and fresh stats for this run.
+    if (data.frame_ring)
+        voglperf_frame_ring_init(data.frame_ring, VOGLPERF_FRAME_RING_SIZE);
+    data.run_data.surfaces.clear();
+    data.run_data.frames_dropped = 0;
+    data.run_data.time_start = 0;
+    data.run_data.hitch_count = 0;
+    data.run_data.capture_start = 0;
+    data.run_data.capture_end = 0;
+    data.run_data.capture_logfile.clear();
+    data.run_data.time_fps = 0;
+    data.run_data.time_stalled = 0;
+    for (size_t i = 0; i < data.run_data.processes.size(); i++)
+    {
+        if (data.run_data.processes[i].pidfd != -1)
+            close(data.run_data.processes[i].pidfd);
+    }
+    data.run_data.processes.clear();
+    data.run_data.swap_count = 0;
+    data.run_data.render_pid = 0;
+    data.run_data.time_first_frame = 0;
+    data.run_data.stop_pending = false;
+    data.run_data.stopping = false;
+    data.run_data.msgs_high = 0;
+    data.run_data.msgs_high_bytes = 0;
+    data.run_data.frames_high = 0;
+    data.run_data.msgs_dropped = 0;
+    data.run_data.high_water_warned = false;
+    data.run_data.msgs_rejected = 0;
+    for (size_t i = 0; i < data.triggers.size(); i++)
+        data.triggers[i].held.clear();
+    data.run_count++;
+
     // Launch game.
+    data.run_data.time_launch = get_time_ns();
     data.run_data.file = popen((data.run_data.launch_cmd + " 2>&1").c_str(), "r");
     if (!data.run_data.file)
     {
@@ -424,57 +909,48 @@ static void game_start(voglperf_data_t &data)
     // Set FILE to non-blocking.
     data.run_data.fileid = fileno(data.run_data.file);
     fcntl(data.run_data.fileid, F_SETFL, O_NONBLOCK);
+    event_add(data, data.run_data.fileid, EVENT_OUTPUT);
 
-    // Grab app output.
-    update_app_output(data);
-
-    // Try to get the MSGTYPE_PID message for ~ 30 seconds.
-    int time = 30000;
-
+    data.run_data.state = GAME_WAIT_PID;
     webby_ws_printf("Waiting for child process to start...\n");
-    while ((time >= 0) && !(data.flags & F_QUIT))
-    {
-        struct mbuf_pid_t mbuf;
-
-        usleep(500 * 1000);
-        time -= 500;
-
-        if (msgrcv(data.msqid, &mbuf, sizeof(mbuf), MSGTYPE_PID_NOTIFY, IPC_NOWAIT) != -1)
-        {
-            data.run_data.pid = mbuf.pid;
-            break;
-        }
-
-        // Grab app output.
-        update_app_output(data);
+}
 
-        // Check for user typing quit command.
-        webby_update(&data.commands, NULL);
-        for (size_t i = 0; i < data.commands.size(); i++)
-        {
-            if (data.commands[i] == "quit" || data.commands[i] == "q" || data.commands[i] == "exit")
-            {
-                data.flags |= F_QUIT;
-                break;
-            }
-        }
-    }
+//----------------------------------------------------------------------------------------------------------------------
+// get_hist_summary_str
+//----------------------------------------------------------------------------------------------------------------------
+static std::string get_hist_summary_str(const voglperf_hist_t &hist)
+{
+    return string_format("percentiles p50:%.2fms p90:%.2fms p99:%.2fms p99.9:%.2fms 1%%low:%.2ffps",
+                         voglperf_hist_percentile(&hist, 50.0) / 1000000.0,
+                         voglperf_hist_percentile(&hist, 90.0) / 1000000.0,
+                         voglperf_hist_percentile(&hist, 99.0) / 1000000.0,
+                         voglperf_hist_percentile(&hist, 99.9) / 1000000.0,
+                         voglperf_hist_low_fps(&hist, 1.0));
+}
 
-    if (data.run_data.pid == (uint64_t)-1)
+//----------------------------------------------------------------------------------------------------------------------
+// get_hitch_str
+//  One line describing a hitch, with the frames around it if window is set.
+//----------------------------------------------------------------------------------------------------------------------
+static std::string get_hitch_str(const voglperf_data_t::hitch_t &hitch, bool window)
+{
+    const mbuf_hitch_t &mbuf = hitch.mbuf;
+    std::string str = string_format("run %u %.2fs surface %u: %.2fms (%.1fx median %.2fms%s) cpu:%.2fms swap:%.2fms",
+                                    hitch.run, hitch.time, mbuf.surface, mbuf.frame_time / 1000000.0,
+                                    mbuf.median ? (double)mbuf.frame_time / mbuf.median : 0.0, mbuf.median / 1000000.0,
+                                    (mbuf.reason & VOGLPERF_HITCH_BUDGET) ? ", over budget" : "",
+                                    mbuf.cpu_time / 1000000.0, mbuf.swap_time / 1000000.0);
+
+    if (window)
     {
-        webby_ws_printf("ERROR: Could not retrieve pid of launched game.\n");
+        uint32_t count = std::min(mbuf.window_before + 1 + mbuf.window_after, (uint32_t)VOGLPERF_HITCH_WINDOW);
 
-        // Close our game pipe handles.
-        update_app_output(data, true);
+        str += "\n    frames:";
+        for (uint32_t i = 0; i < count; i++)
+            str += string_format((i == mbuf.window_before) ? " [%.2f]" : " %.2f", mbuf.window[i] / 1000000.0);
     }
-    else
-    {
-        std::string banner(78, '#');
 
-        webby_ws_printf("\n%s\n", banner.c_str());
-        webby_ws_printf("Voglperf launched pid %" PRIu64 ".\n", data.run_data.pid);
-        webby_ws_printf("%s\n", banner.c_str());
-    }
+    return str;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -486,14 +962,74 @@ static std::string get_vogl_status_str(voglperf_data_t &data)
 
     status_str += string_format("  WS Connections: %u\n", webby_ws_get_connection_count());
 
-    if (data.run_data.pid != (uint64_t)-1)
+    if (data.run_data.state != GAME_STOPPED)
     {
+        static const char *s_states[] = { "stopped", "waiting for pid", "waiting for first frame", "running" };
+        double time_launch = ((data.run_data.time_first_frame ? data.run_data.time_first_frame : get_time_ns()) -
+                              data.run_data.time_launch) / 1000000000.0;
+
         status_str += string_format("  Game: %s\n", data.run_data.game_name.c_str());
+        status_str += string_format("  State: %s (%.2fs %s launch)\n", s_states[data.run_data.state], time_launch,
+                                    data.run_data.time_first_frame ? "first frame after" : "since");
         status_str += string_format("  Logfile: '%s'\n", data.logfile.c_str());
-        status_str += string_format("  Pid: %" PRIu64 "\n", data.run_data.pid);
+        if (data.run_data.pid != (uint64_t)-1)
+            status_str += string_format("  Pid: %" PRIu64 "\n", data.run_data.pid);
+        for (size_t i = 0; i < data.run_data.processes.size(); i++)
+        {
+            const voglperf_data_t::run_data_t::process_t &process = data.run_data.processes[i];
+
+            status_str += string_format("    Process %" PRIu64 " (parent %" PRIu64 "): %s%s%s%s\n",
+                                        process.pid, process.ppid, process.exe.c_str(),
+                                        (process.pid == data.run_data.render_pid) ? " [rendering]" : "",
+                                        (data.frame_ring && !(process.caps & VOGLPERF_CAP_FRAME_RING)) ? " [no frame ring]" : "",
+                                        process.exited ? " [exited]" : "");
+        }
+
+        if (data.run_data.frames_dropped)
+            status_str += string_format("  Frames dropped: %" PRIu64 "\n", data.run_data.frames_dropped);
+        status_str += string_format("  Hitches: %" PRIu64 "\n", data.run_data.hitch_count);
+        status_str += string_format("  High water: %" PRIu64 " messages (%" PRIu64 " of %" PRIu64 " bytes), %" PRIu64 " of %u frames\n",
+                                    data.run_data.msgs_high, data.run_data.msgs_high_bytes, data.run_data.msgs_capacity,
+                                    data.run_data.frames_high, data.frame_ring ? data.frame_ring->size : 0);
+        if (data.run_data.msgs_dropped)
+            status_str += string_format("  Messages dropped: %u\n", data.run_data.msgs_dropped);
+        if (data.run_data.msgs_rejected)
+            status_str += string_format("  Messages rejected (protocol version): %u\n", data.run_data.msgs_rejected);
+
+        for (size_t i = 0; i < data.run_data.surfaces.size(); i++)
+        {
+            if ((data.surface != -1) && ((size_t)data.surface != i))
+                continue;
+
+            const voglperf_data_t::run_data_t::frame_stats_t &stats = data.run_data.surfaces[i];
+            if (!stats.frame_count)
+                continue;
+
+            status_str += string_format("  Surface %u (drawable 0x%x):\n", (uint32_t)i, stats.drawable);
+            status_str += string_format("    Frames: %" PRIu64 " avg:%.2fms min:%.2fms max:%.2fms\n",
+                                        stats.frame_count,
+                                        stats.time_total / (stats.frame_count * 1000000.0),
+                                        stats.frame_min / 1000000.0, stats.frame_max / 1000000.0);
+            status_str += string_format("    Frame split avg cpu:%.2fms swap:%.2fms offcpu:%.2fms\n",
+                                        stats.time_cpu / (stats.frame_count * 1000000.0),
+                                        stats.time_swap / (stats.frame_count * 1000000.0),
+                                        voglperf_frame_off_cpu(stats.time_total, stats.time_cpu, stats.time_swap, stats.time_limit) /
+                                            (stats.frame_count * 1000000.0));
+            if (stats.time_limit)
+                status_str += string_format("    Frame limiter avg:%.2fms\n", stats.time_limit / (stats.frame_count * 1000000.0));
+            if (stats.gpu_count)
+                status_str += string_format("    GPU avg:%.2fms (%" PRIu64 " frames timed)\n",
+                                            stats.time_gpu / (stats.gpu_count * 1000000.0), stats.gpu_count);
+            status_str += string_format("    Run %s\n", get_hist_summary_str(stats.hist).c_str());
+        }
         status_str += data.run_data.launch_cmd;
     }
 
+    if (data.session_hist.count)
+        status_str += string_format("  Session %s\n", get_hist_summary_str(data.session_hist).c_str());
+    if (data.session_hitch_count)
+        status_str += string_format("  Session hitches: %" PRIu64 " (\"hitches\" lists them)\n", data.session_hitch_count);
+
     if (data.game_args.size())
         status_str += string_format("  Game Args: %s\n", data.game_args.c_str());
 
@@ -503,95 +1039,577 @@ static std::string get_vogl_status_str(voglperf_data_t &data)
         status_str += string_format("  %s: %s%s\n", g_options[i].name, (data.flags & g_options[i].flag) ? "On" : "Off",
                                     g_options[i].launch_setting ? launch_str.c_str() : "");
     }
+    status_str += data.fpslimit ? string_format("  fpslimit: %u\n", data.fpslimit) : "  fpslimit: Off\n";
+    status_str += string_format("  clock: %s%s\n", voglperf_clock_name(data.clock), launch_str.c_str());
+    status_str += data.flight_seconds ? string_format("  flight-seconds: %u%s\n", data.flight_seconds, launch_str.c_str()) :
+                                        string_format("  flight-seconds: Off%s\n", launch_str.c_str());
+    if (data.triggers.size())
+        status_str += string_format("  triggers: %u (\"trigger\" lists them)\n", (uint32_t)data.triggers.size());
 
     return status_str;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-// process_commands
+// send_msg
+//  Sends the first size bytes of mbuf to libvoglperf.so as a type message (see Wire format in voglperf.h).
 //----------------------------------------------------------------------------------------------------------------------
-static void process_commands(voglperf_data_t &data)
+static void send_msg(voglperf_data_t &data, uint16_t type, void *mbuf, size_t size, std::string &ws_reply)
 {
-    static const char *s_commands[] =
+    voglperf_msgbuf_t msgbuf;
+    size_t len = voglperf_msg_pack(&msgbuf, type, mbuf, size);
+
+    int ret = msgsnd(data.msqid, &msgbuf, len, IPC_NOWAIT);
+    if (ret == -1)
     {
-        "game start [steamid | filename]: Start game.",
-        "game stop: Send SIGTERM signal to game.",
+        ws_reply += string_format("ERROR: msgsnd failed: %s\n", strerror(errno));
+    }
+}
 
-        "game set (steamid | filename): Set gameid to launch.",
-        "game args: set game arguments.",
+//----------------------------------------------------------------------------------------------------------------------
+// use_control
+//  Whether commands can go through the frame ring's control block: the process they're for (or every one we know
+//  about before something renders) has to have said it's reading it. Otherwise they go through the message queue.
+//----------------------------------------------------------------------------------------------------------------------
+static bool use_control(voglperf_data_t &data)
+{
+    if (!data.frame_ring)
+        return false;
 
-        "logfile start [seconds]: Start capturing frame time data to filename.",
-        "logfile stop: Stop capturing frame time data.",
+    for (size_t i = 0; i < data.run_data.processes.size(); i++)
+    {
+        const voglperf_data_t::run_data_t::process_t &process = data.run_data.processes[i];
 
-        "status: Print status and options.",
-        "quit: Quit voglperfrun.",
-    };
+        if (process.exited || (data.run_data.render_pid && (process.pid != data.run_data.render_pid)))
+            continue;
+        if (!(process.caps & VOGLPERF_CAP_CONTROL))
+            return false;
+    }
+    return true;
+}
 
-    for (size_t i = 0; i < data.commands.size(); i++)
+//----------------------------------------------------------------------------------------------------------------------
+// send_control_command
+//  Queues a logfile command in the frame ring's control block for the rendering process. post is how long a dump
+//  waits before it's written (see voglperf_command_t).
+//----------------------------------------------------------------------------------------------------------------------
+static void send_control_command(voglperf_data_t &data, uint32_t type, const std::string &logfile, uint64_t seconds,
+                                 uint32_t post)
+{
+    voglperf_control_t *control = &data.frame_ring->control;
+    voglperf_command_t *command = &control->commands[control->command_count % VOGLPERF_CONTROL_COMMANDS];
+
+    voglperf_control_write_begin(control);
+    command->type = type;
+    command->post = post;
+    command->pid = data.run_data.render_pid;
+    command->seconds = seconds;
+    snprintf(command->logfile, sizeof(command->logfile), "%s", logfile.c_str());
+    control->command_count++;
+    voglperf_control_write_end(control);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// send_options_msg
+//  Pass options which can change while the game runs on to libvoglperf.so. Like the other send_*_msg helpers this
+//  goes through the frame ring's control block if the game is reading it, otherwise the message queue.
+//----------------------------------------------------------------------------------------------------------------------
+static void send_options_msg(voglperf_data_t &data, std::string &ws_reply)
+{
+    if (use_control(data))
     {
-        bool handled = false;
-        std::string ws_reply;
-        std::vector<std::string> args;
-        std::string &command = data.commands[i];
+        voglperf_control_t *control = &data.frame_ring->control;
+
+        voglperf_control_write_begin(control);
+        control->pid = data.run_data.render_pid;
+        control->fpsshow = !!(data.flags & F_FPSSHOW);
+        control->verbose = !!(data.flags & F_VERBOSE);
+        control->fpslimit = data.fpslimit;
+        control->options_count++;
+        voglperf_control_write_end(control);
+        return;
+    }
 
-        printf("> %s\n", command.c_str());
+    mbuf_options_t mbuf;
 
-        string_split(args, command, " ");
+    mbuf.fpsshow = !!(data.flags & F_FPSSHOW);
+    mbuf.verbose = !!(data.flags & F_VERBOSE);
+    mbuf.fpslimit = data.fpslimit;
 
-        bool on = (args[1] == "on" || args[1] == "1");
-        bool off = (args[1] == "off" || args[1] == "0");
-        if (on && (data.run_data.pid != (uint64_t)-1) && (args[0] == "logfile"))
-        {
-            // Special case someone typing "logfile on" while the game is running.
-            // Turn it into a "logfile start" command.
-            args[1] = "start";
-        }
-        else if (!args[1].size() || on || off)
-        {
-            unsigned int flags_orig = data.flags;
+    send_msg(data, MSGTYPE_OPTIONS, &mbuf, sizeof(mbuf), ws_reply);
+}
 
-            for (size_t j = 0; j < sizeof(g_options) / sizeof(g_options[0]); j++)
-            {
-                if (args[0] == g_options[j].name)
-                {
-                    if (on)
-                        data.flags |= g_options[j].flag;
-                    else if(off)
-                        data.flags &= ~g_options[j].flag;
+//----------------------------------------------------------------------------------------------------------------------
+// send_logfile_start_msg
+//----------------------------------------------------------------------------------------------------------------------
+static void send_logfile_start_msg(voglperf_data_t &data, uint64_t seconds, std::string &ws_reply)
+{
+    std::string logfile = get_logfile_name(data.run_data.game_name, !!(data.flags & F_LOGBINARY));
 
-                    ws_reply += string_format("%s: %s\n", g_options[j].name, (data.flags & g_options[j].flag) ? "On" : "Off");
+    if (use_control(data))
+    {
+        send_control_command(data, MSGTYPE_LOGFILE_START, logfile, seconds, 0);
+        return;
+    }
 
-                    // This is a launch option and the game is already running - warn them.
-                    if (on && g_options[j].launch_setting && (data.run_data.pid != (uint64_t)-1))
-                        ws_reply += "  Option used with next game launch...\n";
+    mbuf_logfile_start_t mbuf;
 
-                    handled = true;
-                }
-            }
+    snprintf(mbuf.logfile, sizeof(mbuf.logfile), "%s", logfile.c_str());
+    mbuf.time = seconds;
 
-            if (data.run_data.pid != (uint64_t)-1)
-            {
-                // If the verbose or fpsshow args have changed, send msg.
-                if ((flags_orig ^ data.flags) & (F_VERBOSE | F_FPSSHOW))
-                {
-                    mbuf_options_t mbuf;
+    send_msg(data, MSGTYPE_LOGFILE_START, &mbuf, offsetof(mbuf_logfile_start_t, logfile) + strlen(mbuf.logfile) + 1, ws_reply);
+}
 
-                    mbuf.mtype = MSGTYPE_OPTIONS;
-                    mbuf.fpsshow = !!(data.flags & F_FPSSHOW);
-                    mbuf.verbose = !!(data.flags & F_VERBOSE);
+//----------------------------------------------------------------------------------------------------------------------
+// send_logfile_stop_msg
+//----------------------------------------------------------------------------------------------------------------------
+static void send_logfile_stop_msg(voglperf_data_t &data, std::string &ws_reply)
+{
+    if (use_control(data))
+    {
+        send_control_command(data, MSGTYPE_LOGFILE_STOP, "", 0, 0);
+        return;
+    }
 
-                    int ret = msgsnd(data.msqid, &mbuf, sizeof(mbuf) - sizeof(mbuf.mtype), IPC_NOWAIT);
-                    if (ret == -1)
-                    {
-                        ws_reply += string_format("ERROR: msgsnd failed: %s\n", strerror(errno));
-                    }
-                }
-            }
-        }
+    mbuf_logfile_stop_t mbuf;
 
-        if (handled)
-        {
-            // Handled with g_options above...
+    mbuf.logfile[0] = 0;
+
+    send_msg(data, MSGTYPE_LOGFILE_STOP, &mbuf, offsetof(mbuf_logfile_stop_t, logfile) + 1, ws_reply);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// send_logfile_dump_msg
+//  Has libvoglperf.so write the last seconds (0 for all) of its flight recorder to a new logfile.
+//----------------------------------------------------------------------------------------------------------------------
+static void send_logfile_dump_msg(voglperf_data_t &data, const char *name_suffix, uint64_t seconds, std::string &ws_reply)
+{
+    std::string logfile = get_logfile_name(data.run_data.game_name + name_suffix, !!(data.flags & F_LOGBINARY));
+
+    if (use_control(data))
+    {
+        send_control_command(data, MSGTYPE_LOGFILE_DUMP, logfile, seconds, 0);
+        return;
+    }
+
+    mbuf_logfile_start_t mbuf;
+
+    snprintf(mbuf.logfile, sizeof(mbuf.logfile), "%s", logfile.c_str());
+    mbuf.time = seconds;
+
+    send_msg(data, MSGTYPE_LOGFILE_DUMP, &mbuf, offsetof(mbuf_logfile_start_t, logfile) + strlen(mbuf.logfile) + 1, ws_reply);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// trigger_capture_send
+//  Hands the pending triggered capture to the rendering process, which keeps recording until capture_end and then
+//  writes it, or writes what it has if it exits first. Sent again as the capture is stretched.
+//----------------------------------------------------------------------------------------------------------------------
+static void trigger_capture_send(voglperf_data_t &data, uint64_t time_cur)
+{
+    voglperf_data_t::run_data_t &run_data = data.run_data;
+    uint64_t seconds = (time_cur - run_data.capture_start + 999999999) / 1000000000;
+    uint64_t post = (run_data.capture_end - time_cur + 999999999) / 1000000000;
+
+    if (run_data.capture_logfile.empty())
+        run_data.capture_logfile = get_logfile_name(run_data.game_name + ".trigger", !!(data.flags & F_LOGBINARY));
+
+    send_control_command(data, MSGTYPE_LOGFILE_DUMP, run_data.capture_logfile, seconds, (uint32_t)post);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// trigger_capture_dump
+//  The pending triggered capture's window is up, or a new one is starting. Dumps it unless the game is already
+//  taking care of that (trigger_capture_send).
+//----------------------------------------------------------------------------------------------------------------------
+static void trigger_capture_dump(voglperf_data_t &data, uint64_t time_cur)
+{
+    if (data.run_data.capture_logfile.empty())
+    {
+        std::string ws_reply;
+        uint64_t seconds = (time_cur - data.run_data.capture_start + 999999999) / 1000000000;
+
+        send_logfile_dump_msg(data, ".trigger", seconds, ws_reply);
+        if (ws_reply.size())
+            webby_ws_printf("%s", ws_reply.c_str());
+    }
+
+    data.run_data.capture_start = 0;
+    data.run_data.capture_end = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// update_triggers
+//  Checks trigger rules against a surface's fps summary, which covers the last time_covered ns of its frames.
+//----------------------------------------------------------------------------------------------------------------------
+static void update_triggers(voglperf_data_t &data, const mbuf_fps_t &mbuf, uint64_t time_covered)
+{
+    for (size_t i = 0; i < data.triggers.size(); i++)
+    {
+        voglperf_data_t::trigger_t &trigger = data.triggers[i];
+        double value = 0.0;
+
+        switch (trigger.metric)
+        {
+        case TRIGGER_METRIC_FPS:        value = mbuf.fps; break;
+        case TRIGGER_METRIC_LOW1:       value = mbuf.fps_low1; break;
+        case TRIGGER_METRIC_P50:        value = mbuf.frame_p50; break;
+        case TRIGGER_METRIC_P90:        value = mbuf.frame_p90; break;
+        case TRIGGER_METRIC_P99:        value = mbuf.frame_p99; break;
+        case TRIGGER_METRIC_P999:       value = mbuf.frame_p999; break;
+        case TRIGGER_METRIC_MAX:        value = mbuf.frame_max; break;
+        case TRIGGER_METRIC_HITCHES:    value = mbuf.hitches; break;
+        }
+
+        if (trigger.held.size() <= mbuf.surface)
+            trigger.held.resize(mbuf.surface + 1, 0);
+
+        uint64_t &held = trigger.held[mbuf.surface];
+        if (!(trigger.greater ? (value > trigger.value) : (value < trigger.value)))
+        {
+            held = 0;
+            continue;
+        }
+        held += time_covered;
+        if (held < (uint64_t)trigger.seconds * 1000000000)
+            continue;
+
+        // Fired. It has to hold for another trigger.seconds to fire again.
+        held = 0;
+        trigger.fired++;
+
+        webby_ws_printf("Trigger '%s' fired on surface %u (%s %.2f).\n", get_trigger_str(trigger).c_str(),
+                        mbuf.surface, g_trigger_metrics[trigger.metric].name, value);
+
+        if (!data.flight_seconds)
+        {
+            webby_ws_printf("ERROR: Flight recorder is off (--flight-seconds=0), nothing captured.\n");
+            continue;
+        }
+
+        uint64_t time_cur = get_time_ns();
+        uint64_t capture_max = (uint64_t)data.flight_seconds * 1000000000;
+        uint64_t capture_start = time_cur - std::min((uint64_t)(data.trigger_pre + trigger.seconds) * 1000000000, time_cur);
+        uint64_t capture_end = time_cur + (uint64_t)data.trigger_post * 1000000000;
+
+        if (data.run_data.capture_end)
+        {
+            // Same bad patch. Keep capturing through it, as long as the game still has the start of it.
+            if (capture_end - data.run_data.capture_start <= capture_max)
+            {
+                data.run_data.capture_end = capture_end;
+                if (data.run_data.capture_logfile.size())
+                    trigger_capture_send(data, time_cur);
+                continue;
+            }
+
+            // The game writes the one it's holding when it gets the new one.
+            trigger_capture_dump(data, time_cur);
+            capture_start = time_cur;
+        }
+
+        data.run_data.capture_start = std::max(capture_start, capture_end - std::min(capture_max, capture_end));
+        data.run_data.capture_end = capture_end;
+        data.run_data.capture_logfile.clear();
+        if (use_control(data))
+            trigger_capture_send(data, time_cur);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// update_trigger_stall
+//  A hung game doesn't send fps summaries, so once the rendering process has gone quiet its triggers get checked
+//  against a stalled second instead: no frames, and one frame that's lasted since the last summary.
+//----------------------------------------------------------------------------------------------------------------------
+static void update_trigger_stall(voglperf_data_t &data, uint64_t time_cur)
+{
+    voglperf_data_t::run_data_t &run_data = data.run_data;
+
+    if (!run_data.time_fps || (time_cur - run_data.time_fps < (uint64_t)TRIGGER_STALL_SECONDS * 1000000000))
+        return;
+    for (size_t i = 0; i < run_data.processes.size(); i++)
+    {
+        // Not hung, gone.
+        if ((run_data.processes[i].pid == run_data.render_pid) && run_data.processes[i].exited)
+            return;
+    }
+
+    uint64_t time_stall = time_cur - run_data.time_fps;
+    mbuf_fps_t mbuf;
+
+    memset(&mbuf, 0, sizeof(mbuf));
+    mbuf.surface = run_data.fps_surface;
+    mbuf.frame_p50 = (float)(time_stall / 1000000.0);
+    mbuf.frame_p90 = mbuf.frame_p50;
+    mbuf.frame_p99 = mbuf.frame_p50;
+    mbuf.frame_p999 = mbuf.frame_p50;
+    mbuf.frame_max = mbuf.frame_p50;
+    mbuf.hitches = 1;
+
+    update_triggers(data, mbuf, time_stall - run_data.time_stalled);
+    run_data.time_stalled = time_stall;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// recv_notify
+//  Next message libvoglperf.so queued, in the order they were sent. Returns its MSGTYPE_*_NOTIFY type, or 0 once
+//  there aren't any. Messages from a libvoglperf.so built with a different VOGLPERF_PROTOCOL_VERSION are skipped.
+//----------------------------------------------------------------------------------------------------------------------
+static uint16_t recv_notify(voglperf_data_t &data, voglperf_msgbuf_t &msgbuf, ssize_t &len)
+{
+    while ((len = msgrcv(data.msqid, &msgbuf, sizeof(msgbuf.mtext), VOGLPERF_MTYPE_NOTIFY, IPC_NOWAIT | MSG_NOERROR)) != -1)
+    {
+        voglperf_msg_header_t header = {};
+
+        memcpy(&header, msgbuf.mtext, std::min(sizeof(header), (size_t)len));
+        if ((len >= (ssize_t)sizeof(header)) && (header.version == VOGLPERF_PROTOCOL_VERSION) && header.type)
+            return header.type;
+
+        if (!data.run_data.msgs_rejected++)
+        {
+            webby_ws_printf("WARNING: libvoglperf.so speaks protocol version %u, we're %u. Rebuild them together.\n",
+                            header.version, VOGLPERF_PROTOCOL_VERSION);
+        }
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// update_render_process
+//  Picks out the process rendering: the latest to start swapping that's still running.
+//----------------------------------------------------------------------------------------------------------------------
+static void update_render_process(voglperf_data_t &data)
+{
+    typedef voglperf_data_t::run_data_t::process_t process_t;
+    voglperf_data_t::run_data_t &run_data = data.run_data;
+
+    const process_t *render = NULL;
+    const process_t *running = NULL;
+    for (size_t i = 0; i < run_data.processes.size(); i++)
+    {
+        const process_t &process = run_data.processes[i];
+
+        if (process.exited)
+            continue;
+        if (!running)
+            running = &process;
+        if (process.swap_order && (!render || (process.swap_order > render->swap_order)))
+            render = &process;
+    }
+
+    uint64_t render_pid = render ? render->pid : 0;
+    if (render_pid != run_data.render_pid)
+    {
+        std::string ws_reply;
+
+        // Stats are for the process rendering. Anything a launcher or splash screen drew before it doesn't count,
+        //  and its surfaces are numbered from 0 too.
+        if (run_data.render_pid && render_pid)
+            run_data.surfaces.clear();
+        run_data.time_fps = 0;
+
+        run_data.render_pid = render_pid;
+        if (render)
+            webby_ws_printf("Rendering process: %" PRIu64 " (%s)\n", render->pid, render->exe.c_str());
+
+        // Point commands at it and make sure it's using the options we have now.
+        send_options_msg(data, ws_reply);
+        if (ws_reply.size())
+            webby_ws_printf("%s", ws_reply.c_str());
+    }
+
+    // Until something renders, follow the first process that's still running.
+    if (render || running)
+        run_data.pid = render ? render->pid : running->pid;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_pid_msg
+//  A process libvoglperf.so is loaded in started, swapped its first frame or is exiting.
+//----------------------------------------------------------------------------------------------------------------------
+static void process_pid_msg(voglperf_data_t &data, mbuf_pid_t &mbuf)
+{
+    typedef voglperf_data_t::run_data_t::process_t process_t;
+    voglperf_data_t::run_data_t &run_data = data.run_data;
+    process_t *process = NULL;
+
+    mbuf.exe[sizeof(mbuf.exe) - 1] = 0;
+    for (size_t i = 0; i < run_data.processes.size(); i++)
+    {
+        if (run_data.processes[i].pid == mbuf.pid)
+            process = &run_data.processes[i];
+    }
+
+    if (mbuf.event == VOGLPERF_PROCESS_START)
+    {
+        // Same pid again means it exec'd something else.
+        if (!process)
+        {
+            run_data.processes.push_back(process_t());
+            process = &run_data.processes.back();
+
+            // Wakes us up the moment it exits.
+            process->pidfd = (int)syscall(SYS_pidfd_open, (pid_t)mbuf.pid, 0);
+            if ((process->pidfd != -1) && !event_add(data, process->pidfd, EVENT_PROCESS))
+            {
+                close(process->pidfd);
+                process->pidfd = -1;
+            }
+        }
+
+        process->pid = mbuf.pid;
+        process->ppid = mbuf.ppid;
+        process->exe = mbuf.exe;
+        process->caps = mbuf.caps;
+        process->swap_order = 0;
+        process->exited = false;
+
+        webby_ws_printf("Process %" PRIu64 " started (parent %" PRIu64 "): %s\n", mbuf.pid, mbuf.ppid, mbuf.exe);
+
+        // Forked or exec'd after "game stop" got to its parent.
+        if (run_data.stopping)
+            process_signal(*process, SIGTERM);
+    }
+    else if (process && (mbuf.event == VOGLPERF_PROCESS_SWAP) && !process->swap_order)
+    {
+        // Switch over before the messages it sends next.
+        process->swap_order = ++run_data.swap_count;
+        update_render_process(data);
+    }
+    else if (process && (mbuf.event == VOGLPERF_PROCESS_EXIT) && (process->pidfd == -1))
+    {
+        // With a pidfd we wait for it to actually be gone.
+        process->exited = true;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// update_processes
+//  Notices processes libvoglperf.so reported in from (process_pid_msg) exiting. Launch wrappers never swap, so
+//  they're only followed until something does.
+//----------------------------------------------------------------------------------------------------------------------
+static void update_processes(voglperf_data_t &data)
+{
+    typedef voglperf_data_t::run_data_t::process_t process_t;
+    voglperf_data_t::run_data_t &run_data = data.run_data;
+
+    // Crashed or killed processes don't get to say they're exiting, and the exit message can beat the process
+    //  actually going. A pidfd is readable once it's gone; without one, check /proc.
+    std::vector<struct pollfd> pollfds;
+    for (size_t i = 0; i < run_data.processes.size(); i++)
+    {
+        process_t &process = run_data.processes[i];
+
+        if (process.pidfd != -1)
+        {
+            struct pollfd pollfd = { process.pidfd, POLLIN, 0 };
+            pollfds.push_back(pollfd);
+        }
+        else if (!process.exited)
+        {
+            std::string proc_status_file = string_format("/proc/%" PRIu64 "/status", process.pid);
+
+            if (access(proc_status_file.c_str(), F_OK) != 0)
+                process.exited = true;
+        }
+    }
+    if (pollfds.size() && (poll(&pollfds[0], pollfds.size(), 0) > 0))
+    {
+        for (size_t i = 0, j = 0; i < run_data.processes.size(); i++)
+        {
+            process_t &process = run_data.processes[i];
+
+            if ((process.pidfd == -1) || !(pollfds[j++].revents & POLLIN))
+                continue;
+
+            // Closing it takes it out of the epoll set too.
+            close(process.pidfd);
+            process.pidfd = -1;
+            process.exited = true;
+        }
+    }
+
+    update_render_process(data);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_commands
+//----------------------------------------------------------------------------------------------------------------------
+static void process_commands(voglperf_data_t &data)
+{
+    static const char *s_commands[] =
+    {
+        "game start [steamid | filename]: Start game.",
+        "game stop: Send SIGTERM signal to game.",
+
+        "game set (steamid | filename): Set gameid to launch.",
+        "game args: set game arguments.",
+
+        "logfile start [seconds]: Start capturing frame time data to filename.",
+        "logfile stop: Stop capturing frame time data.",
+        "logfile dump [seconds]: Write out the last seconds of frame times (default all the game has kept).",
+        "trigger [add rule | clear | window pre post]: List or change rules that dump a logfile, e.g. 'trigger add p99 > 33ms for 2s'.",
+
+        "status: Print status and options.",
+        "surface [all | id]: List surfaces, or only show stats for one of them.",
+        "fpslimit [fps | off]: Cap the game's frame rate (takes effect on the next frame while running).",
+        "clock [monotonic | tsc]: Frame timestamp source for the next game launch.",
+        "hitches [count | all | clear]: List the last hitches this session (default 10).",
+        "quit: Quit voglperfrun.",
+    };
+
+    for (size_t i = 0; i < data.commands.size(); i++)
+    {
+        bool handled = false;
+        std::string ws_reply;
+        std::vector<std::string> args;
+        std::string &command = data.commands[i];
+
+        printf("> %s\n", command.c_str());
+
+        string_split(args, command, " ");
+
+        bool on = (args[1] == "on" || args[1] == "1");
+        bool off = (args[1] == "off" || args[1] == "0");
+        if (on && (data.run_data.pid != (uint64_t)-1) && (args[0] == "logfile"))
+        {
+            // Special case someone typing "logfile on" while the game is running.
+            // Turn it into a "logfile start" command.
+            args[1] = "start";
+        }
+        else if (!args[1].size() || on || off)
+        {
+            unsigned int flags_orig = data.flags;
+
+            for (size_t j = 0; j < sizeof(g_options) / sizeof(g_options[0]); j++)
+            {
+                if (args[0] == g_options[j].name)
+                {
+                    if (on)
+                        data.flags |= g_options[j].flag;
+                    else if(off)
+                        data.flags &= ~g_options[j].flag;
+
+                    ws_reply += string_format("%s: %s\n", g_options[j].name, (data.flags & g_options[j].flag) ? "On" : "Off");
+
+                    // This is a launch option and the game is already running - warn them.
+                    if (on && g_options[j].launch_setting && (data.run_data.state != GAME_STOPPED))
+                        ws_reply += "  Option used with next game launch...\n";
+
+                    handled = true;
+                }
+            }
+
+            if (data.run_data.pid != (uint64_t)-1)
+            {
+                // If the verbose or fpsshow args have changed, send msg.
+                if ((flags_orig ^ data.flags) & (F_VERBOSE | F_FPSSHOW))
+                    send_options_msg(data, ws_reply);
+            }
+        }
+
+        if (handled)
+        {
+            // Handled with g_options above...
         }
         else if (args[0] == "status")
         {
@@ -599,6 +1617,153 @@ static void process_commands(voglperf_data_t &data)
 
             handled = true;
         }
+        else if (args[0] == "surface")
+        {
+            if (args[1] == "all")
+            {
+                data.surface = -1;
+            }
+            else if (args[1].size())
+            {
+                char *end = NULL;
+                long surface = strtol(args[1].c_str(), &end, 10);
+
+                if (*end || (surface < 0))
+                    ws_reply += string_format("ERROR: Bad surface id '%s'.\n", args[1].c_str());
+                else
+                    data.surface = (int)surface;
+            }
+
+            for (size_t j = 0; j < data.run_data.surfaces.size(); j++)
+            {
+                const voglperf_data_t::run_data_t::frame_stats_t &stats = data.run_data.surfaces[j];
+
+                ws_reply += string_format("  %s%u: drawable 0x%x, %" PRIu64 " frames\n",
+                                          ((size_t)data.surface == j) ? "*" : " ", (uint32_t)j, stats.drawable, stats.frame_count);
+            }
+            ws_reply += (data.surface == -1) ? "Showing all surfaces.\n" : string_format("Showing surface %d.\n", data.surface);
+
+            handled = true;
+        }
+        else if (args[0] == "fpslimit")
+        {
+            if (off)
+            {
+                data.fpslimit = 0;
+            }
+            else if (args[1].size())
+            {
+                char *end = NULL;
+                long fpslimit = strtol(args[1].c_str(), &end, 10);
+
+                if (*end || (fpslimit <= 0) || (fpslimit > 100000))
+                    ws_reply += string_format("ERROR: Bad fpslimit '%s'.\n", args[1].c_str());
+                else
+                    data.fpslimit = (uint32_t)fpslimit;
+            }
+
+            if (args[1].size() && (data.run_data.pid != (uint64_t)-1))
+                send_options_msg(data, ws_reply);
+
+            ws_reply += data.fpslimit ? string_format("fpslimit: %u fps\n", data.fpslimit) : "fpslimit: Off\n";
+
+            handled = true;
+        }
+        else if (args[0] == "clock")
+        {
+            if (args[1] == voglperf_clock_name(VOGLPERF_CLOCK_TSC))
+                data.clock = VOGLPERF_CLOCK_TSC;
+            else if (args[1] == voglperf_clock_name(VOGLPERF_CLOCK_MONOTONIC))
+                data.clock = VOGLPERF_CLOCK_MONOTONIC;
+            else if (args[1].size())
+                ws_reply += string_format("ERROR: Bad clock '%s'. Expected monotonic or tsc.\n", args[1].c_str());
+
+            ws_reply += string_format("clock: %s\n", voglperf_clock_name(data.clock));
+            if (args[1].size() && (data.run_data.pid != (uint64_t)-1))
+                ws_reply += "  Option used with next game launch...\n";
+
+            handled = true;
+        }
+        else if (args[0] == "hitches")
+        {
+            size_t count = std::min(data.hitches.size(), (size_t)10);
+
+            if (args[1] == "clear")
+            {
+                data.hitches.clear();
+                data.session_hitch_count = 0;
+                count = 0;
+            }
+            else if (args[1] == "all")
+            {
+                count = data.hitches.size();
+            }
+            else if (args[1].size())
+            {
+                char *end = NULL;
+                long val = strtol(args[1].c_str(), &end, 10);
+
+                if (*end || (val < 0))
+                    ws_reply += string_format("ERROR: Bad hitch count '%s'.\n", args[1].c_str());
+                else
+                    count = std::min(data.hitches.size(), (size_t)val);
+            }
+
+            for (size_t j = data.hitches.size() - count; j < data.hitches.size(); j++)
+                ws_reply += "  " + get_hitch_str(data.hitches[j], true) + "\n";
+            ws_reply += string_format("%" PRIu64 " hitches this session.\n", data.session_hitch_count);
+
+            handled = true;
+        }
+        else if (args[0] == "trigger")
+        {
+            if (args[1] == "add")
+            {
+                voglperf_data_t::trigger_t trigger;
+                size_t rule = command.find("add") + 3;
+
+                if (parse_trigger(command.substr(rule), trigger))
+                    data.triggers.push_back(trigger);
+                else
+                    ws_reply += string_format("ERROR: Bad trigger '%s'. Expected METRIC < or > VALUE [SECONDS].\n", command.c_str() + rule);
+            }
+            else if (args[1] == "clear")
+            {
+                data.triggers.clear();
+            }
+            else if (args[1] == "window")
+            {
+                char *end_pre = NULL;
+                char *end_post = NULL;
+                long pre = strtol(args[2].c_str(), &end_pre, 10);
+                long post = strtol(args[3].c_str(), &end_post, 10);
+
+                if (!args[2].size() || !args[3].size() || *end_pre || *end_post ||
+                        (pre < 0) || (post < 0) || (pre > 3600) || (post > 3600))
+                {
+                    ws_reply += "ERROR: Expected 'trigger window pre post' in seconds.\n";
+                }
+                else
+                {
+                    data.trigger_pre = (uint32_t)pre;
+                    data.trigger_post = (uint32_t)post;
+                }
+            }
+            else if (args[1].size())
+            {
+                ws_reply += string_format("ERROR: Unknown trigger command '%s'.\n", args[1].c_str());
+            }
+
+            for (size_t j = 0; j < data.triggers.size(); j++)
+            {
+                ws_reply += string_format("  %u: %s (fired %" PRIu64 " times)\n", (uint32_t)j, get_trigger_str(data.triggers[j]).c_str(),
+                                          data.triggers[j].fired);
+            }
+            ws_reply += string_format("%u triggers, capturing %us before and %us after.\n", (uint32_t)data.triggers.size(),
+                                      data.trigger_pre, data.trigger_post);
+
+            handled = true;
+        }
         else if (args[0] == "help")
         {
             ws_reply += "Commands:\n";
@@ -660,35 +1825,20 @@ static void process_commands(voglperf_data_t &data)
             }
             else if (args[1] == "start")
             {
-                mbuf_logfile_start_t mbuf;
-                std::string logfile = get_logfile_name(data.run_data.game_name);
-
-                mbuf.mtype = MSGTYPE_LOGFILE_START;
-
-                strncpy(mbuf.logfile, logfile.c_str(), sizeof(mbuf.logfile));
-                mbuf.logfile[sizeof(mbuf.logfile) - 1] = 0;
-                mbuf.time = (uint64_t)atoi(args[2].c_str());
-
-                int ret = msgsnd(data.msqid, &mbuf, sizeof(mbuf) - sizeof(mbuf.mtype), IPC_NOWAIT);
-                if (ret == -1)
-                {
-                    ws_reply += string_format("ERROR: msgsnd failed: %s\n", strerror(errno));
-                }
+                send_logfile_start_msg(data, (uint64_t)atoi(args[2].c_str()), ws_reply);
 
                 handled = true;
             }
             else if (args[1] == "stop")
             {
-                mbuf_logfile_stop_t mbuf;
-
-                mbuf.mtype = MSGTYPE_LOGFILE_STOP;
-                mbuf.logfile[0] = 0;
+                send_logfile_stop_msg(data, ws_reply);
 
-                int ret = msgsnd(data.msqid, &mbuf, sizeof(mbuf) - sizeof(mbuf.mtype), IPC_NOWAIT);
-                if (ret == -1)
-                {
-                    ws_reply += string_format("ERROR: msgsnd failed: %s\n", strerror(errno));
-                }
+                handled = true;
+            }
+            else if (args[1] == "dump")
+            {
+                // Frames the game has already swapped, so give it a name of its own.
+                send_logfile_dump_msg(data, ".flight", (uint64_t)std::max(atoi(args[2].c_str()), 0), ws_reply);
 
                 handled = true;
             }
@@ -708,63 +1858,401 @@ static void process_commands(voglperf_data_t &data)
     data.commands.clear();
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// get_surface_stats
+//  Returns stats for surface id from the game, or NULL if the id is bogus.
+//----------------------------------------------------------------------------------------------------------------------
+static voglperf_data_t::run_data_t::frame_stats_t *get_surface_stats(voglperf_data_t &data, uint32_t surface)
+{
+    static const uint32_t s_max_surfaces = 256;
+
+    if (surface >= s_max_surfaces)
+        return NULL;
+
+    if (surface >= data.run_data.surfaces.size())
+        data.run_data.surfaces.resize(surface + 1);
+
+    return &data.run_data.surfaces[surface];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// update_high_water
+//  Notes how backed up the message queue and frame ring are just before they get drained.
+//----------------------------------------------------------------------------------------------------------------------
+static void update_high_water(voglperf_data_t &data)
+{
+    voglperf_data_t::run_data_t &run_data = data.run_data;
+    struct msqid_ds ds;
+
+    if (msgctl(data.msqid, IPC_STAT, &ds) == 0)
+    {
+        run_data.msgs_high = std::max(run_data.msgs_high, (uint64_t)ds.msg_qnum);
+        run_data.msgs_high_bytes = std::max(run_data.msgs_high_bytes, (uint64_t)ds.__msg_cbytes);
+        run_data.msgs_capacity = ds.msg_qbytes;
+    }
+
+    if (data.frame_ring)
+    {
+        uint64_t frames = __atomic_load_n(&data.frame_ring->write_index, __ATOMIC_ACQUIRE) - data.frame_ring->read_index;
+        run_data.frames_high = std::max(run_data.frames_high, frames);
+    }
+
+    // Over half full, a bigger burst or a slower wakeup could overflow one of them.
+    bool msgs_full = run_data.msgs_capacity && (run_data.msgs_high_bytes * 2 > run_data.msgs_capacity);
+    bool frames_full = data.frame_ring && (run_data.frames_high * 2 > data.frame_ring->size);
+    if (!run_data.high_water_warned && (msgs_full || frames_full))
+    {
+        webby_ws_printf("WARNING: %s over half full (see status).\n", msgs_full ? "Message queue" : "Frame ring");
+        run_data.high_water_warned = true;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// update_app_frames
+//----------------------------------------------------------------------------------------------------------------------
+static void update_app_frames(voglperf_data_t &data)
+{
+    if (!data.frame_ring)
+        return;
+
+    for (;;)
+    {
+        voglperf_frame_t frames[1024];
+        uint32_t count = voglperf_frame_ring_pop(data.frame_ring, frames, sizeof(frames) / sizeof(frames[0]));
+
+        if (count && !data.run_data.time_start)
+            data.run_data.time_start = frames[0].time;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            // Only frames from the rendering process, or the first one to swap before we've heard it has.
+            if (data.run_data.render_pid && (frames[i].pid != data.run_data.render_pid))
+                continue;
+
+            voglperf_data_t::run_data_t::frame_stats_t *surface_stats = get_surface_stats(data, frames[i].surface);
+            if (!surface_stats)
+                continue;
+
+            voglperf_data_t::run_data_t::frame_stats_t &stats = *surface_stats;
+
+            if (stats.time_last)
+            {
+                uint64_t time_frame = frames[i].time - stats.time_last;
+
+                stats.frame_count++;
+                stats.time_total += time_frame;
+                stats.frame_min = std::min(stats.frame_min, time_frame);
+                stats.frame_max = std::max(stats.frame_max, time_frame);
+                stats.time_cpu += frames[i].cpu_time;
+                stats.time_swap += frames[i].swap_time;
+                stats.time_limit += frames[i].limit_time;
+                if (frames[i].gpu_time)
+                {
+                    stats.time_gpu += frames[i].gpu_time;
+                    stats.gpu_count += frames[i].gpu_frames;
+                }
+                voglperf_hist_add(&stats.hist, time_frame);
+            }
+
+            stats.time_last = frames[i].time;
+        }
+
+        if (count < sizeof(frames) / sizeof(frames[0]))
+            break;
+    }
+
+    data.run_data.frames_dropped = __atomic_load_n(&data.frame_ring->dropped, __ATOMIC_RELAXED);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_fps_msg
+//  Each surface sends one a second.
+//----------------------------------------------------------------------------------------------------------------------
+static void process_fps_msg(voglperf_data_t &data, const mbuf_fps_t &mbuf_fps, std::string &output)
+{
+    // Running total, so the latest is the most that have been lost.
+    data.run_data.msgs_dropped = std::max(data.run_data.msgs_dropped, mbuf_fps.msgs_dropped);
+
+    // Launchers and splash screens swap too. Only the rendering process counts.
+    if (mbuf_fps.pid != data.run_data.render_pid)
+        return;
+
+    voglperf_data_t::run_data_t::frame_stats_t *stats = get_surface_stats(data, mbuf_fps.surface);
+    if (stats)
+        stats->drawable = mbuf_fps.drawable;
+
+    // The summary covers the frames in its second (frame_time), less whatever of that we already counted as hung.
+    uint64_t time_covered = (uint64_t)(mbuf_fps.frame_time * 1000000.0);
+
+    update_triggers(data, mbuf_fps, time_covered - std::min(data.run_data.time_stalled, time_covered));
+    data.run_data.time_fps = get_time_ns();
+    data.run_data.fps_surface = mbuf_fps.surface;
+    data.run_data.time_stalled = 0;
+
+    if ((data.flags & F_FPSPRINT) &&
+            ((data.surface == -1) || ((uint32_t)data.surface == mbuf_fps.surface)))
+    {
+        std::string dropped = mbuf_fps.dropped ? string_format(" dropped:%u", mbuf_fps.dropped) : "";
+        std::string gpu = mbuf_fps.frame_gpu ? string_format(" gpu:%.2fms", mbuf_fps.frame_gpu) : "";
+        std::string hitches = mbuf_fps.hitches ? string_format(" hitches:%u", mbuf_fps.hitches) : "";
+        std::string limit = mbuf_fps.frame_limit ? string_format(" limit:%.2fms limiterr:%.0fus", mbuf_fps.frame_limit,
+                                                                 mbuf_fps.limit_error * 1000.0f) : "";
+        std::string surface = (data.run_data.surfaces.size() > 1) ? string_format("[surface %u] ", mbuf_fps.surface) : "";
+
+        output += string_format("%s%.2f fps frames:%u time:%.2fms min:%.2fms max:%.2fms "
+                                "p50:%.2fms p90:%.2fms p99:%.2fms p99.9:%.2fms 1%%low:%.2ffps "
+                                "cpu:%.2fms swap:%.2fms offcpu:%.2fms%s%s%s%s\n",
+                                surface.c_str(), mbuf_fps.fps, mbuf_fps.frame_count, mbuf_fps.frame_time, mbuf_fps.frame_min, mbuf_fps.frame_max,
+                                mbuf_fps.frame_p50, mbuf_fps.frame_p90, mbuf_fps.frame_p99, mbuf_fps.frame_p999, mbuf_fps.fps_low1,
+                                mbuf_fps.frame_cpu, mbuf_fps.frame_swap, mbuf_fps.frame_off_cpu,
+                                gpu.c_str(), limit.c_str(), hitches.c_str(), dropped.c_str());
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_hitch_msg
+//  Hitch events, each with the frames around it.
+//----------------------------------------------------------------------------------------------------------------------
+static void process_hitch_msg(voglperf_data_t &data, const mbuf_hitch_t &mbuf_hitch, std::string &output)
+{
+    voglperf_data_t::hitch_t hitch;
+
+    if (mbuf_hitch.pid != data.run_data.render_pid)
+        return;
+
+    if (!data.run_data.time_start)
+        data.run_data.time_start = mbuf_hitch.time;
+
+    hitch.run = data.run_count;
+    hitch.time = (mbuf_hitch.time > data.run_data.time_start) ? (mbuf_hitch.time - data.run_data.time_start) / 1000000000.0 : 0.0;
+    hitch.mbuf = mbuf_hitch;
+
+    if (data.hitches.size() >= MAX_HITCHES)
+        data.hitches.erase(data.hitches.begin());
+    data.hitches.push_back(hitch);
+    data.run_data.hitch_count++;
+    data.session_hitch_count++;
+
+    if ((data.flags & F_FPSPRINT) &&
+            ((data.surface == -1) || ((uint32_t)data.surface == mbuf_hitch.surface)))
+    {
+        output += string_format("Hitch %s\n", get_hitch_str(hitch, false).c_str());
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_logfile_start_msg
+//----------------------------------------------------------------------------------------------------------------------
+static void process_logfile_start_msg(voglperf_data_t &data, const mbuf_logfile_start_t &mbuf_start, std::string &output)
+{
+    std::string time = mbuf_start.time ? string_format(" (%" PRId64 " seconds).", mbuf_start.time) : "";
+
+    output += string_format("Logfile started: %s%s\n", mbuf_start.logfile, time.c_str());
+    data.logfile = mbuf_start.logfile;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_logfile_stop_msg
+//----------------------------------------------------------------------------------------------------------------------
+static void process_logfile_stop_msg(voglperf_data_t &data, const mbuf_logfile_stop_t &mbuf_stop, std::string &output)
+{
+    std::string url = string_format("http://%s:%s/logfile%s\n", data.ipaddr.c_str(), data.port.c_str(), mbuf_stop.logfile);
+
+    output += string_format("Logfile stopped: <a href=\"%s\">%s</a>\n", url.c_str(), url.c_str());
+    data.logfile = "";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// process_logfile_dump_msg
+//----------------------------------------------------------------------------------------------------------------------
+static void process_logfile_dump_msg(voglperf_data_t &data, const mbuf_logfile_dump_t &mbuf_dump, std::string &output)
+{
+    // The game's written the triggered capture it was holding (or given up on it).
+    if (data.run_data.capture_logfile == mbuf_dump.logfile)
+    {
+        data.run_data.capture_start = 0;
+        data.run_data.capture_end = 0;
+        data.run_data.capture_logfile.clear();
+    }
+
+    if (mbuf_dump.frame_count)
+    {
+        std::string url = string_format("http://%s:%s/logfile%s\n", data.ipaddr.c_str(), data.port.c_str(), mbuf_dump.logfile);
+
+        output += string_format("Logfile dumped (%" PRIu64 " frames, %.2f seconds): <a href=\"%s\">%s</a>\n",
+                                mbuf_dump.frame_count, mbuf_dump.time / 1000000000.0, url.c_str(), url.c_str());
+    }
+    else
+    {
+        output += string_format("ERROR: Logfile dump to %s failed (flight recorder off or empty).\n", mbuf_dump.logfile);
+    }
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // update_app_messages
 //----------------------------------------------------------------------------------------------------------------------
 static void update_app_messages(voglperf_data_t &data)
 {
-    if (data.run_data.pid == (uint64_t)-1)
+    if (data.run_data.state == GAME_STOPPED)
         return;
 
-    bool app_finished = false;
+    update_high_water(data);
+
+    // Take everything libvoglperf.so has queued in one go, so a burst never backs up the queue, then handle it as a
+    //  batch with all the output going out in one write. It's handled in the order it was sent: a logfile stop
+    //  followed by the start replacing it has to end with the new logfile running.
+    voglperf_msgbuf_t msgbuf;
+    ssize_t len;
+    uint16_t type;
+    std::string output;
 
-    // Try to get FPS messages.
-    struct mbuf_fps_t mbuf_fps;
-    int ret = msgrcv(data.msqid, &mbuf_fps, sizeof(mbuf_fps) - sizeof(mbuf_fps.mtype), MSGTYPE_FPS_NOTIFY, IPC_NOWAIT);
-    if (ret != -1)
+    while ((type = recv_notify(data, msgbuf, len)))
     {
-        if (mbuf_fps.frame_count == (uint32_t)-1)
+        switch (type)
+        {
+        case MSGTYPE_PID_NOTIFY:
+        {
+            mbuf_pid_t mbuf;
+            if (voglperf_msg_unpack(&msgbuf, len, type, &mbuf, sizeof(mbuf)))
+                process_pid_msg(data, mbuf);
+            break;
+        }
+        case MSGTYPE_FPS_NOTIFY:
         {
-            // Frame count of -1 comes in when game exits.
-            app_finished = true;
+            mbuf_fps_t mbuf;
+            if (voglperf_msg_unpack(&msgbuf, len, type, &mbuf, sizeof(mbuf)))
+                process_fps_msg(data, mbuf, output);
+            break;
+        }
+        case MSGTYPE_HITCH_NOTIFY:
+        {
+            mbuf_hitch_t mbuf;
+            if (voglperf_msg_unpack(&msgbuf, len, type, &mbuf, sizeof(mbuf)))
+                process_hitch_msg(data, mbuf, output);
+            break;
+        }
+        case MSGTYPE_LOGFILE_START_NOTIFY:
+        {
+            mbuf_logfile_start_t mbuf;
+            if (voglperf_msg_unpack(&msgbuf, len, type, &mbuf, sizeof(mbuf)))
+                process_logfile_start_msg(data, mbuf, output);
+            break;
+        }
+        case MSGTYPE_LOGFILE_STOP_NOTIFY:
+        {
+            mbuf_logfile_stop_t mbuf;
+            if (voglperf_msg_unpack(&msgbuf, len, type, &mbuf, sizeof(mbuf)))
+                process_logfile_stop_msg(data, mbuf, output);
+            break;
         }
-        else  if (data.flags & F_FPSPRINT)
+        case MSGTYPE_LOGFILE_DUMP_NOTIFY:
         {
-            webby_ws_printf("%.2f fps frames:%u time:%.2fms min:%.2fms max:%.2fms\n",
-                            mbuf_fps.fps, mbuf_fps.frame_count, mbuf_fps.frame_time, mbuf_fps.frame_min, mbuf_fps.frame_max);
+            mbuf_logfile_dump_t mbuf;
+            if (voglperf_msg_unpack(&msgbuf, len, type, &mbuf, sizeof(mbuf)))
+                process_logfile_dump_msg(data, mbuf, output);
+            break;
+        }
         }
     }
 
-    struct mbuf_logfile_start_t mbuf_start;
-    ret = msgrcv(data.msqid, &mbuf_start, sizeof(mbuf_start) - sizeof(mbuf_start.mtype), MSGTYPE_LOGFILE_START_NOTIFY, IPC_NOWAIT);
-    if (ret != -1)
-    {
-        std::string time = mbuf_start.time ? string_format(" (%" PRId64 " seconds).", mbuf_start.time) : "";
+    // Keep track of which process is the game.
+    update_processes(data);
 
-        webby_ws_printf("Logfile started: %s%s\n", mbuf_start.logfile, time.c_str());
-        data.logfile = mbuf_start.logfile;
+    // Nothing has reported in yet.
+    if (data.run_data.pid == (uint64_t)-1)
+    {
+        if (output.size())
+            webby_ws_write_buffer(NULL, output.c_str(), output.size());
+        return;
     }
 
-    struct mbuf_logfile_stop_t mbuf_stop;
-    ret = msgrcv(data.msqid, &mbuf_stop, sizeof(mbuf_stop) - sizeof(mbuf_stop.mtype), MSGTYPE_LOGFILE_STOP_NOTIFY, IPC_NOWAIT);
-    if (ret != -1)
-    {
-        std::string url = string_format("http://%s:%s/logfile%s\n", data.ipaddr.c_str(), data.port.c_str(), mbuf_stop.logfile);
+    // Drain every frame time the game has pushed into our shared memory ring.
+    update_app_frames(data);
 
-        webby_ws_printf("Logfile stopped: <a href=\"%s\">%s</a>\n", url.c_str(), url.c_str());
-        data.logfile = "";
-    }
+    if (output.size())
+        webby_ws_write_buffer(NULL, output.c_str(), output.size());
+
+    uint64_t time_cur = get_time_ns();
+
+    update_trigger_stall(data, time_cur);
 
-    // Check if the app has finished.
-    std::string proc_status_file = string_format("/proc/%" PRIu64 "/status", data.run_data.pid);
+    // Triggered capture has run its course.
+    if (data.run_data.capture_end && (time_cur >= data.run_data.capture_end))
+        trigger_capture_dump(data, time_cur);
 
-    if (app_finished || (access(proc_status_file.c_str(), F_OK) != 0))
+    // The game has finished once every process it started has exited.
+    bool app_finished = true;
+    for (size_t i = 0; i < data.run_data.processes.size(); i++)
+        app_finished = app_finished && data.run_data.processes[i].exited;
+
+    if (app_finished)
     {
         // Close handles, etc.
         update_app_output(data, true);
 
+        // Fold this run into the session totals.
+        for (size_t i = 0; i < data.run_data.surfaces.size(); i++)
+        {
+            const voglperf_hist_t &hist = data.run_data.surfaces[i].hist;
+            if (hist.count)
+            {
+                webby_ws_printf("Surface %u run %s\n", (uint32_t)i, get_hist_summary_str(hist).c_str());
+                voglperf_hist_merge(&data.session_hist, &hist);
+            }
+        }
+
+        if (data.run_data.capture_logfile.size())
+            webby_ws_printf("ERROR: Game exited without writing the triggered capture to %s.\n", data.run_data.capture_logfile.c_str());
+        else if (data.run_data.capture_end)
+            webby_ws_printf("ERROR: Game exited before the triggered capture was dumped.\n");
+        if (data.run_data.state != GAME_RUNNING)
+            webby_ws_printf("ERROR: Game exited before its first frame.\n");
+
         // Set pid back to -1.
         data.run_data.pid = (uint64_t)-1;
+        data.run_data.state = GAME_STOPPED;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// update_game_launch
+//  Moves a launch along: waiting for a process to report in, then for the first frame.
+//----------------------------------------------------------------------------------------------------------------------
+static void update_game_launch(voglperf_data_t &data)
+{
+    voglperf_data_t::run_data_t &run_data = data.run_data;
+
+    if (run_data.state == GAME_WAIT_PID)
+    {
+        // update_app_messages has handled anything that reported in.
+        if (run_data.pid != (uint64_t)-1)
+        {
+            std::string banner(78, '#');
+
+            webby_ws_printf("\n%s\n", banner.c_str());
+            webby_ws_printf("Voglperf launched pid %" PRIu64 ".\n", run_data.pid);
+            webby_ws_printf("%s\n", banner.c_str());
+
+            run_data.state = GAME_WAIT_FRAME;
+            if (run_data.stop_pending)
+                game_stop(data);
+        }
+        else if (get_time_ns() - run_data.time_launch >= GAME_WAIT_PID_TIMEOUT * 1000000000ULL)
+        {
+            webby_ws_printf("ERROR: Could not retrieve pid of launched game.\n");
+
+            // Close our game pipe handles.
+            update_app_output(data, true);
+            run_data.state = GAME_STOPPED;
+        }
+    }
+
+    if ((run_data.state == GAME_WAIT_FRAME) && run_data.swap_count)
+    {
+        run_data.time_first_frame = get_time_ns();
+        run_data.state = GAME_RUNNING;
+
+        webby_ws_printf("First frame %.2fs after launch.\n", (run_data.time_first_frame - run_data.time_launch) / 1000000000.0);
     }
 }
 
@@ -788,7 +2276,13 @@ static std::string webby_uri_dispatch_callback(const char *request_uri, void *us
 
     if (!strncmp(logfile_str.c_str(), request_uri, logfile_str.size()))
     {
-        std::string file = get_file_contents(request_uri + sizeof(logfile_prefix) - 1);
+        const char *filename = request_uri + sizeof(logfile_prefix) - 1;
+
+        // Binary logfiles get served up as csv.
+        if (is_binary_logfile(filename))
+            return get_logfile_csv(filename);
+
+        std::string file = get_file_contents(filename);
         return file;
     }
 
@@ -861,6 +2355,7 @@ static void *editline_threadproc(void *arg)
                 pthread_mutex_lock(&data->lock);
                 data->thread_commands.push_back(command);
                 pthread_mutex_unlock(&data->lock);
+                eventfd_write(data->command_fd, 1);
 
                 history(myhistory, &ev, H_ENTER, line);
             }
@@ -875,6 +2370,33 @@ static void *editline_threadproc(void *arg)
     return NULL;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// get_event_timeout
+//  How long the main loop can sleep for (ms, -1 until something happens).
+//----------------------------------------------------------------------------------------------------------------------
+static int get_event_timeout(voglperf_data_t &data)
+{
+    if (data.commands.size())
+        return 0;
+    if (data.run_data.state == GAME_STOPPED)
+        return -1;
+
+    // Check in on the game once a second regardless, in case its doorbell can't reach us (say it's in a container
+    //  with its own network namespace) or processes have to be checked for through /proc. This also times out
+    //  launches that never report in.
+    int timeout = 1000;
+
+    // Wake up to dump a triggered capture on time.
+    if (data.run_data.capture_end)
+    {
+        uint64_t time = get_time_ns();
+        uint64_t wait = (data.run_data.capture_end > time) ? (data.run_data.capture_end - time + 999999) / 1000000 : 0;
+
+        timeout = (int)std::min(wait, (uint64_t)timeout);
+    }
+    return timeout;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // main
 //----------------------------------------------------------------------------------------------------------------------
@@ -908,6 +2430,17 @@ int main(int argc, char **argv)
         { "ipaddr"         , 'i' , "IPADDR" , 0 , "Web IP address."                                                         , 2 },
         { "port"           , 'p' , "PORT"   , 0 , "Web port."                                                               , 2 },
 
+        { "fpslimit"       , 'm' , "FPS"    , 0 , "Cap the game's frame rate at FPS without vsync."                         , 2 },
+        { "clock"          , 'o' , "CLOCK"  , 0 , "Frame timestamp source: monotonic (default) or tsc."                    , 2 },
+        { "hitch-factor"   , 'K' , "K"      , 0 , "Frames over K times the rolling median are hitches (default 2.5, 0 off).", 2 },
+        { "hitch-ms"       , 'B' , "MS"     , 0 , "Frames over MS milliseconds are hitches."                                , 2 },
+        { "flight-seconds" , 'F' , "SECONDS", 0 , "Seconds of frames kept for \"logfile dump\" (default 60, 0 off)."       , 2 },
+        { "trigger"        , 'T' , "RULE"   , 0 , "Dump a logfile when RULE holds, e.g. \"p99>33:2\" or \"fps<45:3\"."       , 2 },
+        { "trigger-window" , 'W' , "PRE:POST", 0 , "Seconds captured before and after a trigger (default 10:5)."          , 2 },
+
+        { "convert"        , 'c' , "LOGFILE", 0 , "Convert binary logfile to csv and exit."                                 , 3 },
+        { "convert-range"  , 'r' , "START:END", 0 , "Only convert frames between START and END seconds."                    , 3 },
+
         { "show-type-list" , -2  , 0        , 0 , "Produce list of whitespace-separated words used for command completion." , 3 },
         { "help"           , '?' , 0        , 0 , "Print this help message."                                                , 3 },
 
@@ -918,6 +2451,26 @@ int main(int argc, char **argv)
     struct argp argp = { &argp_options[0], parse_options, 0, "Vogl perf launcher.", NULL, NULL, NULL };
     argp_parse(&argp, argc, argv, ARGP_NO_HELP, 0, &data);
 
+    if (data.convert_file.size())
+    {
+        std::string csv = get_logfile_csv(data.convert_file.c_str(), data.convert_time_start, data.convert_time_end);
+        if (!csv.size())
+            return -1;
+
+        std::string csv_file = data.convert_file;
+        if (is_binary_logfile(csv_file))
+            csv_file.resize(csv_file.size() - strlen(VOGLPERF_LOG_EXTENSION));
+        csv_file += ".csv";
+
+        FILE *fp = fopen(csv_file.c_str(), "wb");
+        if (!fp || (fwrite(csv.c_str(), 1, csv.size(), fp) != csv.size()))
+            errorf("ERROR: Writing %s failed: %s\n", csv_file.c_str(), strerror(errno));
+        fclose(fp);
+
+        printf("Wrote %s\n", csv_file.c_str());
+        return 0;
+    }
+
     /*
      * Initialize our message queue used to communicate with our hook.
      */
@@ -927,6 +2480,50 @@ int main(int argc, char **argv)
         errorf("ERROR: msgget() failed: %s\n", strerror(errno));
     }
 
+    /*
+     * Shared memory ring the hook pushes every frame time into.
+     */
+    data.shmid = shmget(IPC_PRIVATE, voglperf_frame_ring_bytes(VOGLPERF_FRAME_RING_SIZE), IPC_CREAT | S_IRUSR | S_IWUSR);
+    if (data.shmid == -1)
+    {
+        printf("WARNING: shmget() failed: %s\n", strerror(errno));
+    }
+    else
+    {
+        void *addr = shmat(data.shmid, NULL, 0);
+        if (addr == (void *)-1)
+        {
+            printf("WARNING: shmat() failed: %s\n", strerror(errno));
+            shmctl(data.shmid, IPC_RMID, NULL);
+            data.shmid = -1;
+        }
+        else
+        {
+            data.frame_ring = (voglperf_frame_ring_t *)addr;
+            voglperf_frame_ring_init(data.frame_ring, VOGLPERF_FRAME_RING_SIZE);
+        }
+    }
+
+    /*
+     * Doorbell libvoglperf.so rings when it queues messages for us.
+     */
+    data.doorbell_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (data.doorbell_fd != -1)
+    {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, VOGLPERF_DOORBELL_NAME, data.msqid);
+
+        if (bind(data.doorbell_fd, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + 1 + len) != 0)
+        {
+            printf("WARNING: bind() doorbell failed: %s\n", strerror(errno));
+            close(data.doorbell_fd);
+            data.doorbell_fd = -1;
+        }
+    }
+
     /*
      * Start our web server...
      */
@@ -943,6 +2540,23 @@ int main(int argc, char **argv)
 
     pthread_mutex_init(&data.lock, NULL);
 
+    /*
+     * Everything the main loop waits on: web sockets, stdin commands, game output, hook messages and game processes
+     *  exiting. It sleeps until one of them has something for it.
+     */
+    data.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (data.epoll_fd == -1)
+        errorf("ERROR: epoll_create1() failed: %s\n", strerror(errno));
+
+    data.command_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (data.command_fd == -1)
+        errorf("ERROR: eventfd() failed: %s\n", strerror(errno));
+
+    event_add(data, webby_get_fd(), EVENT_WEBBY);
+    event_add(data, data.command_fd, EVENT_COMMAND);
+    if (data.doorbell_fd != -1)
+        event_add(data, data.doorbell_fd, EVENT_DOORBELL);
+
     pthread_t threadid = (pthread_t)-1;
     if (pthread_create(&threadid, NULL, &editline_threadproc, (void *)&data) != 0)
         printf("WARNING: pthread_create failed: %s\n", strerror(errno));
@@ -962,34 +2576,60 @@ int main(int argc, char **argv)
 
     while (!(data.flags & F_QUIT))
     {
-        struct timeval timeout;
+        struct epoll_event events[16];
+        int count = epoll_wait(data.epoll_fd, events, sizeof(events) / sizeof(events[0]), get_event_timeout(data));
 
-        // Handle commands from stdin.
-        if (data.thread_commands.size())
+        for (int i = 0; i < count; i++)
         {
-            pthread_mutex_lock(&data.lock);
-            data.commands.insert(data.commands.end(), data.thread_commands.begin(), data.thread_commands.end());
-            data.thread_commands.clear();
-            pthread_mutex_unlock(&data.lock);
+            switch (events[i].data.u64)
+            {
+            case EVENT_WEBBY:
+            {
+                // Update web page.
+                struct timeval timeout = { 0, 0 };
+                webby_update(&data.commands, &timeout);
+                break;
+            }
+            case EVENT_COMMAND:
+            {
+                // Handle commands from stdin.
+                eventfd_t value;
+                eventfd_read(data.command_fd, &value);
+
+                pthread_mutex_lock(&data.lock);
+                data.commands.insert(data.commands.end(), data.thread_commands.begin(), data.thread_commands.end());
+                data.thread_commands.clear();
+                pthread_mutex_unlock(&data.lock);
+                break;
+            }
+            case EVENT_OUTPUT:
+                // Grab output if game is running.
+                update_app_output(data);
+                break;
+            case EVENT_DOORBELL:
+            {
+                // Any number of rings just means there's messages waiting.
+                char buf[64];
+                while (recv(data.doorbell_fd, buf, sizeof(buf), 0) > 0)
+                    ;
+                break;
+            }
+            case EVENT_PROCESS:
+                // update_processes sees which.
+                break;
+            }
         }
 
-        // Have Webby wait .5s unless there are commands to execute.
-        timeout.tv_sec = 0;
-        timeout.tv_usec = data.commands.size() ? 5 : 500 * 1000;
-
-        // Update web page.
-        webby_update(&data.commands, &timeout);
-
         // Handle any commands.
         process_commands(data);
 
-        // Grab output if game is running.
-        update_app_output(data);
-
         // Grab messages from running game.
         update_app_messages(data);
 
-        if (quit_on_game_exit && (data.run_data.pid == (uint64_t)-1))
+        // Move a game launch along.
+        update_game_launch(data);
+
+        if (quit_on_game_exit && (data.run_data.state == GAME_STOPPED))
             data.commands.push_back("quit");
     }
 
@@ -1011,8 +2651,22 @@ int main(int argc, char **argv)
 
     pthread_mutex_destroy(&data.lock);
 
+    close(data.epoll_fd);
+    close(data.command_fd);
+    if (data.doorbell_fd != -1)
+        close(data.doorbell_fd);
+
     // Destroy our message queue.
     msgctl(data.msqid, IPC_RMID, NULL);
     data.msqid = -1;
+
+    // Destroy our frame ring.
+    if (data.frame_ring)
+    {
+        shmdt(data.frame_ring);
+        shmctl(data.shmid, IPC_RMID, NULL);
+        data.frame_ring = NULL;
+        data.shmid = -1;
+    }
     return 0;
 }
@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <unistd.h>
 #include <libgen.h>
@@ -33,9 +35,11 @@
 #include <errno.h>
 #include <pwd.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
 
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
 
 #include <ifaddrs.h>
 #include <netinet/in.h>
@@ -44,6 +48,8 @@
 
 #include "webby/webby.h"
 #include "voglutils.h"
+#include "voglperf.h"
+#include "voglperf_log.h"
 
 struct webby_data_t
 {
@@ -60,6 +66,10 @@ struct webby_data_t
     int memory_size;
     struct WebbyServer *server;
     struct WebbyServerConfig config;
+
+    // Watches the server's sockets for webby_get_fd.
+    int epoll_fd;
+    std::vector<int> epoll_sockets;
 };
 static inline webby_data_t& webby_data()
 {
@@ -297,7 +307,7 @@ std::string url_encode(const std::string &value)
 //----------------------------------------------------------------------------------------------------------------------
 // get_logfile_name
 //----------------------------------------------------------------------------------------------------------------------
-std::string get_logfile_name(std::string basename_str)
+std::string get_logfile_name(std::string basename_str, bool binary)
 {
     char timestr[128];
     time_t t = time(NULL);
@@ -316,7 +326,243 @@ std::string get_logfile_name(std::string basename_str)
             basename[i] = '-';
     }
 
-    return string_format("%s/voglperf.%s.%s.csv", P_tmpdir, basename.c_str(), timestr);
+    // Names handed out in the same second get a -2, -3, etc. so commands issued back to back (a couple of flight
+    //  recorder dumps, say) don't overwrite each other. The files don't exist yet, so we can't check for them.
+    static std::string s_last_name;
+    static uint32_t s_repeat = 0;
+
+    std::string name = string_format("%s/voglperf.%s.%s", P_tmpdir, basename.c_str(), timestr);
+    s_repeat = (name == s_last_name) ? (s_repeat + 1) : 1;
+    s_last_name = name;
+    if (s_repeat > 1)
+        name += string_format("-%u", s_repeat);
+
+    return name + (binary ? VOGLPERF_LOG_EXTENSION : ".csv");
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// is_binary_logfile
+//----------------------------------------------------------------------------------------------------------------------
+bool is_binary_logfile(const std::string &filename)
+{
+    static const std::string ext = VOGLPERF_LOG_EXTENSION;
+
+    return (filename.size() >= ext.size()) && !filename.compare(filename.size() - ext.size(), ext.size(), ext);
+}
+
+static bool logfile_index_compare(const voglperf_log_index_t &index, uint64_t time)
+{
+    return index.time_end < time;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// get_logfile_csv
+//  Convert frames in [time_start, time_end] seconds (time_end < 0 for all) of a binary logfile to csv text.
+//----------------------------------------------------------------------------------------------------------------------
+std::string get_logfile_csv(const char *filename, double time_start, double time_end)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        webby_ws_printf("WARNING: Opening %s failed: %s\n", filename, strerror(errno));
+        return "";
+    }
+
+    // Counts and sizes in the file get checked against its size before we allocate anything for them, so a
+    //  truncated or corrupt logfile can't have us allocate more than it holds.
+    struct stat st;
+    uint64_t file_size = (fstat(fileno(fp), &st) == 0) ? (uint64_t)st.st_size : 0;
+
+    voglperf_log_header_t header;
+    if ((fread(&header, sizeof(header), 1, fp) != 1) ||
+            memcmp(header.magic, VOGLPERF_LOG_MAGIC, sizeof(header.magic)) ||
+            (header.version != VOGLPERF_LOG_VERSION))
+    {
+        webby_ws_printf("WARNING: %s is not a version %u voglperf logfile.\n", filename, VOGLPERF_LOG_VERSION);
+        fclose(fp);
+        return "";
+    }
+
+    // Logfiles written before the dropped count and clock were added have a smaller header.
+    if (header.header_size < offsetof(voglperf_log_header_t, clock))
+        header.dropped = 0;
+    if (header.header_size < sizeof(header))
+    {
+        header.clock = VOGLPERF_CLOCK_MONOTONIC;
+        header.tsc_hz = 0;
+    }
+
+    // Use the block index if the logfile was closed, otherwise walk the block headers.
+    std::vector<voglperf_log_index_t> index;
+    if (header.index_offset && header.block_count && (header.index_offset <= file_size) &&
+            (header.block_count <= (file_size - header.index_offset) / sizeof(voglperf_log_index_t)))
+    {
+        index.resize(header.block_count);
+        if (fseeko(fp, header.index_offset, SEEK_SET) || (fread(&index[0], sizeof(index[0]), index.size(), fp) != index.size()))
+            index.clear();
+    }
+
+    if (index.empty())
+    {
+        off_t offset = header.header_size;
+
+        for (;;)
+        {
+            voglperf_log_block_t block;
+
+            if (fseeko(fp, offset, SEEK_SET) || (fread(&block, sizeof(block), 1, fp) != 1) ||
+                    (block.magic != VOGLPERF_LOG_BLOCK_MAGIC) ||
+                    ((uint64_t)offset + sizeof(block) + block.data_size > file_size))
+                break;
+
+            voglperf_log_index_t entry;
+            entry.time_base = block.time_base;
+            entry.time_end = block.time_end;
+            entry.offset = offset;
+            entry.frame_count = block.frame_count;
+            entry.pad = 0;
+            index.push_back(entry);
+
+            offset += sizeof(block) + block.data_size;
+        }
+
+        if (!index.empty())
+            header.time_start = index[0].time_base;
+    }
+
+    uint64_t time_start_ns = header.time_start + (uint64_t)(std::max(time_start, 0.0) * 1000000000.0);
+    uint64_t time_end_ns = (time_end < 0) ? (uint64_t)-1 : header.time_start + (uint64_t)(time_end * 1000000000.0);
+
+    char timebuf[256];
+    struct tm now_tm;
+    time_t wall_time = (time_t)header.wall_time;
+
+    strftime(timebuf, sizeof(timebuf), "%h %e %T", localtime_r(&wall_time, &now_tm));
+    header.program[sizeof(header.program) - 1] = 0;
+
+    std::string csv = string_format("# %s - %s\n", timebuf, header.program);
+    csv += string_format("# dropped frames: %20" PRIu64 "\n", header.dropped);
+    if (header.clock == VOGLPERF_CLOCK_TSC)
+        csv += string_format("# clock: tsc %" PRIu64 " Hz\n", header.tsc_hz);
+    else
+        csv += string_format("# clock: %s\n", voglperf_clock_name(header.clock));
+    if (header.channels & ~(1 << VOGLPERF_LOG_CHANNEL_FRAME_TIME))
+    {
+        csv += "# frame_ms";
+        if (header.channels & (1 << VOGLPERF_LOG_CHANNEL_CPU_TIME))
+            csv += ", cpu_ms, swap_ms, offcpu_ms";
+        if (header.channels & (1 << VOGLPERF_LOG_CHANNEL_SURFACE))
+            csv += ", surface";
+        if (header.channels & (1 << VOGLPERF_LOG_CHANNEL_GPU_TIME))
+            csv += ", gpu_ms";
+        if (header.channels & (1 << VOGLPERF_LOG_CHANNEL_LIMIT_TIME))
+            csv += ", limit_ms";
+        csv += "\n";
+    }
+
+    // Last frame time of each surface so we can print per surface frame times.
+    std::vector<uint64_t> surface_time_last;
+
+    // Skip straight to the first block which ends after time_start.
+    std::vector<voglperf_log_index_t>::iterator it = std::lower_bound(index.begin(), index.end(), time_start_ns, logfile_index_compare);
+
+    std::vector<uint8_t> data;
+    for (; (it != index.end()) && (it->time_base <= time_end_ns); ++it)
+    {
+        voglperf_log_block_t block;
+
+        if (fseeko(fp, it->offset, SEEK_SET) || (fread(&block, sizeof(block), 1, fp) != 1) ||
+                (block.magic != VOGLPERF_LOG_BLOCK_MAGIC))
+        {
+            webby_ws_printf("WARNING: Bad block at offset %" PRIu64 " in %s.\n", it->offset, filename);
+            break;
+        }
+
+        // Every value takes at least a byte, so a block can't hold more frames than it has bytes.
+        if (((uint64_t)it->offset + sizeof(block) + block.data_size > file_size) || (block.frame_count > block.data_size))
+        {
+            webby_ws_printf("WARNING: Corrupt block at offset %" PRIu64 " in %s.\n", it->offset, filename);
+            break;
+        }
+
+        data.resize(block.data_size);
+        if (block.data_size && (fread(&data[0], 1, data.size(), fp) != data.size()))
+        {
+            webby_ws_printf("WARNING: Truncated block at offset %" PRIu64 " in %s.\n", it->offset, filename);
+            break;
+        }
+
+        // Columns are stored in channel order, each with a value per frame.
+        const uint8_t *src = data.empty() ? NULL : &data[0];
+        const uint8_t *src_end = src + data.size();
+
+        std::vector<uint64_t> values[VOGLPERF_LOG_CHANNEL_COUNT];
+        for (uint32_t channel = 0; channel < VOGLPERF_LOG_CHANNEL_COUNT; channel++)
+        {
+            if (!(block.channels & (1 << channel)))
+                continue;
+
+            values[channel].resize(block.frame_count);
+            for (uint32_t i = 0; (i < block.frame_count) && src; i++)
+                src = voglperf_varint_read(src, src_end, &values[channel][i]);
+        }
+
+        if (!src)
+        {
+            webby_ws_printf("WARNING: Corrupt block at offset %" PRIu64 " in %s.\n", it->offset, filename);
+            break;
+        }
+
+        const std::vector<uint64_t> &frame_times = values[VOGLPERF_LOG_CHANNEL_FRAME_TIME];
+        const std::vector<uint64_t> &cpu_times = values[VOGLPERF_LOG_CHANNEL_CPU_TIME];
+        const std::vector<uint64_t> &swap_times = values[VOGLPERF_LOG_CHANNEL_SWAP_TIME];
+        const std::vector<uint64_t> &gpu_times = values[VOGLPERF_LOG_CHANNEL_GPU_TIME];
+        const std::vector<uint64_t> &surfaces = values[VOGLPERF_LOG_CHANNEL_SURFACE];
+        const std::vector<uint64_t> &limit_times = values[VOGLPERF_LOG_CHANNEL_LIMIT_TIME];
+        const std::vector<uint64_t> &hitch_medians = values[VOGLPERF_LOG_CHANNEL_HITCH_MEDIAN];
+        uint64_t time = block.time_base;
+
+        for (uint32_t i = 0; i < frame_times.size(); i++)
+        {
+            // Frame times are from the previous frame on any surface. Make them per surface.
+            uint64_t time_frame = frame_times[i];
+            uint64_t surface = surfaces.empty() ? 0 : surfaces[i];
+
+            time += time_frame;
+            if (surface < 0x10000)
+            {
+                if (surface >= surface_time_last.size())
+                    surface_time_last.resize(surface + 1, 0);
+                if (surface_time_last[surface])
+                    time_frame = time - surface_time_last[surface];
+                surface_time_last[surface] = time;
+            }
+
+            if ((time < time_start_ns) || (time > time_end_ns))
+                continue;
+
+            csv += string_format("%.2f", time_frame / 1000000.0);
+            if (!cpu_times.empty() && !swap_times.empty())
+            {
+                uint64_t limit_time = limit_times.empty() ? 0 : limit_times[i];
+
+                csv += string_format(", %.2f, %.2f, %.2f", cpu_times[i] / 1000000.0, swap_times[i] / 1000000.0,
+                                     voglperf_frame_off_cpu(time_frame, cpu_times[i], swap_times[i], limit_time) / 1000000.0);
+            }
+            if (!surfaces.empty())
+                csv += string_format(", %" PRIu64, surface);
+            if (!gpu_times.empty())
+                csv += string_format(", %.2f", gpu_times[i] / 1000000.0);
+            if (!limit_times.empty())
+                csv += string_format(", %.2f", limit_times[i] / 1000000.0);
+            csv += "\n";
+            if (!hitch_medians.empty() && hitch_medians[i])
+                csv += string_format(VOGLPERF_LOG_CSV_HITCH_FORMAT, time_frame / 1000000.0, hitch_medians[i] / 1000000.0);
+        }
+    }
+
+    fclose(fp);
+    return csv;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -473,6 +719,25 @@ std::string get_ld_preload_str(const char *lib32, const char *lib64, bool do_ld_
     return ld_preload_str;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// get_vulkan_layer_str
+//----------------------------------------------------------------------------------------------------------------------
+std::string get_vulkan_layer_str()
+{
+    // The loader looks for implicit layer manifests in $XDG_DATA_DIRS/vulkan/implicit_layer.d, which works with
+    // any loader version. VOGLPERF_VULKAN=1 is the manifest's enable_environment.
+    static const char s_layer_dir[] = "vulkan/implicit_layer.d";
+    std::string layer_dir = get_full_path(s_layer_dir);
+
+    // Not built with the Vulkan layer.
+    if (layer_dir == s_layer_dir)
+        return "";
+
+    std::string data_dir = layer_dir.substr(0, layer_dir.size() - sizeof(s_layer_dir));
+
+    return "VOGLPERF_VULKAN=1 XDG_DATA_DIRS=\"" + data_dir + ":${XDG_DATA_DIRS:-/usr/local/share:/usr/share}\"";
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // webby_write_buffer
 //----------------------------------------------------------------------------------------------------------------------
@@ -553,7 +818,7 @@ static int webby_dispatch(struct WebbyConnection *connection)
         }
     }
 
-    std::string index_html_file = get_config_dir() + "/index_v1.html";
+    std::string index_html_file = get_config_dir() + "/index_v2.html";
     std::string index_html = get_file_contents(index_html_file.c_str());
 
     if (!index_html.size())
@@ -720,6 +985,40 @@ static int webby_ws_frame(struct WebbyConnection *connection, const struct Webby
     return 0;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// webby_watch_sockets
+//  Sockets only open and close inside WebbyServerUpdate, so they're taken out of the epoll set before it runs (while
+//  each fd is still the socket that was added) and the current ones put back after.
+//----------------------------------------------------------------------------------------------------------------------
+static void webby_watch_sockets(bool watch)
+{
+    webby_data_t &webby = webby_data();
+
+    if (webby.epoll_fd == -1)
+        return;
+
+    for (size_t i = 0; i < webby.epoll_sockets.size(); i++)
+        epoll_ctl(webby.epoll_fd, EPOLL_CTL_DEL, webby.epoll_sockets[i], NULL);
+    webby.epoll_sockets.clear();
+
+    if (watch && webby.server)
+    {
+        size_t sockets[webby_data_t::MAX_WSCONN + 1];
+        int want_write[webby_data_t::MAX_WSCONN + 1];
+        int count = WebbyServerGetSockets(webby.server, sockets, want_write, webby_data_t::MAX_WSCONN + 1);
+
+        for (int i = 0; i < count; i++)
+        {
+            struct epoll_event event;
+
+            event.events = want_write[i] ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            event.data.fd = (int)sockets[i];
+            if (epoll_ctl(webby.epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event) == 0)
+                webby.epoll_sockets.push_back(event.data.fd);
+        }
+    }
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // webby_start
 //----------------------------------------------------------------------------------------------------------------------
@@ -757,6 +1056,11 @@ void webby_start(const webby_init_t& init)
     if (!webby_data().server)
         errorf("ERROR: Web server failed to initialize.\n");
 
+    webby_data().epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (webby_data().epoll_fd == -1)
+        errorf("ERROR: epoll_create1() failed: %s\n", strerror(errno));
+    webby_watch_sockets(true);
+
     printf("  Started http://%s:%u\n\n", webby_data().config.bind_address, webby_data().config.listening_port);
 }
 
@@ -767,7 +1071,9 @@ void webby_update(std::vector<std::string> *commands, struct timeval *timeoutval
 {
     if (webby_data().server)
     {
+        webby_watch_sockets(false);
         WebbyServerUpdate(webby_data().server, timeoutval);
+        webby_watch_sockets(true);
 
         // If we were passed a command array, add new commands to it.
         if (commands && webby_data().ws_commands.size())
@@ -778,6 +1084,14 @@ void webby_update(std::vector<std::string> *commands, struct timeval *timeoutval
     }
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// webby_get_fd
+//----------------------------------------------------------------------------------------------------------------------
+int webby_get_fd()
+{
+    return webby_data().epoll_fd;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // webby_end
 //----------------------------------------------------------------------------------------------------------------------
@@ -785,6 +1099,13 @@ void webby_end()
 {
     webby_data().ws_connections.empty();
 
+    webby_watch_sockets(false);
+    if (webby_data().epoll_fd != -1)
+    {
+        close(webby_data().epoll_fd);
+        webby_data().epoll_fd = -1;
+    }
+
     if (webby_data().server)
     {
         WebbyServerShutdown(webby_data().server);
@@ -33,10 +33,15 @@ std::string get_ip_addr();
 std::string get_file_contents(const char *filename);
 std::string string_format(const char *fmt, ...);
 std::string url_encode(const std::string &value);
-std::string get_logfile_name(std::string basename_str);
+std::string get_logfile_name(std::string basename_str, bool binary);
 std::string get_ld_preload_str(const char *lib32, const char *lib64, bool do_ld_debug);
+std::string get_vulkan_layer_str();
 void string_split(std::vector<std::string>& args, const std::string& str, const std::string& delims);
 
+// Binary (VOGLPERF_LOG_EXTENSION) logfile support.
+bool is_binary_logfile(const std::string &filename);
+std::string get_logfile_csv(const char *filename, double time_start = 0.0, double time_end = -1.0);
+
 // Spew fatal error message and die.
 void __attribute__ ((noreturn)) errorf(const char *format, ...);
 
@@ -65,6 +70,8 @@ struct webby_init_t
 void webby_start(const webby_init_t &init);
 void webby_end();
 void webby_update(std::vector<std::string> *commands, struct timeval *timeoutval);
+// epoll fd that's readable when webby_update has something to do.
+int webby_get_fd();
 void webby_ws_printf(const char *format, ...);
 void webby_ws_write_buffer(struct WebbyConnection *connection, const char *buffer, size_t buffer_len);
 unsigned int webby_ws_get_connection_count();
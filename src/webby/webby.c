@@ -1412,6 +1412,29 @@ WebbyServerUpdate(struct WebbyServer *srv, struct timeval *timeoutval)
   }
 }
 
+int
+WebbyServerGetSockets(struct WebbyServer *srv, size_t *sockets, int *want_write, int max)
+{
+  int i, count = 0;
+
+  /* Same sets WebbyServerUpdate() selects on */
+  if (srv->connection_count < srv->config.connection_max && count < max)
+  {
+    sockets[count] = (size_t) srv->socket;
+    want_write[count] = 0;
+    ++count;
+  }
+
+  for (i = 0; i < srv->connection_count && count < max; ++i)
+  {
+    sockets[count] = (size_t) srv->connections[i].socket;
+    want_write[count] = srv->connections[i].state == WBC_SEND_CONTINUE;
+    ++count;
+  }
+
+  return count;
+}
+
 static int wb_flush(struct WebbyBuffer *buf, webby_socket_t socket)
 {
   if (buf->used > 0)
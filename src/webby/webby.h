@@ -173,6 +173,14 @@ WebbyServerInit(struct WebbyServerConfig *config, void *memory, size_t memory_si
 void
 WebbyServerUpdate(struct WebbyServer *srv, struct timeval *timeoutval);
 
+/* Get the sockets WebbyServerUpdate() waits on, for callers with their own
+ * poll loop. Fills in up to max sockets and sets want_write for ones waiting to
+ * be written to. Returns the count. Sockets only change inside
+ * WebbyServerUpdate() and WebbyServerShutdown().
+ */
+int
+WebbyServerGetSockets(struct WebbyServer *srv, size_t *sockets, int *want_write, int max);
+
 /* Shutdown the server and close all sockets. */
 void
 WebbyServerShutdown(struct WebbyServer *srv);